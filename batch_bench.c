@@ -0,0 +1,146 @@
+/**********************************************************************
+ *
+ * Filename:    batch_bench.c
+ *
+ * Description: steps/sec of a big fleet of tiny machines, embedded
+ *              state_machine per heap object versus the batch pool.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o batch_bench batch_bench.c \
+ *            smbatch.c smtscan.c states.c getms.c "
+ * run: " ./batch_bench [machines [passes]] "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "smbatch.h"
+#include "bench.h"
+
+/* a toy device, a couple of registers the states poke */
+struct device {
+    uint32_t status;
+    uint32_t data;
+};
+
+/* classic layout, one heap object per machine */
+struct heap_device {
+    struct state_machine sm;
+    struct device dev;
+    char other[40];             /* the rest of a real user struct */
+};
+
+static inline int device_tick(struct device *dev)
+{
+    dev->data = dev->data * 1103515245 + 12345;
+    dev->status ^= dev->data >> 31;
+    return SM_RETURN_DONE;
+}
+
+static int heap_tick_state(struct state_machine *sm)
+{
+    struct heap_device *hd = cast_p_to_outer(
+            struct state_machine *, sm, struct heap_device, sm);
+
+    return device_tick(&hd->dev);
+}
+
+static int batch_tick_state(struct state_machine *sm)
+{
+    return device_tick(sm_batch_context(sm));
+}
+
+state_func heap_table[] = {
+    heap_tick_state,
+    heap_tick_state,
+    SM_JUMP(heap_table),
+};
+
+state_func batch_table[] = {
+    batch_tick_state,
+    batch_tick_state,
+    SM_JUMP(batch_table),
+};
+
+int main(int argc, char **argv)
+{
+    size_t machines = 1000000;
+    unsigned int passes = 20;
+    struct heap_device **fleet;
+    struct sm_batch_pool pool;
+    unsigned long steps;
+    uint64_t t0, heap_ns, batch_ns;
+    size_t i;
+    unsigned int p;
+
+    if (argc > 1)
+        machines = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        passes = strtoul(argv[2], NULL, 0);
+
+    /*
+     * heap fleet, allocated one by one and visited in a shuffled order like
+     * machines created and freed over a long run end up
+     */
+    fleet = malloc(machines * sizeof(*fleet));
+    for (i = 0; i < machines; i++) {
+        fleet[i] = calloc(1, sizeof(**fleet));
+        SM_SET_TABLE(&fleet[i]->sm, heap_table);
+        fleet[i]->dev.data = i;
+    }
+    srand(1);
+    for (i = machines - 1; i > 0; i--) {
+        size_t j = ((size_t)rand() * RAND_MAX + rand()) % (i + 1);
+        struct heap_device *t = fleet[i];
+
+        fleet[i] = fleet[j];
+        fleet[j] = t;
+    }
+    steps = 0;
+    t0 = bench_ns();
+    for (p = 0; p < passes; p++) {
+        for (i = 0; i < machines; i++) {
+            struct state_machine *sm = &fleet[i]->sm;
+            int ret;
+
+            do {
+                ret = sm_run_state(sm);
+                steps++;
+            } while (ret > 0 && sm->stateptrptr);
+        }
+    }
+    heap_ns = bench_ns() - t0;
+    printf("heap  %zu machines: %lu steps %.1f Msteps/s\n", machines, steps,
+           steps * 1e3 / heap_ns);
+
+    if (sm_batch_init(&pool, machines, sizeof(struct device)) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < machines; i++) {
+        struct device *dev = sm_batch_ctx(&pool, i);
+
+        sm_batch_set_table(&pool, i, batch_table);
+        dev->data = i;
+    }
+    steps = 0;
+    t0 = bench_ns();
+    for (p = 0; p < passes; p++)
+        steps += sm_run_batch(&pool, 0, machines);
+    batch_ns = bench_ns() - t0;
+    printf("batch %zu machines: %lu steps %.1f Msteps/s (%.2fx)\n", machines,
+           steps, steps * 1e3 / batch_ns, (double)heap_ns / batch_ns);
+
+    sm_batch_free(&pool);
+    for (i = 0; i < machines; i++)
+        free(fleet[i]);
+    free(fleet);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/**********************************************************************
+ *
+ * Filename:    bench.h
+ *
+ * Description: tiny timing helpers shared by the benchmark programs.
+ *
+ * Notes:       Linux only, uses CLOCK_MONOTONIC and the x86 TSC if there.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __BENCH_H__
+#define __BENCH_H__
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* wall clock in ns, for ns/op and ops/sec */
+static inline uint64_t bench_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* cpu cycle counter, 0 where there is none */
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* keep the optimizer from deleting a benchmarked result */
+#define bench_keep(x) __asm__ __volatile__("" : : "g"(x) : "memory")
+
+#endif //__BENCH_H__
@@ -0,0 +1,140 @@
+/**********************************************************************
+ *
+ * Filename:    bytecode_bench.c
+ *
+ * Description: table bytes and steps/sec of state_func tables against
+ *              their byte code conversion.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o bytecode_bench bytecode_bench.c \
+ *            smbc.c smlink.c states.c getms.c "
+ * run: " ./bytecode_bench [tables [rounds]] "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "smbc.h"
+#include "bench.h"
+
+static unsigned long work;
+
+/* a pile of distinct state functions, like a real program has */
+#define BENCH_STATE(n) \
+    static int state_##n(struct state_machine *sm) \
+    { \
+        (void)sm; \
+        work += n; \
+        return SM_RETURN_DONE; \
+    }
+BENCH_STATE(1) BENCH_STATE(2) BENCH_STATE(3) BENCH_STATE(4)
+BENCH_STATE(5) BENCH_STATE(6) BENCH_STATE(7) BENCH_STATE(8)
+BENCH_STATE(9) BENCH_STATE(10) BENCH_STATE(11) BENCH_STATE(12)
+BENCH_STATE(13) BENCH_STATE(14) BENCH_STATE(15) BENCH_STATE(16)
+
+static state_func states[] = {
+    state_1, state_2, state_3, state_4, state_5, state_6, state_7, state_8,
+    state_9, state_10, state_11, state_12, state_13, state_14, state_15,
+    state_16,
+};
+
+/* states per table, then a timer load and a jump to some other table */
+#define BENCH_STATES    12
+#define BENCH_SLOTS     (BENCH_STATES + 2 + 2)
+
+int main(int argc, char **argv)
+{
+    unsigned int ntables = argc > 1 ? atoi(argv[1]) : 4000;
+    unsigned int rounds = argc > 2 ? atoi(argv[2]) : 200;
+    struct smbc_table *tables = calloc(ntables, sizeof(*tables));
+    struct state_machine *c_fleet = calloc(ntables, sizeof(*c_fleet));
+    struct smbc_machine *bc_fleet = calloc(ntables, sizeof(*bc_fleet));
+    struct smbc_program prog;
+    unsigned long c_steps = 0, bc_steps = 0, c_work;
+    uint64_t c_ns, bc_ns;
+    size_t c_bytes, bc_bytes;
+    unsigned int t, r, s;
+
+    if (!tables || !c_fleet || !bc_fleet || !ntables)
+        return 1;
+    srand(1);
+    for (t = 0; t < ntables; t++) {
+        state_func *table = calloc(BENCH_SLOTS, sizeof(*table));
+
+        if (!table)
+            return 1;
+        for (s = 0; s < BENCH_STATES; s++)
+            table[s] = states[rand() % elements_of(states)];
+        table[s++] = sm_delay_ticks_state;
+        table[s++] = (state_func)(uintptr_t)SM_MS_TO_TICKS(1000);
+        table[s++] = sm_jump_table_state;
+        table[s] = (state_func)tables[0].table; /* fixed up below */
+        tables[t].table = table;
+        tables[t].nslots = BENCH_SLOTS;
+    }
+    for (t = 0; t < ntables; t++)
+        tables[t].table[BENCH_SLOTS - 1] =
+                (state_func)tables[rand() % ntables].table;
+    if (smbc_convert(tables, ntables, &prog) < 0) {
+        printf("conversion failed\n");
+        return 1;
+    }
+    c_bytes = (size_t)ntables * BENCH_SLOTS * sizeof(state_func);
+    bc_bytes = prog.size + prog.nfuncs * sizeof(state_func);
+
+    /* one machine per table, walks all over the tables */
+    for (t = 0; t < ntables; t++) {
+        c_fleet[t].stateptrptr = tables[t].table;
+        smbc_set_table(&prog, &bc_fleet[t], t);
+    }
+    work = 0;
+    c_ns = bench_ns();
+    for (r = 0; r < rounds; r++) {
+        for (t = 0; t < ntables; t++) {
+            int ret;
+
+            do {
+                ret = sm_run_state(&c_fleet[t]);
+                c_steps++;
+            } while (ret > 0 && c_fleet[t].stateptrptr);
+        }
+    }
+    c_ns = bench_ns() - c_ns;
+    c_work = work;
+    work = 0;
+    bc_ns = bench_ns();
+    for (r = 0; r < rounds; r++) {
+        for (t = 0; t < ntables; t++) {
+            int ret;
+
+            do {
+                ret = smbc_run_state(&prog, &bc_fleet[t]);
+                bc_steps++;
+            } while (ret > 0 && bc_fleet[t].pc);
+        }
+    }
+    bc_ns = bench_ns() - bc_ns;
+    if (work != c_work || bc_steps != c_steps)
+        printf("byte code ran differently!\n");
+
+    printf("format      table bytes  bytes/slot  steps/sec\n");
+    printf("state_func %12zu %11.2f %10.0f\n", c_bytes,
+           (double)c_bytes / (ntables * BENCH_SLOTS), c_steps * 1e9 / c_ns);
+    printf("byte code  %12zu %11.2f %10.0f\n", bc_bytes,
+           (double)bc_bytes / (ntables * BENCH_SLOTS),
+           bc_steps * 1e9 / bc_ns);
+    smbc_free(&prog);
+    for (t = 0; t < ntables; t++)
+        free(tables[t].table);
+    free(tables);
+    free(c_fleet);
+    free(bc_fleet);
+    return 0;
+}
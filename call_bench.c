@@ -0,0 +1,155 @@
+/**********************************************************************
+ *
+ * Filename:    call_bench.c
+ *
+ * Description: table bytes and speed of a shared sequence copied into
+ *              every table versus kept once and reached with SM_CALL.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -DSM_CALL_DEPTH=4 -o call_bench \
+ *            call_bench.c states.c getms.c "
+ * run: " ./call_bench [tables [machines [uses]]] "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "states.h"
+#include "bench.h"
+
+#define SEQ_STATES  10  /* states in the shared sequence */
+#define RUN_NS      500000000ULL
+
+struct worker {
+    struct state_machine sm;
+    struct sm_call_stack stack;
+    unsigned long work;         /* sequence states run */
+};
+
+#define cast_sm_to_worker(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct worker, sm))
+
+/* the sequence body, stands in for set timer, wait for fd, handle timeout */
+static int seq_state(struct state_machine *sm)
+{
+    cast_sm_to_worker(sm)->work++;
+    return SM_RETURN_DONE;
+}
+
+/* what each table does on its own between uses of the sequence */
+static int own_state(struct state_machine *sm)
+{
+    (void)sm;
+    return SM_RETURN_DONE;
+}
+
+/* tables[i]: uses x (own_state, sequence), SM_JUMP(start) */
+static state_func **build(unsigned int ntables, unsigned int uses,
+                          state_func *shared, size_t *bytes)
+{
+    state_func **tables = malloc(ntables * sizeof(*tables));
+    size_t per = shared ? 1 + SM_CALL_SLOTS : 1 + SEQ_STATES;
+    unsigned int t, u, k;
+
+    *bytes = 0;
+    for (t = 0; t < ntables; t++) {
+        size_t n = uses * per + 2;
+        state_func *p = tables[t] = malloc(n * sizeof(state_func));
+
+        *bytes += n * sizeof(state_func);
+        for (u = 0; u < uses; u++) {
+            *p++ = own_state;
+            if (shared) {
+                *p++ = sm_call_state;
+                *p++ = (state_func)shared;
+            } else {
+                for (k = 0; k < SEQ_STATES; k++)
+                    *p++ = seq_state;
+            }
+        }
+        *p++ = sm_jump_table_state;
+        *p = (state_func)tables[t];
+    }
+    return tables;
+}
+
+static double run(struct worker *fleet, size_t machines, state_func **tables,
+                  unsigned int ntables, unsigned long *steps)
+{
+    unsigned long work = 0;
+    uint64_t t0, ns;
+    size_t i;
+
+    for (i = 0; i < machines; i++) {
+        fleet[i].work = 0;
+        SM_SET_TABLE(&fleet[i].sm, tables[i % ntables]);
+        SM_SET_CALL_STACK(&fleet[i].sm, &fleet[i].stack);
+    }
+    *steps = 0;
+    t0 = bench_ns();
+    do {
+        for (i = 0; i < machines; i++) {
+            struct state_machine *sm = &fleet[i].sm;
+            int ret;
+
+            do {
+                ret = sm_run_state(sm);
+                ++*steps;
+            } while (ret > 0);
+        }
+    } while ((ns = bench_ns() - t0) < RUN_NS);
+    for (i = 0; i < machines; i++)
+        work += fleet[i].work;
+    return work * 1e3 / ns;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int ntables = 4096, uses = 4, t;
+    size_t machines = 16384, inline_bytes, call_bytes;
+    state_func shared[SEQ_STATES + 1];
+    state_func **inlined, **called;
+    struct worker *fleet;
+    unsigned long steps;
+    double rate;
+
+    if (argc > 1)
+        ntables = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        machines = strtoul(argv[2], NULL, 0);
+    if (argc > 3)
+        uses = strtoul(argv[3], NULL, 0);
+
+    for (t = 0; t < SEQ_STATES; t++)
+        shared[t] = seq_state;
+    shared[SEQ_STATES] = sm_ret_state;
+    inlined = build(ntables, uses, NULL, &inline_bytes);
+    called = build(ntables, uses, shared, &call_bytes);
+    call_bytes += sizeof(shared);
+    fleet = calloc(machines, sizeof(*fleet));
+
+    rate = run(fleet, machines, inlined, ntables, &steps);
+    printf("inline  %u tables: %7zu KB, %.1f M sequence states/s "
+           "(%lu steps)\n", ntables, inline_bytes >> 10, rate, steps);
+    rate = run(fleet, machines, called, ntables, &steps);
+    printf("SM_CALL %u tables: %7zu KB, %.1f M sequence states/s "
+           "(%lu steps)\n", ntables, call_bytes >> 10, rate, steps);
+    printf("tables %.1fx smaller\n", (double)inline_bytes / call_bytes);
+
+    for (t = 0; t < ntables; t++) {
+        free(inlined[t]);
+        free(called[t]);
+    }
+    free(inlined);
+    free(called);
+    free(fleet);
+    return 0;
+}
@@ -12,6 +12,8 @@
  * notice must not be changed or removed and no warranty is either
  * expressed or implied by its publication or distribution.
  **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
 #include <cdll.h>
 /*
  * cdll circular double linked list infrastructure
@@ -73,3 +75,368 @@ void cdll_swap_nodes(struct cdll *oldfirst, struct cdll *newfirst)
         cdll_insert_node_tail(newfirst, oldfirst);
     }
 }
+
+/* join the nodes of list between prev and next */
+static void cdll_join(struct cdll *list, struct cdll *prev,
+                      struct cdll *next)
+{
+    struct cdll *first = list->next;
+    struct cdll *last = list->prev;
+
+    first->prev = prev;
+    prev->next = first;
+    last->next = next;
+    next->prev = last;
+}
+
+void cdll_splice(struct cdll *list, struct cdll *head)
+{
+    if (!cdll_empty(list)) {
+        cdll_join(list, head, head->next);
+        cdll_init(list);
+    }
+}
+
+void cdll_splice_tail(struct cdll *list, struct cdll *head)
+{
+    if (!cdll_empty(list)) {
+        cdll_join(list, head->prev, head);
+        cdll_init(list);
+    }
+}
+
+void cdll_cut_position(struct cdll *list, struct cdll *head,
+                       struct cdll *entry)
+{
+    struct cdll *first = head->next;
+
+    if (entry == head || cdll_empty(head))
+        return;
+    list->next = first;
+    first->prev = list;
+    list->prev = entry;
+    head->next = entry->next;
+    head->next->prev = head;
+    entry->next = list;
+}
+
+/*
+ * merge sort, after the Linux list_sort(). While sorting the lists are
+ * NULL terminated singly linked through next, and prev chains the pending
+ * sorted sublists, sizes kept to powers of 2 by the bits of count so
+ * merges stay balanced (2:1 at worst) without any recursion or stack.
+ */
+#define cdll_node_obj(node, off) ((const void *)((char *)(node) - (off)))
+
+/* merge two NULL terminated lists, a's nodes first when equal */
+static struct cdll *cdll_merge_run(struct cdll *a, struct cdll *b, size_t off,
+                                   cdll_cmp_func cmp, void *priv)
+{
+    struct cdll *head = NULL;
+    struct cdll **tail = &head;
+
+    for (;;) {
+        if (cmp(priv, cdll_node_obj(a, off), cdll_node_obj(b, off)) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/* last merge, straight back into the circular list with prev links */
+static void cdll_merge_final(struct cdll *head, struct cdll *a,
+                             struct cdll *b, size_t off, cdll_cmp_func cmp,
+                             void *priv)
+{
+    struct cdll *tail = head;
+
+    for (;;) {
+        if (cmp(priv, cdll_node_obj(a, off), cdll_node_obj(b, off)) <= 0) {
+            tail->next = a;
+            a->prev = tail;
+            tail = a;
+            a = a->next;
+            if (!a)
+                break;
+        } else {
+            tail->next = b;
+            b->prev = tail;
+            tail = b;
+            b = b->next;
+            if (!b) {
+                b = a;
+                break;
+            }
+        }
+    }
+    /* the rest of the list left over */
+    do {
+        tail->next = b;
+        b->prev = tail;
+        tail = b;
+        b = b->next;
+    } while (b);
+    tail->next = head;
+    head->prev = tail;
+}
+
+void cdll_sort(struct cdll *head, size_t node_offset, cdll_cmp_func cmp,
+               void *priv)
+{
+    struct cdll *list = head->next;
+    struct cdll *pending = NULL;
+    size_t count = 0;
+
+    if (list == head->prev)
+        return; /* 0 or 1 nodes */
+    head->prev->next = NULL;
+
+    do {
+        struct cdll **tail = &pending;
+        size_t bits;
+
+        /* find the pending pair of equal size to merge, if any */
+        for (bits = count; bits & 1; bits >>= 1)
+            tail = &(*tail)->prev;
+        if (bits) {
+            struct cdll *a = *tail, *b = a->prev;
+
+            a = cdll_merge_run(b, a, node_offset, cmp, priv);
+            a->prev = b->prev;
+            *tail = a;
+        }
+        /* next node becomes a pending list of 1 */
+        list->prev = pending;
+        pending = list;
+        list = list->next;
+        pending->next = NULL;
+        count++;
+    } while (list);
+
+    /* merge all the pending lists, newest (smallest) first */
+    list = pending;
+    pending = pending->prev;
+    for (;;) {
+        struct cdll *next = pending->prev;
+
+        if (!next)
+            break;
+        list = cdll_merge_run(pending, list, node_offset, cmp, priv);
+        pending = next;
+    }
+    cdll_merge_final(head, pending, list, node_offset, cmp, priv);
+}
+
+void cdll_merge(struct cdll *head, struct cdll *list, size_t node_offset,
+                cdll_cmp_func cmp, void *priv)
+{
+    struct cdll *pos = head->next;
+
+    while (!cdll_empty(list)) {
+        struct cdll *node = list->next;
+
+        while (pos != head &&
+               cmp(priv, cdll_node_obj(pos, node_offset),
+                   cdll_node_obj(node, node_offset)) <= 0)
+            pos = pos->next;
+        if (pos == head) {
+            cdll_splice_tail(list, head); /* the rest all goes last */
+            return;
+        }
+        cdll_delete_node(node);
+        cdll_insert_node_tail(node, pos);
+    }
+}
+
+/*
+ * cdll_pool, objects on the free lists are found from their struct cdll
+ */
+#define CDLL_POOL_SLAB_BYTES (64 * 1024)
+
+#define cdll_pool_node(pool, obj) \
+    ((struct cdll *)((char *)(obj) + (pool)->node_offset))
+#define cdll_pool_obj(pool, node) \
+    ((void *)((char *)(node) - (pool)->node_offset))
+
+/* slab header, the objects follow it */
+struct cdll_pool_slab {
+    struct cdll link;
+    void *align;                /* keep the objects pointer aligned */
+};
+
+int cdll_pool_init(struct cdll_pool *pool, size_t obj_size,
+                   size_t node_offset, size_t slab_objs)
+{
+    size_t align = sizeof(void *) > sizeof(double) ?
+                   sizeof(void *) : sizeof(double);
+
+    pool->obj_size = (obj_size + align - 1) & ~(align - 1);
+    pool->node_offset = node_offset;
+    if (!slab_objs)
+        slab_objs = CDLL_POOL_SLAB_BYTES / pool->obj_size;
+    pool->slab_objs = slab_objs ? slab_objs : 1;
+    pool->nfree = 0;
+    cdll_init(&pool->free);
+    cdll_init(&pool->slabs);
+    pthread_mutex_init(&pool->lock, NULL);
+    return 0;
+}
+
+void cdll_pool_destroy(struct cdll_pool *pool)
+{
+    while (!cdll_empty(&pool->slabs)) {
+        struct cdll *slab = pool->slabs.next;
+
+        cdll_delete_node(slab);
+        free(slab);
+    }
+    cdll_init(&pool->free);
+    pool->nfree = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/* add one slab of objects to the free list */
+static int cdll_pool_grow(struct cdll_pool *pool)
+{
+    struct cdll_pool_slab *slab;
+    char *obj;
+    size_t i;
+
+    slab = malloc(sizeof(*slab) + pool->slab_objs * pool->obj_size);
+    if (!slab)
+        return -1;
+    cdll_insert_node_tail(&slab->link, &pool->slabs);
+    obj = (char *)(slab + 1);
+    for (i = 0; i < pool->slab_objs; i++, obj += pool->obj_size)
+        cdll_insert_node_tail(cdll_pool_node(pool, obj), &pool->free);
+    pool->nfree += pool->slab_objs;
+    return 0;
+}
+
+int cdll_pool_reserve(struct cdll_pool *pool, size_t n)
+{
+    while (pool->nfree < n) {
+        if (cdll_pool_grow(pool) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void *cdll_pool_alloc(struct cdll_pool *pool)
+{
+    struct cdll *node;
+
+    if (cdll_empty(&pool->free) && cdll_pool_grow(pool) < 0)
+        return NULL;
+    node = pool->free.next;
+    cdll_delete_node(node);
+    pool->nfree--;
+    return cdll_pool_obj(pool, node);
+}
+
+void *cdll_pool_zalloc(struct cdll_pool *pool)
+{
+    void *obj = cdll_pool_alloc(pool);
+
+    if (obj) {
+        memset(obj, 0, pool->obj_size);
+        cdll_init(cdll_pool_node(pool, obj));
+    }
+    return obj;
+}
+
+void cdll_pool_free(struct cdll_pool *pool, void *obj)
+{
+    /* head, the next alloc gets the object that is still in cache */
+    cdll_insert_node_head(cdll_pool_node(pool, obj), &pool->free);
+    pool->nfree++;
+}
+
+void cdll_pool_cache_init(struct cdll_pool_cache *cache,
+                          struct cdll_pool *pool)
+{
+    cache->pool = pool;
+    cache->nfree = 0;
+    cdll_init(&cache->free);
+}
+
+/* move up to n free objects from one free list to another */
+static size_t cdll_pool_move(struct cdll *to, struct cdll *from, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n && !cdll_empty(from); i++) {
+        struct cdll *node = from->next;
+
+        cdll_delete_node(node);
+        cdll_insert_node_head(node, to);
+    }
+    return i;
+}
+
+void *cdll_pool_cache_alloc(struct cdll_pool_cache *cache)
+{
+    struct cdll_pool *pool = cache->pool;
+    struct cdll *node;
+
+    if (!cache->nfree) {
+        pthread_mutex_lock(&pool->lock);
+        if (cdll_pool_reserve(pool, CDLL_POOL_BATCH) < 0 && !pool->nfree) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        cache->nfree = cdll_pool_move(&cache->free, &pool->free,
+                                      CDLL_POOL_BATCH);
+        pool->nfree -= cache->nfree;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    node = cache->free.next;
+    cdll_delete_node(node);
+    cache->nfree--;
+    return cdll_pool_obj(pool, node);
+}
+
+void cdll_pool_cache_free(struct cdll_pool_cache *cache, void *obj)
+{
+    struct cdll_pool *pool = cache->pool;
+    size_t i;
+
+    cdll_insert_node_head(cdll_pool_node(pool, obj), &cache->free);
+    if (++cache->nfree < 2 * CDLL_POOL_BATCH)
+        return;
+    /* hand the coldest batch back, keep the one just used */
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < CDLL_POOL_BATCH; i++) {
+        struct cdll *node = cache->free.prev;
+
+        cdll_delete_node(node);
+        cdll_insert_node_head(node, &pool->free);
+    }
+    pool->nfree += CDLL_POOL_BATCH;
+    pthread_mutex_unlock(&pool->lock);
+    cache->nfree -= CDLL_POOL_BATCH;
+}
+
+void cdll_pool_cache_flush(struct cdll_pool_cache *cache)
+{
+    struct cdll_pool *pool = cache->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->nfree += cdll_pool_move(&pool->free, &cache->free, cache->nfree);
+    pthread_mutex_unlock(&pool->lock);
+    cache->nfree = 0;
+}
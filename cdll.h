@@ -14,6 +14,8 @@
  **********************************************************************/
 #ifndef __CDLL_INFRA_H__
 #define __CDLL_INFRA_H__
+#include <stddef.h>
+#include <pthread.h>
 
 /*
  * cdll circular double linked list infrastructure linked list implementation,
@@ -58,6 +60,107 @@ void cdll_insert_node_tail(struct cdll *newnode, struct cdll *head);
 void cdll_delete_node(struct cdll *list);
 //kind of tricky, but useful for sorts
 void cdll_swap_nodes(struct cdll *i, struct cdll *j);
+/*
+ * cdll_splice - move every node of list right after head, O(1)
+ * list: list head, left empty
+ * head: list head to add them after
+ * cdll_splice_tail() adds them before head, ie after the last node.
+ */
+void cdll_splice(struct cdll *list, struct cdll *head);
+void cdll_splice_tail(struct cdll *list, struct cdll *head);
+/*
+ * cdll_cut_position - move the front of a list to another, O(1)
+ * list: empty list head to get the nodes
+ * head: list head to cut from
+ * entry: last node to move, a node of head, or head itself to move none
+ */
+void cdll_cut_position(struct cdll *list, struct cdll *head,
+                       struct cdll *entry);
+
+/*
+ * compare two objects for cdll_sort() and cdll_merge(), return <0, 0, >0
+ * like strcmp. priv is passed through.
+ */
+typedef int (*cdll_cmp_func)(void *priv, const void *a, const void *b);
+/*
+ * cdll_sort - stable merge sort of the list, O(n log n), no allocation
+ * node_offset: offsetof the struct cdll in the objects, the comparator
+ *              gets the objects like cast_p_to_outer would give them
+ */
+void cdll_sort(struct cdll *head, size_t node_offset, cdll_cmp_func cmp,
+               void *priv);
+#define cdll_sort_type(head, type, member, cmp, priv) \
+    cdll_sort(head, offsetof(type, member), cmp, priv)
+/*
+ * cdll_merge - merge sorted list into sorted head, O(n + m), stable:
+ * on equal keys head's nodes come first. list is left empty.
+ */
+void cdll_merge(struct cdll *head, struct cdll *list, size_t node_offset,
+                cdll_cmp_func cmp, void *priv);
+
+/*
+ * cdll_pool fixed size object pool, for structs that embed a struct cdll.
+ * Objects come from malloc'd slabs of slab_objs objects and go back on a
+ * free list threaded through their own struct cdll, so alloc and free are a
+ * couple of pointer moves. Memory only goes back to malloc in
+ * cdll_pool_destroy().
+ *
+ * cdll_pool_alloc()/cdll_pool_free() are not thread safe. Threads sharing
+ * a pool each use a cdll_pool_cache, that moves CDLL_POOL_BATCH objects at
+ * a time to and from the pool under its lock.
+ */
+#ifndef CDLL_POOL_BATCH
+#define CDLL_POOL_BATCH 32
+#endif
+
+struct cdll_pool {
+    size_t obj_size;            /* rounded up to keep objects aligned */
+    size_t node_offset;         /* of the struct cdll in the object */
+    size_t slab_objs;           /* objects added per refill */
+    size_t nfree;
+    struct cdll free;           /* free objects, by their struct cdll */
+    struct cdll slabs;          /* every slab, for destroy */
+    pthread_mutex_t lock;       /* only taken by the caches */
+};
+
+struct cdll_pool_cache {
+    struct cdll_pool *pool;
+    size_t nfree;
+    struct cdll free;
+};
+
+/*
+ * cdll_pool_init - set up an empty pool
+ * obj_size: sizeof the object
+ * node_offset: offsetof the struct cdll member
+ * slab_objs: objects per refill, 0 picks about 64 KB worth
+ * returns 0
+ */
+int cdll_pool_init(struct cdll_pool *pool, size_t obj_size,
+                   size_t node_offset, size_t slab_objs);
+#define cdll_pool_init_type(pool, type, member, slab_objs) \
+    cdll_pool_init(pool, sizeof(type), offsetof(type, member), slab_objs)
+/* free every slab, all objects from the pool must be done with */
+void cdll_pool_destroy(struct cdll_pool *pool);
+/* bulk refill, make sure n objects are free, returns 0 or -1 */
+int cdll_pool_reserve(struct cdll_pool *pool, size_t n);
+/*
+ * cdll_pool_alloc - get an object, NULL if out of memory
+ * The struct cdll is cdll_init'ed, the rest is whatever the last user left,
+ * cdll_pool_zalloc() clears it first like calloc.
+ */
+void *cdll_pool_alloc(struct cdll_pool *pool);
+void *cdll_pool_zalloc(struct cdll_pool *pool);
+/* give an object back, it must not be on any list */
+void cdll_pool_free(struct cdll_pool *pool, void *obj);
+
+/* a thread's private front end to a shared pool */
+void cdll_pool_cache_init(struct cdll_pool_cache *cache,
+                          struct cdll_pool *pool);
+void *cdll_pool_cache_alloc(struct cdll_pool_cache *cache);
+void cdll_pool_cache_free(struct cdll_pool_cache *cache, void *obj);
+/* give all cached objects back to the pool, eg before the thread exits */
+void cdll_pool_cache_flush(struct cdll_pool_cache *cache);
 
 /**
  * cast_p_to_outer - cast a pointer to an outer, containing struct
@@ -14,113 +14,113 @@
  **********************************************************************/
 
 /*
- * compile: " gcc -Wall -Wextra -g -o example example.c states.c getms.c "
+ * compile: " gcc -I . -Wall -Wextra -g -o example example.c states.c getms.c \
+ *            smsched.c cdll.c tmwheel.c \
+ *            smreactor.c smring.c smio.c smlink.c "
  * test: " gdb ./example "
  */
 #include "states.h"
+#include "smsched.h"
+#include "smreactor.h"
+#include "smring.h"
+#include "smio.h"
+#include "smlink.h"
 #include <unistd.h>
 #include <stdio.h>
-#include <sys/select.h>
-#include <time.h>
+#include <string.h>
 #include <termios.h>
 
 /*
  * define structure containing 2 statemachines for input and output
  */
 static struct fab_main_state {
-    struct state_machine in;
-    struct state_machine out;
-    char data[512];
-    unsigned int head;
-    unsigned int tail;
+    struct sm_io_task in;       /* stdin into keys */
+    struct sm_io_task out;      /* keys out to stdout */
+    struct sm_ring keys;        /* in writes, out reads */
+    uint8_t data[512];
+    int eof_key;                /* the tty's ^D, -1 if stdin is no tty */
+    unsigned long long scanned; /* input bytes looked at for eof_key */
+    int input_done;             /* stdin ended, out drains and quits */
+    int finished;               /* both machines are gone */
 } fab_main_state;
 
-/*
- * example where state is followed by jump on timeout,
- * repeats if no timeout and no key
- * and continues when a key is ready
- */
-static int input_available_state(struct state_machine *sm)
+static int wait_key_state(struct state_machine *sm)
 {
-    struct timeval tv;
-    fd_set fds;
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
 
     if (SM_IS_TIMER_DONE(sm)) {
+        printf("hey give me keys\n");
+        fflush(stdout); /* the keys go out with write(), not stdio */
         return SM_RETURN_DONE; /* timed out, tell table interp */
     }
-
-    tv.tv_sec = 0;
-    tv.tv_usec = 100;
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
-    select(STDIN_FILENO+1, &fds, NULL, NULL, &tv);
-    if (FD_ISSET(STDIN_FILENO, &fds)) {
-        return SM_RETURN_SKIP_JUMP; /* a key is ready, continue */
+    if (!sm_ring_used(io->tx)) {
+        if (fab_main_state.input_done)
+            return SM_RETURN_ERROR; /* all out and no more coming */
+        sm_sched_block_timer(sm); /* sleep until input wakes us */
+        return SM_RETURN_REPEAT; //empty, call again later
     }
-    return SM_RETURN_REPEAT; /* not done, keep polling */
+    return SM_RETURN_SKIP_JUMP; //something to print, continue
 }
 
-static int read_key_state(struct state_machine *sm)
+/*
+ * Without canonical mode the tty hands ^D over as a key, look for it in
+ * what read brought in. in is the only writer of keys, so those bytes are
+ * still in data[] even if out already took them.
+ */
+static int key_eof_state(struct state_machine *sm)
 {
-    struct fab_main_state *pt = cast_p_to_outer(
-            struct state_machine *, sm, struct fab_main_state, in);
-    unsigned int in_byte, next;
-
-    in_byte = getchar();
-
-    /* push byte into buffer for other "thread" */
-    next = pt->head + 1;
-    if (next >= sizeof(pt->data))
-        next = 0;
-    if (next == pt->tail)
-        return SM_RETURN_DONE; //error return, buffer is full
-
-    pt->data[pt->head] = in_byte;
-    pt->head = next;
-
-    return SM_RETURN_SKIP_JUMP; //everything is good, continue
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
+    struct fab_main_state *fab = &fab_main_state;
+
+    if (fab->eof_key < 0)
+        return SM_RETURN_SKIP_JUMP;
+    for (; fab->scanned < io->bytes_in; fab->scanned++) {
+        if (fab->data[fab->scanned % sizeof(fab->data)] == fab->eof_key)
+            return SM_RETURN_DONE; /* typed end of input */
+    }
+    return SM_RETURN_SKIP_JUMP;
 }
 
-static int print_key_state(struct state_machine *sm)
+/* end of input, or an fd failed, the machine exits */
+static int io_end_state(struct state_machine *sm)
 {
-    struct fab_main_state *pt = cast_p_to_outer(
-            struct state_machine *, sm, struct fab_main_state, out);
-    unsigned int out_byte, next;
-
-    if (SM_IS_TIMER_DONE(sm)) {
-        printf("hey give me keys\n");
-        return SM_RETURN_DONE; /* timed out, tell table interp */
-    }
-    if (pt->head == pt->tail)
-        return SM_RETURN_REPEAT; //empty, call again later
-    /* next is where tail will point to after this read. */
-    next = pt->tail + 1;
-    if (next >= sizeof(pt->data))
-        next = 0;
-
-    out_byte = pt->data[pt->tail];
-    pt->tail = next;
-
-    putchar(out_byte);
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
 
-    return SM_RETURN_DONE; //everything is good, continue
+    if (io->err)
+        fprintf(stderr, "example: %s\n", strerror(io->err));
+    return SM_RETURN_ERROR;
 }
 
 /*
- * example state machine sequence tables
+ * example state machine sequence tables. Whatever is typed goes in and
+ * out in one step each, however many keys that is.
  */
+state_func io_end_table[] = {
+    io_end_state,
+};
 state_func get_key_table[] = {
-    SM_SET_TIMER_MS(3000),      /* fast timeout for testing 5 second */
-    input_available_state,
+    /* sleep until a key is ready, fast timeout for testing 3 second */
+    SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 3000),
     SM_JUMP(get_key_table),     /* timeout, nag or just retry */
-    read_key_state,             /* will choose one of the following jumps */
-    SM_JUMP(get_key_table),     /* error buffer is full return */
-    SM_JUMP(get_key_table),     /* all ok, just get more input */
+    SM_IO_READ,                 /* all there is, into the ring */
+    SM_JUMP(io_end_table),      /* end of input or error */
+    key_eof_state,              /* ^D typed on the terminal? */
+    SM_JUMP(io_end_table),      /* yes, same as end of input */
+    SM_JUMP(get_key_table),     /* no, just get more input */
 };
 state_func display_key_table[] = {
     SM_SET_TIMER_MS(6000),      /* fast timeout for testing 5 second */
-    print_key_state,             /* will choose one of the following jumps */
-    SM_JUMP(display_key_table),     /* error buffer is full return */
+    wait_key_state,             /* will choose one of the following jumps */
+    SM_JUMP(display_key_table), /* nagged, wait again */
+    SM_IO_WRITE,                /* everything in the ring */
+    SM_JUMP(io_end_table),      /* stdout is gone */
+    SM_JUMP(display_key_table), /* all out */
+};
+
+static const struct sm_link_table tables[] = {
+    SM_LINK_TABLE(get_key_table),
+    SM_LINK_TABLE(display_key_table),
+    SM_LINK_TABLE(io_end_table),
 };
 
 /*
@@ -129,47 +129,79 @@ state_func display_key_table[] = {
  * Other task will slowly send out user messages.
  */
 
+/*
+ * a machine exited. Input ending lets out print what is left, then out
+ * exits too and the program is done.
+ */
+static void task_exit(struct sm_task *task, int result)
+{
+    (void) result;
+    if (task == &fab_main_state.in.ft.task) {
+        fab_main_state.input_done = 1;
+        sm_sched_wake(&fab_main_state.out.ft.task);
+    } else {
+        fab_main_state.finished = 1;
+    }
+}
+
 int main(int argc, char **argv)
 {
     (void) argc;
     (void) argv;
-    int ret;
-
-    fab_main_state.head = 0;
-    fab_main_state.tail = 0;
-    fab_main_state.in.stateptrptr = NULL;
-    fab_main_state.out.stateptrptr = NULL;
-
-    struct termios ctrl;
-    tcgetattr(STDIN_FILENO, &ctrl);
+    struct sm_sched sched;
+    struct sm_reactor reactor;
+
+    sm_ring_init_buf(&fab_main_state.keys, fab_main_state.data,
+                     sizeof(fab_main_state.data));
+    /* check the tables and point every jump straight at its target */
+    sm_link_op(sm_wait_fd_state, SM_WAIT_FD_SLOTS,
+               SM_WAIT_FD_SLOTS + SM_RETURN_SKIP_JUMP_SIZE);
+    sm_link_op(SM_IO_READ, 1, SM_RETURN_SKIP_JUMP);
+    sm_link_op(SM_IO_WRITE, 1, SM_RETURN_SKIP_JUMP);
+    sm_link_op(wait_key_state, 1, SM_RETURN_SKIP_JUMP);
+    sm_link_op(key_eof_state, 1, SM_RETURN_SKIP_JUMP);
+    sm_link_op(io_end_state, 1, 0); /* never goes on */
+    if (sm_link(tables, elements_of(tables), NULL, stderr) < 0)
+        return 1;
+    sm_sched_init(&sched);
+    if (sm_reactor_init(&reactor) < 0)
+        return 1;
+    sm_reactor_attach(&reactor, &sched);
+    sm_io_task_init(&fab_main_state.in, STDIN_FILENO, -1, get_key_table,
+                    task_exit);
+    sm_io_task_init(&fab_main_state.out, -1, STDOUT_FILENO,
+                    display_key_table, task_exit);
+    fab_main_state.in.rx = &fab_main_state.keys;
+    fab_main_state.in.rx_wake = &fab_main_state.out.ft.task;
+    fab_main_state.out.tx = &fab_main_state.keys;
+    sm_sched_add(&sched, &fab_main_state.in.ft.task);
+    sm_sched_add(&sched, &fab_main_state.out.ft.task);
+
+    struct termios ctrl, saved;
+    int tty = tcgetattr(STDIN_FILENO, &ctrl) == 0;
+    saved = ctrl;
+    fab_main_state.eof_key = tty ? ctrl.c_cc[VEOF] : -1;
     ctrl.c_lflag &= ~(ECHO | ICANON);
-    /* turning off canonical mode makes input unbuffered */
-    tcsetattr(STDIN_FILENO, TCSANOW, &ctrl);
+    /* turning off canonical mode makes input unbuffered, ^D too */
+    if (tty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &ctrl);
 
-    printf("type keys!\n");
+    printf("type keys! end with ^D\n");
+    fflush(stdout);
 
     while (1) {
+        /* run each runnable machine until jump, delay or complete */
+        sm_sched_run_until_blocked(&sched);
+        if (fab_main_state.finished)
+            break;
 
-        if (!fab_main_state.in.stateptrptr)
-        {
-            /* restart if machine exited */
-            fab_main_state.in.stateptrptr = (void *)get_key_table;
-        }
-        do {
-            /* run until jump, delay or complete */
-            ret = sm_run_state(&fab_main_state.in);
-        } while (ret > 0 && fab_main_state.in.stateptrptr);
-
-        if (!fab_main_state.out.stateptrptr)
-        {
-            /* restart if machine exited */
-            fab_main_state.out.stateptrptr = (void *)display_key_table;
-        }
-        do {
-            /* run until jump, delay or complete */
-            ret = sm_run_state(&fab_main_state.out);
-        } while (ret > 0 && fab_main_state.out.stateptrptr);
-
-        nanosleep((struct timespec[]){{0, 1000000}},NULL); /* sleep 1 ms */
+        /* sleep until a key or the next timeout, no fixed tick */
+        sm_reactor_idle(&reactor, &sched);
     }
-}
\ No newline at end of file
+    sm_io_task_release(&reactor, &fab_main_state.in);
+    sm_io_task_release(&reactor, &fab_main_state.out);
+    sm_reactor_close(&reactor);
+    if (tty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**********************************************************************
+ *
+ * Filename:    exec_bench.c
+ *
+ * Description: steps/sec of the work stealing executor from 1 to N threads.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -pthread -o exec_bench exec_bench.c \
+ *            smexec.c smsched.c tmwheel.c states.c getms.c cdll.c "
+ * run: " ./exec_bench [max_threads [machines [ms_per_run [work]]]] "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "smexec.h"
+#include "bench.h"
+
+/* each machine does a little private work per step, no sharing */
+struct bench_machine {
+    struct sm_task task;
+    unsigned int seed;
+};
+
+static unsigned int work_per_step = 100;
+
+static int work_state(struct state_machine *sm)
+{
+    struct bench_machine *bm = cast_p_to_outer(
+            struct state_machine *, sm, struct bench_machine, task.sm);
+    unsigned int i;
+
+    for (i = 0; i < work_per_step; i++)
+        bm->seed = bm->seed * 1103515245 + 12345;
+    return SM_RETURN_DONE;
+}
+
+state_func work_table[] = {
+    work_state,
+    work_state,
+    work_state,
+    SM_JUMP(work_table),
+};
+
+int main(int argc, char **argv)
+{
+    unsigned int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int machines = 10000;
+    unsigned int ms = 1000;
+    unsigned int threads, i;
+    struct bench_machine *fleet;
+    double base = 0;
+
+    if (argc > 1)
+        max_threads = atoi(argv[1]);
+    if (argc > 2)
+        machines = atoi(argv[2]);
+    if (argc > 3)
+        ms = atoi(argv[3]);
+    if (argc > 4)
+        work_per_step = atoi(argv[4]);
+    fleet = calloc(machines, sizeof(*fleet));
+    if (!fleet || !max_threads || !machines)
+        return 1;
+
+    printf("threads steps/sec speedup steals\n");
+    for (threads = 1; threads <= max_threads; threads++) {
+        struct sm_exec exec;
+        unsigned long steals = 0;
+        uint64_t start, ns;
+        double rate;
+
+        if (sm_exec_init(&exec, threads))
+            return 1;
+        /* all on worker 0, the others have to steal to get going */
+        for (i = 0; i < machines; i++) {
+            fleet[i].seed = i;
+            sm_task_init(&fleet[i].task, work_table, NULL);
+            sm_exec_add_to(&exec, 0, &fleet[i].task);
+        }
+        start = bench_ns();
+        if (sm_exec_start(&exec))
+            return 1;
+        usleep(ms * 1000);
+        sm_exec_stop(&exec);
+        ns = bench_ns() - start;
+        rate = sm_exec_steps(&exec) * 1e9 / ns;
+        if (threads == 1)
+            base = rate;
+        for (i = 0; i < threads; i++)
+            steals += exec.workers[i].steals;
+        printf("%7u %9.0f %7.2f %6lu\n", threads, rate, rate / base, steals);
+        for (i = 0; i < machines; i++)
+            sm_sched_remove(&fleet[i].task);
+        sm_exec_destroy(&exec);
+    }
+    free(fleet);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/**********************************************************************
+ *
+ * Filename:    fanin_bench.c
+ *
+ * Description: many producers feeding one machine, consumer polling a
+ *              shared count versus sleeping on its mailbox.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -pthread -o fanin_bench \
+ *            fanin_bench.c smmbox.c smsched.c smreactor.c states.c \
+ *            getms.c cdll.c tmwheel.c "
+ * run: " ./fanin_bench [producers [ms]] "
+ *
+ * Producer machines each send one message every 10ms. The polling
+ * consumer repeats until the shared count moves, so the mainloop never
+ * sleeps. The mailbox consumer sits in SM_WAIT_MSG. Then the same with
+ * producer threads posting remotely. Reports consumer steps per message
+ * and the cpu time used.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "smmbox.h"
+#include "smreactor.h"
+#include "bench.h"
+
+#define PERIOD_MS   10
+
+struct producer {
+    struct sm_task task;
+    struct sm_msg msg;
+    int posted;                 /* msg is in the mailbox */
+};
+
+static struct sm_msg_task consumer;
+static unsigned long pending;   /* polling mode's shared state */
+static unsigned long handled;
+static unsigned long consumer_steps;
+static int use_mbox;
+
+#define cast_msg_to_producer(pm) (cast_p_to_outer( \
+            struct sm_msg *, pm, \
+            struct producer, msg))
+
+static int produce_state(struct state_machine *sm)
+{
+    struct producer *p = cast_p_to_outer(
+            struct state_machine *, sm, struct producer, task.sm);
+
+    if (!use_mbox) {
+        pending++;
+    } else if (!p->posted) {
+        p->posted = 1;
+        sm_mbox_post(&consumer, &p->msg);
+    }
+    return SM_RETURN_DONE;
+}
+
+static int poll_state(struct state_machine *sm)
+{
+    (void) sm;
+    consumer_steps++;
+    if (!pending)
+        return SM_RETURN_REPEAT; /* nothing, look again next pass */
+    handled += pending;
+    pending = 0;
+    return SM_RETURN_DONE;
+}
+
+static int take_msg_state(struct state_machine *sm)
+{
+    struct sm_msg_task *mt = cast_sm_to_msg_task(sm);
+    struct sm_msg *msg;
+
+    consumer_steps++;
+    while ((msg = sm_mbox_pop(&mt->mbox))) {
+        cast_msg_to_producer(msg)->posted = 0;
+        handled++;
+    }
+    return SM_RETURN_DONE;
+}
+
+static int take_remote_state(struct state_machine *sm)
+{
+    struct sm_msg_task *mt = cast_sm_to_msg_task(sm);
+    struct sm_msg *msg;
+
+    consumer_steps++;
+    while ((msg = sm_mbox_pop(&mt->mbox))) {
+        free(msg);
+        handled++;
+    }
+    return SM_RETURN_DONE;
+}
+
+state_func producer_table[] = {
+    SM_DELAY_MS(PERIOD_MS),
+    produce_state,
+    SM_JUMP(producer_table),
+};
+state_func poll_table[] = {
+    poll_state,
+    SM_JUMP(poll_table),
+};
+state_func mbox_table[] = {
+    SM_WAIT_MSG(1000),
+    SM_JUMP(mbox_table),        /* nobody wrote for a second */
+    take_msg_state,
+    SM_JUMP(mbox_table),
+};
+state_func remote_table[] = {
+    SM_WAIT_MSG(1000),
+    SM_JUMP(remote_table),
+    take_remote_state,
+    SM_JUMP(remote_table),
+};
+
+static double cpu_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, unsigned long n, double cpu)
+{
+    printf("%-8s %5lu producers %8lu msgs %10lu consumer steps "
+           "%8.2f steps/msg %6.3f cpu s\n", name, n, handled,
+           consumer_steps, handled ? (double)consumer_steps / handled : 0,
+           cpu);
+}
+
+static void run(struct sm_sched *sched, struct sm_reactor *reactor,
+                unsigned long ms)
+{
+    uint64_t end = bench_ns() + ms * 1000000ULL;
+
+    while (bench_ns() < end) {
+        sm_sched_run_until_blocked(sched);
+        sm_reactor_idle(reactor, sched);
+    }
+}
+
+static void bench_machines(unsigned long n, unsigned long ms, int mbox)
+{
+    struct producer *prod = calloc(n, sizeof(*prod));
+    struct sm_sched sched;
+    struct sm_reactor reactor;
+    unsigned long i;
+    double cpu;
+
+    if (!prod || sm_reactor_init(&reactor) < 0)
+        exit(1);
+    sm_sched_init(&sched);
+    sm_reactor_attach(&reactor, &sched);
+    use_mbox = mbox;
+    pending = handled = consumer_steps = 0;
+    sm_msg_task_init(&consumer, mbox ? mbox_table : poll_table, NULL);
+    sm_sched_add(&sched, &consumer.task);
+    for (i = 0; i < n; i++) {
+        sm_task_init(&prod[i].task, producer_table, NULL);
+        sm_sched_add(&sched, &prod[i].task);
+    }
+    cpu = cpu_secs();
+    run(&sched, &reactor, ms);
+    report(mbox ? "mbox" : "poll", n, cpu_secs() - cpu);
+    sm_reactor_close(&reactor);
+    free(prod);
+}
+
+static int stop;
+
+static void *poster(void *arg)
+{
+    struct timespec nap = { 0, PERIOD_MS * 1000000L };
+    unsigned long i, n = (unsigned long)arg;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        for (i = 0; i < n; i++)
+            sm_mbox_post_remote(&consumer, malloc(sizeof(struct sm_msg)));
+        nanosleep(&nap, NULL);
+    }
+    return NULL;
+}
+
+#define THREADS 4
+
+static void bench_threads(unsigned long n, unsigned long ms)
+{
+    pthread_t threads[THREADS];
+    struct sm_sched sched;
+    struct sm_reactor reactor;
+    struct sm_msg *msg;
+    unsigned long i;
+    double cpu;
+
+    if (sm_reactor_init(&reactor) < 0)
+        exit(1);
+    sm_sched_init(&sched);
+    sm_reactor_attach(&reactor, &sched);
+    handled = consumer_steps = 0;
+    sm_msg_task_init(&consumer, remote_table, NULL);
+    sm_sched_add(&sched, &consumer.task);
+    stop = 0;
+    cpu = cpu_secs();
+    for (i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, poster,
+                       (void *)((n + THREADS - 1) / THREADS));
+    run(&sched, &reactor, ms);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    report("remote", n, cpu_secs() - cpu);
+    while ((msg = sm_mbox_pop(&consumer.mbox)))
+        free(msg);
+    sm_reactor_close(&reactor);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+    unsigned long ms = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000;
+
+    bench_machines(n, ms, 0);
+    bench_machines(n, ms, 1);
+    bench_threads(n, ms);
+    return 0;
+}
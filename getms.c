@@ -2,7 +2,8 @@
  *
  * Filename:    getms.c
  *
- * Description: A Linux millisecond tick fetch routine.
+ * Description: A Linux tick fetch routine, ms by default, cached per pass
+ *              with SM_CACHED_TICKS.
  *
  * Notes: Highly un-portable. All statemachines need a 16 bit, monotomic,
  * incrementing counter that shows as a millisecond value. On linux call the os
@@ -15,18 +16,104 @@
  * expressed or implied by its publication or distribution.
  **********************************************************************/
 #include <time.h>
+#include "states.h"
+#if defined(SM_TICK_TSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SM_USE_TSC
+#endif
 
-/*
- * define posix millisecond time function.
- * used to calculate delays needed in run to completion systems.
- */
+#define SM_NS_PER_SEC 1000000000ULL
 
-unsigned int getms()
+/* this thread's ticks as of the last sm_tick_update() */
+__thread SM_TIMER_SIZE sm_tick_now;
+
+#ifndef SM_SIMULATION
+static uint64_t sm_mono_ns(void)
 {
     struct timespec et;
 
     clock_gettime(CLOCK_MONOTONIC, &et); /* cannot error return */
+    return (uint64_t)et.tv_sec * SM_NS_PER_SEC + et.tv_nsec;
+}
+
+#ifdef SM_USE_TSC
+/*
+ * With SM_TICK_TSC the clock is the cycle counter, scaled by a rate
+ * measured against CLOCK_MONOTONIC. The rate is measured over the whole
+ * run and the offset taken again every SM_TICK_TSC_RESYNC_NS, so the ticks
+ * follow CLOCK_MONOTONIC closely, never going backwards. Needs a constant
+ * rate TSC synchronized across cores (constant_tsc nonstop_tsc in
+ * /proc/cpuinfo), any x86 of the last decade.
+ */
+#ifndef SM_TICK_TSC_RESYNC_NS
+#define SM_TICK_TSC_RESYNC_NS 100000000ULL
+#endif
+#define SM_TSC_MIN_SPAN (1ULL << 20) /* cycles before the rate is trusted */
+
+static __thread struct {
+    uint64_t base_tsc, base_ns;     /* first reading, rate measured from it */
+    uint64_t anchor_tsc, anchor_ns; /* last clock read */
+    uint64_t resync_tsc;            /* cycles between clock reads */
+    uint64_t last_ns;               /* never go back */
+    double ns_per_tsc;              /* 0 until measured */
+} sm_tsc;
+
+static uint64_t sm_clock_ns(void)
+{
+    uint64_t tsc = __rdtsc();
+    uint64_t ns;
 
-    return (et.tv_nsec / 1000000) + (et.tv_sec * 1000);
+    if (!sm_tsc.ns_per_tsc || tsc - sm_tsc.anchor_tsc >= sm_tsc.resync_tsc) {
+        ns = sm_mono_ns();
+        if (!sm_tsc.base_ns) {
+            sm_tsc.base_tsc = tsc;
+            sm_tsc.base_ns = ns;
+        } else if (tsc - sm_tsc.base_tsc >= SM_TSC_MIN_SPAN) {
+            sm_tsc.ns_per_tsc = (double)(ns - sm_tsc.base_ns) /
+                                (tsc - sm_tsc.base_tsc);
+            sm_tsc.resync_tsc = SM_TICK_TSC_RESYNC_NS / sm_tsc.ns_per_tsc;
+        }
+        sm_tsc.anchor_tsc = tsc;
+        sm_tsc.anchor_ns = ns;
+    } else {
+        ns = sm_tsc.anchor_ns +
+             (uint64_t)((tsc - sm_tsc.anchor_tsc) * sm_tsc.ns_per_tsc);
+    }
+    if (ns < sm_tsc.last_ns)
+        ns = sm_tsc.last_ns;
+    sm_tsc.last_ns = ns;
+    return ns;
+}
+#else
+#define sm_clock_ns() sm_mono_ns()
+#endif
+#endif
 
-}
\ No newline at end of file
+/*
+ * define posix tick time function, SM_TICK_RATE ticks per second.
+ * used to calculate delays needed in run to completion systems.
+ * The count wraps at the width of SM_TIMER_SIZE.
+ */
+#ifdef SM_SIMULATION
+/* the virtual clock, in ticks, moved by the simulator only */
+uint64_t sm_sim_now;
+
+SM_TIMER_SIZE getms(void)
+{
+    return (SM_TIMER_SIZE)sm_sim_now;
+}
+#else
+SM_TIMER_SIZE getms(void)
+{
+    uint64_t ns = sm_clock_ns();
+
+    return (SM_TIMER_SIZE)((ns / SM_NS_PER_SEC) * SM_TICK_RATE +
+                           (ns % SM_NS_PER_SEC) * SM_TICK_RATE /
+                           SM_NS_PER_SEC);
+}
+#endif
+
+SM_TIMER_SIZE sm_tick_update(void)
+{
+    return sm_tick_now = getms();
+}
@@ -0,0 +1,234 @@
+/**********************************************************************
+ *
+ * Filename:    io_bench.c
+ *
+ * Description: forwarding throughput of a machine moving a byte per step
+ *              through stdio versus the smio batch states.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -pthread -o io_bench io_bench.c \
+ *            smio.c smreactor.c smsched.c smring.c tmwheel.c cdll.c \
+ *            states.c getms.c "
+ * run: " ./io_bench [MB] "
+ *
+ * A writer thread pushes MB megabytes into a pipe (then a socketpair), one
+ * machine forwards them to a second one, a reader thread counts them out.
+ * byte is the old example.c pattern, getc() and putc() each a state step.
+ * readv/writev goes through a ring with SM_IO_READ and SM_IO_WRITE, splice
+ * with SM_IO_SPLICE never copies to user space.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "smio.h"
+#include "bench.h"
+
+#define CHUNK       4096        /* writer's write() size */
+#define RING_SIZE   (64 * 1024)
+
+struct stream {
+    int fd;
+    size_t bytes;
+};
+
+static FILE *byte_in;
+static FILE *byte_out;
+static int byte_c;              /* getc_state's byte for putc_state */
+static int forward_done;
+
+static void *writer(void *arg)
+{
+    struct stream *s = arg;
+    char buf[CHUNK];
+    size_t left = s->bytes;
+
+    memset(buf, 'x', sizeof(buf));
+    while (left) {
+        ssize_t n = write(s->fd, buf, left < CHUNK ? left : CHUNK);
+
+        if (n <= 0)
+            break;
+        left -= n;
+    }
+    close(s->fd);
+    return NULL;
+}
+
+static void *reader(void *arg)
+{
+    struct stream *s = arg;
+    char buf[RING_SIZE];
+    ssize_t n;
+
+    while ((n = read(s->fd, buf, sizeof(buf))) > 0)
+        s->bytes += n;
+    return NULL;
+}
+
+/* the example.c way, one byte per state */
+static int getc_state(struct state_machine *sm)
+{
+    (void)sm;
+    byte_c = getc(byte_in);
+    if (byte_c == EOF)
+        return SM_RETURN_ERROR;
+    return SM_RETURN_DONE;
+}
+
+static int putc_state(struct state_machine *sm)
+{
+    (void)sm;
+    putc(byte_c, byte_out);
+    return SM_RETURN_DONE;
+}
+
+state_func byte_table[] = {
+    getc_state,
+    putc_state,
+    SM_JUMP(byte_table),
+};
+
+static int end_state(struct state_machine *sm)
+{
+    (void)sm;
+    forward_done = 1;
+    return SM_RETURN_ERROR;
+}
+
+state_func end_table[] = {
+    end_state,
+};
+
+state_func copy_table[] = {
+    SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 1000),
+    SM_JUMP(copy_table),
+    SM_IO_READ,
+    SM_JUMP(end_table),
+    SM_IO_WRITE,
+    SM_JUMP(end_table),
+    SM_JUMP(copy_table),
+};
+
+state_func splice_table[] = {
+    SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 1000),
+    SM_JUMP(splice_table),
+    SM_IO_SPLICE,
+    SM_JUMP(end_table),
+    SM_JUMP(splice_table),
+};
+
+static void make_pair(int sock, int fds[2])
+{
+    int ok = sock ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds);
+
+    if (ok < 0) {
+        perror("pair");
+        exit(1);
+    }
+}
+
+/* forward from in to out, returns sm_run_state() calls */
+static unsigned long forward(state_func *table, int in, int out,
+                             unsigned long *syscalls)
+{
+    unsigned long steps = 0;
+
+    if (table == byte_table) {
+        struct state_machine sm;
+
+        byte_in = fdopen(in, "r");
+        byte_out = fdopen(out, "w");
+        SM_SET_TABLE(&sm, byte_table);
+        do {
+            steps++;
+        } while (sm_run_state(&sm) >= 0);
+        fclose(byte_in);
+        fclose(byte_out);
+        *syscalls = 0;
+    } else {
+        struct sm_sched sched;
+        struct sm_reactor reactor;
+        struct sm_io_task io;
+        struct sm_ring ring;
+
+        fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+        fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK);
+        sm_ring_init(&ring, RING_SIZE);
+        sm_sched_init(&sched);
+        sm_reactor_init(&reactor);
+        sm_reactor_attach(&reactor, &sched);
+        sm_io_task_init(&io, in, out, table, NULL);
+        io.rx = &ring;
+        io.tx = &ring;
+        sm_sched_add(&sched, &io.ft.task);
+        forward_done = 0;
+        while (!forward_done) {
+            steps += sm_sched_run_until_blocked(&sched);
+            if (!forward_done)
+                sm_reactor_idle(&reactor, &sched);
+        }
+        *syscalls = io.syscalls;
+        sm_io_task_release(&reactor, &io);
+        sm_reactor_close(&reactor);
+        sm_ring_destroy(&ring);
+        close(in);
+        close(out);
+    }
+    return steps;
+}
+
+static void run(const char *name, state_func *table, int sock, size_t bytes)
+{
+    struct stream src, dst;
+    pthread_t w, r;
+    int a[2], b[2];
+    unsigned long steps, syscalls;
+    uint64_t t0, ns;
+
+    make_pair(sock, a);
+    make_pair(sock, b);
+    src.fd = a[1];
+    src.bytes = bytes;
+    dst.fd = b[0];
+    dst.bytes = 0;
+    t0 = bench_ns();
+    pthread_create(&w, NULL, writer, &src);
+    pthread_create(&r, NULL, reader, &dst);
+    steps = forward(table, a[0], b[1], &syscalls);
+    pthread_join(w, NULL);
+    pthread_join(r, NULL);
+    ns = bench_ns() - t0;
+    close(b[0]);
+    printf("%-10s %-12s %8.0f MB/s %10lu steps %6.2f steps/KB",
+           sock ? "socketpair" : "pipe", name, dst.bytes * 1e3 / ns,
+           steps, steps * 1024.0 / dst.bytes);
+    if (syscalls)
+        printf(" %8lu syscalls", syscalls);
+    printf("%s\n", dst.bytes == bytes ? "" : " SHORT");
+}
+
+int main(int argc, char **argv)
+{
+    size_t bytes = (argc > 1 ? strtoul(argv[1], NULL, 0) : 64) << 20;
+    int sock;
+
+    for (sock = 0; sock < 2; sock++) {
+        run("byte", byte_table, sock, bytes);
+        run("readv/writev", copy_table, sock, bytes);
+        run("splice", splice_table, sock, bytes);
+    }
+    return 0;
+}
@@ -14,7 +14,7 @@
  **********************************************************************/
 
 /*
- * gcc -I . -Wall -Wextra -g -o list_unit_test list_unit_test.c states.c getms.c cdll.c
+ * gcc -I . -Wall -Wextra -g -pthread -o list_unit_test list_unit_test.c states.c getms.c cdll.c
  */
 #include <string.h>
 #include <stdio.h>
@@ -39,7 +39,9 @@ void removevalvelist()
 	struct cdll *vlist;
 	struct teststruct *test;
 
-	cdll_for_each(vlist, &myvalvelist) {
+	//delete re-inits the node and free loses it, so always take the first
+	while (!cdll_empty(&myvalvelist)) {
+		vlist = myvalvelist.next;
 		test = cast_cdll_to_teststruct(vlist);
 		printf("fifo delete %p, number %d\n", test, test->struct_no);
 		cdll_delete_node(vlist);
@@ -52,7 +54,8 @@ void removevalvelist_rev()
 	struct cdll *pos;
 	struct teststruct *test;
 	//for a complete test, actually remove the fifo backwards
-	cdll_for_each_rev(pos, &myvalvelist) {
+	while (!cdll_empty(&myvalvelist)) {
+		pos = myvalvelist.prev;
 		test = cast_cdll_to_teststruct(pos);
 		printf("filo delete %p, number %d\n", test, test->struct_no);
 		cdll_delete_node(pos);
@@ -70,6 +73,175 @@ void printlist(struct cdll *p)
 	}
 
 }
+/* same list, objects from a cdll_pool instead of calloc/free */
+int pooltest(void)
+{
+	struct cdll_pool pool;
+	struct cdll_pool_cache cache;
+	struct teststruct *t, *last = NULL;
+	struct cdll *pos;
+	void *objs[100];
+	int i, errors = 0;
+
+	cdll_pool_init_type(&pool, struct teststruct, vlist, 4);
+	cdll_init(&myvalvelist);
+	for (i = 0; i < 8; i++) {
+		t = cdll_pool_zalloc(&pool);
+		if (!t || !cdll_empty(&t->vlist) || t->struct_no) {
+			printf("pool alloc %d bad\n", i);
+			errors++;
+			continue;
+		}
+		t->struct_no = i;
+		cdll_insert_node_tail(&t->vlist, &myvalvelist);
+	}
+	printlist(&myvalvelist);
+	while (!cdll_empty(&myvalvelist)) {
+		pos = myvalvelist.prev;
+		cdll_delete_node(pos);
+		last = cast_cdll_to_teststruct(pos);
+		cdll_pool_free(&pool, last);
+	}
+	/* last freed is handed out first */
+	t = cdll_pool_alloc(&pool);
+	if (!t || t != last || !cdll_empty(&t->vlist)) {
+		printf("pool did not reuse %p\n", (void *)t);
+		errors++;
+	}
+	cdll_pool_free(&pool, t);
+	if (pool.nfree != 8 || cdll_pool_reserve(&pool, 10) || pool.nfree != 12) {
+		printf("pool reserve nfree %zu\n", pool.nfree);
+		errors++;
+	}
+
+	/* a cache pulls and returns batches */
+	cdll_pool_cache_init(&cache, &pool);
+	for (i = 0; i < 100; i++) {
+		objs[i] = cdll_pool_cache_alloc(&cache);
+		if (!objs[i])
+			errors++;
+	}
+	for (i = 0; i < 100; i++)
+		cdll_pool_cache_free(&cache, objs[i]);
+	if (cache.nfree >= 2 * CDLL_POOL_BATCH) {
+		printf("cache kept %zu\n", cache.nfree);
+		errors++;
+	}
+	cdll_pool_cache_flush(&cache);
+	i = 0;
+	cdll_for_each(pos, &pool.slabs)
+		i++;
+	if (cache.nfree || pool.nfree != i * pool.slab_objs) {
+		printf("pool lost objects, %zu free of %zu\n", pool.nfree,
+		       i * pool.slab_objs);
+		errors++;
+	}
+	cdll_pool_destroy(&pool);
+	printf("pool test %s\n", errors ? "FAILED" : "passed");
+	return errors;
+}
+
+struct sortstruct {
+	int key;
+	int seq;		/* insertion order, to check stability */
+	struct cdll node;
+};
+
+static int sortcmp(void *priv, const void *a, const void *b)
+{
+	const struct sortstruct *x = a, *y = b;
+
+	(void)priv;
+	return x->key - y->key;
+}
+
+/* sorted by key, seq ascending among equal keys, links both ways intact */
+static int checksorted(struct cdll *head, int n)
+{
+	struct cdll *pos;
+	struct sortstruct *prev = NULL, *s;
+	int count = 0;
+
+	cdll_for_each(pos, head) {
+		s = cast_p_to_outer(struct cdll *, pos, struct sortstruct, node);
+		if (pos->next->prev != pos)
+			return -1;
+		if (prev && (prev->key > s->key ||
+			     (prev->key == s->key && prev->seq > s->seq)))
+			return -1;
+		prev = s;
+		count++;
+	}
+	return count == n ? 0 : -1;
+}
+
+/* splice, cut, sort and merge */
+int sorttest(void)
+{
+	static struct sortstruct items[1000];
+	struct cdll a, b;
+	struct cdll *pos;
+	int i, n, errors = 0;
+
+	cdll_init(&a);
+	cdll_init(&b);
+	for (i = 0; i < 1000; i++) {
+		items[i].key = rand() % 50;
+		items[i].seq = i;
+		cdll_insert_node_tail(&items[i].node, i < 600 ? &a : &b);
+	}
+	cdll_splice_tail(&b, &a);
+	if (!cdll_empty(&b) || a.prev != &items[999].node ||
+	    items[600].node.prev != &items[599].node) {
+		printf("splice tail bad\n");
+		errors++;
+	}
+	cdll_cut_position(&b, &a, &items[9].node);
+	n = 0;
+	cdll_for_each(pos, &b)
+		n++;
+	if (n != 10 || a.next != &items[10].node || b.prev != &items[9].node) {
+		printf("cut position bad, %d nodes\n", n);
+		errors++;
+	}
+	cdll_splice(&b, &a);
+	if (!cdll_empty(&b) || a.next != &items[0].node) {
+		printf("splice bad\n");
+		errors++;
+	}
+	for (n = 0; n <= 3; n++) {
+		/* 0 and 1 node lists are already sorted */
+		cdll_init(&b);
+		for (i = 0; i < n; i++)
+			cdll_insert_node_tail(&items[i].node, &b);
+		cdll_sort_type(&b, struct sortstruct, node, sortcmp, NULL);
+		if (checksorted(&b, n)) {
+			printf("sort of %d bad\n", n);
+			errors++;
+		}
+	}
+	cdll_init(&a);
+	for (i = 0; i < 1000; i++)
+		cdll_insert_node_tail(&items[i].node, &a);
+	cdll_sort_type(&a, struct sortstruct, node, sortcmp, NULL);
+	if (checksorted(&a, 1000)) {
+		printf("sort of 1000 bad\n");
+		errors++;
+	}
+	/* cut leaves two sorted lists, merge them back, front one first */
+	pos = a.next;
+	for (i = 0; i < 400; i++)
+		pos = pos->next;
+	cdll_cut_position(&b, &a, pos);
+	cdll_merge(&b, &a, offsetof(struct sortstruct, node), sortcmp, NULL);
+	if (!cdll_empty(&a) || checksorted(&b, 1000)) {
+		printf("merge bad\n");
+		errors++;
+	}
+	printf("sort test %s\n", errors ? "FAILED" : "passed");
+	return errors;
+}
+
 #define VERSION "1.0"
 int main( int argc, char *argv[] )
 {
@@ -100,4 +272,5 @@ int main( int argc, char *argv[] )
 	}
 	printlist(&myvalvelist);
 	removevalvelist();
+	return pooltest() || sorttest() ? 1 : 0;
 }
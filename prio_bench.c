@@ -0,0 +1,140 @@
+/**********************************************************************
+ *
+ * Filename:    prio_bench.c
+ *
+ * Description: timer lateness of a few critical machines under a pile of
+ *              busy housekeeping machines, with and without priorities.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o prio_bench prio_bench.c \
+ *            smsched.c states.c getms.c cdll.c tmwheel.c "
+ * run: " ./prio_bench [housekeepers [us per step [ms]]] "
+ *
+ * Critical machines wake every PERIOD_MS and have a DEADLINE_MS deadline,
+ * housekeepers poll forever burning some cpu per step, so the scheduler
+ * is overloaded. Reports how late the critical machines ran.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "smsched.h"
+#include "bench.h"
+
+#define CRITICAL    4
+#define PERIOD_MS   2
+#define DEADLINE_MS 1
+#define SAMPLES     100000
+
+struct critical {
+    struct sm_task task;
+    uint64_t due_ns;
+};
+
+static unsigned long burn_ns;
+static uint64_t late_ns[SAMPLES];
+static unsigned long nlate;
+
+static int mark_state(struct state_machine *sm)
+{
+    struct critical *c = cast_p_to_outer(
+            struct state_machine *, sm, struct critical, task.sm);
+
+    c->due_ns = bench_ns() + PERIOD_MS * 1000000ULL;
+    return SM_RETURN_DONE;
+}
+
+static int control_state(struct state_machine *sm)
+{
+    struct critical *c = cast_p_to_outer(
+            struct state_machine *, sm, struct critical, task.sm);
+    uint64_t now = bench_ns();
+
+    if (nlate < SAMPLES)
+        late_ns[nlate++] = now > c->due_ns ? now - c->due_ns : 0;
+    return SM_RETURN_DONE;
+}
+
+static int housekeeping_state(struct state_machine *sm)
+{
+    uint64_t end = bench_ns() + burn_ns;
+
+    (void) sm;
+    while (bench_ns() < end)
+        ;
+    return SM_RETURN_REPEAT;
+}
+
+state_func critical_table[] = {
+    mark_state,
+    SM_DELAY_MS(PERIOD_MS),
+    control_state,
+    SM_JUMP(critical_table),
+};
+state_func housekeeping_table[] = {
+    housekeeping_state,
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench(const char *name, unsigned long n, unsigned long ms,
+                  int prio)
+{
+    struct critical crit[CRITICAL];
+    struct sm_task *hk = calloc(n, sizeof(*hk));
+    struct sm_sched sched;
+    uint64_t end;
+    unsigned long i;
+
+    if (!hk)
+        exit(1);
+    sm_sched_init(&sched);
+    nlate = 0;
+    for (i = 0; i < CRITICAL; i++) {
+        sm_task_init(&crit[i].task, critical_table, NULL);
+        if (prio) {
+            sm_task_set_prio(&crit[i].task, SM_PRIO_HIGHEST);
+            sm_task_set_deadline(&crit[i].task, SM_MS_TO_TICKS(DEADLINE_MS));
+        }
+        sm_sched_add(&sched, &crit[i].task);
+    }
+    for (i = 0; i < n; i++) {
+        sm_task_init(&hk[i], housekeeping_table, NULL);
+        if (prio)
+            sm_task_set_prio(&hk[i], SM_PRIO_LOWEST);
+        sm_sched_add(&sched, &hk[i]);
+    }
+    end = bench_ns() + ms * 1000000ULL;
+    while (bench_ns() < end)
+        sm_sched_run_until_blocked(&sched);
+    qsort(late_ns, nlate, sizeof(late_ns[0]), cmp_u64);
+    printf("%-6s %5lu samples late us p50 %8.1f p99 %8.1f max %8.1f "
+           "deadline misses %lu\n", name, nlate,
+           nlate ? late_ns[nlate / 2] / 1e3 : 0,
+           nlate ? late_ns[nlate * 99 / 100] / 1e3 : 0,
+           nlate ? late_ns[nlate - 1] / 1e3 : 0, sched.deadline_misses);
+    free(hk);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = argc > 1 ? strtoul(argv[1], NULL, 0) : 200;
+    unsigned long ms = argc > 3 ? strtoul(argv[3], NULL, 0) : 2000;
+
+    burn_ns = (argc > 2 ? strtoul(argv[2], NULL, 0) : 50) * 1000;
+    bench("plain", n, ms, 0);
+    bench("prio", n, ms, 1);
+    return 0;
+}
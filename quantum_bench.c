@@ -0,0 +1,128 @@
+/**********************************************************************
+ *
+ * Filename:    quantum_bench.c
+ *
+ * Description: pass and run latency of a mixed fleet of short and long
+ *              tables, without limits, with a step quantum and with a
+ *              wall budget per pass.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o quantum_bench quantum_bench.c \
+ *            smsched.c states.c getms.c cdll.c tmwheel.c "
+ * run: " ./quantum_bench [short [long [passes]]] "
+ *
+ * Long machines walk a LONG_STEPS table of SM_RETURN_DONE states before
+ * they jump, short ones a few. Run latency is one task run, pass latency
+ * one sm_sched_run_until_blocked(), both from sched->pass.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "smsched.h"
+#include "bench.h"
+
+#define LONG_STEPS  4000
+
+static unsigned long long_overruns, short_overruns;
+static struct sm_task *long_tasks;
+static unsigned long nlong;
+
+static int work_state(struct state_machine *sm)
+{
+    /* a little something per step */
+    sm->delay = sm->delay * 1103515245 + 12345;
+    return SM_RETURN_DONE;
+}
+
+static state_func long_table[LONG_STEPS + 2];
+state_func short_table[] = {
+    work_state,
+    work_state,
+    work_state,
+    SM_JUMP(short_table),
+};
+
+static void overrun(struct sm_task *task)
+{
+    if (task >= long_tasks && task < long_tasks + nlong)
+        long_overruns++;
+    else
+        short_overruns++;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench(const char *name, unsigned long nshort, unsigned long passes,
+                  unsigned int quantum, uint64_t pass_ns)
+{
+    struct sm_task *short_tasks = calloc(nshort, sizeof(*short_tasks));
+    uint64_t *pass = calloc(passes, sizeof(*pass));
+    uint64_t run_p99 = 0, run_max = 0;
+    struct sm_sched sched;
+    unsigned long i, steps = 0, left = 0;
+
+    long_tasks = calloc(nlong, sizeof(*long_tasks));
+    if (!short_tasks || !pass || !long_tasks)
+        exit(1);
+    long_overruns = short_overruns = 0;
+    sm_sched_init(&sched);
+    sm_sched_set_budget(&sched, quantum, pass_ns, overrun);
+    sm_sched_measure(&sched, 1);
+    for (i = 0; i < nlong; i++) {
+        sm_task_init(&long_tasks[i], long_table, NULL);
+        sm_sched_add(&sched, &long_tasks[i]);
+    }
+    for (i = 0; i < nshort; i++) {
+        sm_task_init(&short_tasks[i], short_table, NULL);
+        sm_sched_add(&sched, &short_tasks[i]);
+    }
+    for (i = 0; i < passes; i++) {
+        steps += sm_sched_run_until_blocked(&sched);
+        pass[i] = sched.pass.ns;
+        left += sched.pass.left;
+        if (sched.pass.run_p99_ns > run_p99)
+            run_p99 = sched.pass.run_p99_ns;
+        if (sched.pass.run_max_ns > run_max)
+            run_max = sched.pass.run_max_ns;
+    }
+    qsort(pass, passes, sizeof(*pass), cmp_u64);
+    printf("%-8s pass us p50 %8.1f p99 %8.1f max %8.1f | worst pass run "
+           "p99 %7.1f max %7.1f us | steps/pass %7lu | overruns long %lu "
+           "short %lu | left over %lu\n", name, pass[passes / 2] / 1e3,
+           pass[passes * 99 / 100] / 1e3, pass[passes - 1] / 1e3,
+           run_p99 / 1e3, run_max / 1e3, steps / passes, long_overruns,
+           short_overruns, left);
+    free(short_tasks);
+    free(long_tasks);
+    free(pass);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long nshort = argc > 1 ? strtoul(argv[1], NULL, 0) : 200;
+    unsigned long passes = argc > 3 ? strtoul(argv[3], NULL, 0) : 2000;
+    unsigned int i;
+
+    nlong = argc > 2 ? strtoul(argv[2], NULL, 0) : 8;
+    for (i = 0; i < LONG_STEPS; i++)
+        long_table[i] = work_state;
+    long_table[i++] = sm_jump_table_state;
+    long_table[i] = (state_func)long_table;
+    bench("none", nshort, passes, 0, 0);
+    bench("quantum", nshort, passes, 256, 0);
+    bench("wall", nshort, passes, 256, 20000);
+    return 0;
+}
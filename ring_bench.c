@@ -0,0 +1,182 @@
+/**********************************************************************
+ *
+ * Filename:    ring_bench.c
+ *
+ * Description: throughput of the SPSC ring between two threads, bulk
+ *              copy, zero copy spans and records.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -pthread -o ring_bench ring_bench.c \
+ *            smring.c "
+ * run: " ./ring_bench [MB [ring size]] "
+ * Every byte is checked on the consumer side, a mismatch exits 1. A side
+ * that finds the ring full (empty) yields, so it also runs on one cpu.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "smring.h"
+#include "bench.h"
+
+#define CHUNK   4096            /* most bytes moved per call */
+
+struct run {
+    struct sm_ring ring;
+    size_t total;               /* bytes (or records) to move */
+    size_t rec_mod;
+    int mode;
+    int bad;
+};
+
+enum { MODE_COPY, MODE_SPAN, MODE_REC };
+
+/* byte n of the stream */
+#define pattern(n)  ((uint8_t)((n) * 7 + ((n) >> 13)))
+
+static void *producer(void *arg)
+{
+    struct run *run = arg;
+    uint8_t chunk[CHUNK];
+    size_t n = 0, i, len, done;
+    void *span;
+    uint8_t *p;
+
+    while (n < run->total) {
+        switch (run->mode) {
+        case MODE_COPY:
+            len = run->total - n < CHUNK ? run->total - n : CHUNK;
+            for (i = 0; i < len; i++)
+                chunk[i] = pattern(n + i);
+            for (done = 0; done < len; ) {
+                i = sm_ring_push(&run->ring, chunk + done, len - done);
+                if (!i)
+                    sched_yield();
+                done += i;
+            }
+            n += len;
+            break;
+        case MODE_SPAN:
+            len = sm_ring_write_span(&run->ring, &span);
+            if (!len)
+                sched_yield();
+            if (len > run->total - n)
+                len = run->total - n;
+            for (p = span, i = 0; i < len; i++)
+                p[i] = pattern(n + i);
+            sm_ring_write_commit(&run->ring, len);
+            n += len;
+            break;
+        case MODE_REC:
+            /* record n is n % 251 + 1 bytes of n, less on tiny rings */
+            len = n % run->rec_mod + 1;
+            while (!(p = sm_ring_rec_reserve(&run->ring, len)))
+                sched_yield();
+            memset(p, (uint8_t)n, len);
+            sm_ring_rec_commit(&run->ring, len);
+            n++;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct run *run = arg;
+    uint8_t chunk[CHUNK];
+    size_t n = 0, i, len;
+    const void *span;
+    const uint8_t *p;
+
+    while (n < run->total) {
+        switch (run->mode) {
+        case MODE_COPY:
+            len = sm_ring_pop(&run->ring, chunk, CHUNK);
+            if (!len)
+                sched_yield();
+            for (i = 0; i < len; i++)
+                run->bad |= chunk[i] != pattern(n + i);
+            n += len;
+            break;
+        case MODE_SPAN:
+            len = sm_ring_read_span(&run->ring, &span);
+            if (!len)
+                sched_yield();
+            for (p = span, i = 0; i < len; i++)
+                run->bad |= p[i] != pattern(n + i);
+            sm_ring_read_release(&run->ring, len);
+            n += len;
+            break;
+        case MODE_REC:
+            if (!(p = sm_ring_rec_peek(&run->ring, &len))) {
+                sched_yield();
+                break;
+            }
+            run->bad |= len != n % run->rec_mod + 1;
+            for (i = 0; i < len; i++)
+                run->bad |= p[i] != (uint8_t)n;
+            sm_ring_rec_release(&run->ring);
+            n++;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int bench(const char *name, int mode, size_t bytes, size_t size)
+{
+    struct run run;
+    pthread_t prod, cons;
+    uint64_t t0, t1;
+    double secs;
+
+    if (sm_ring_init(&run.ring, size) < 0) {
+        fprintf(stderr, "bad ring size %zu\n", size);
+        return 1;
+    }
+    run.rec_mod = SM_RING_REC_MAX(&run.ring) < 251 ?
+                  SM_RING_REC_MAX(&run.ring) : 251;
+    run.mode = mode;
+    run.bad = 0;
+    run.total = mode == MODE_REC ? bytes / ((run.rec_mod + 1) / 2) : bytes;
+    t0 = bench_ns();
+    pthread_create(&cons, NULL, consumer, &run);
+    pthread_create(&prod, NULL, producer, &run);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    t1 = bench_ns();
+    secs = (t1 - t0) / 1e9;
+    if (mode == MODE_REC)
+        printf("%-8s %8.2f GB/s  %8.2f Mrec/s%s\n", name,
+               run.total * ((run.rec_mod + 1) / 2) / secs / 1e9, run.total / secs / 1e6,
+               run.bad ? "  BAD DATA" : "");
+    else
+        printf("%-8s %8.2f GB/s%s\n", name, run.total / secs / 1e9,
+               run.bad ? "  BAD DATA" : "");
+    sm_ring_destroy(&run.ring);
+    return run.bad;
+}
+
+int main(int argc, char **argv)
+{
+    size_t bytes = (argc > 1 ? strtoul(argv[1], NULL, 0) : 1024) << 20;
+    size_t size = argc > 2 ? strtoul(argv[2], NULL, 0) : 64 * 1024;
+    int bad = 0;
+
+    printf("ring %zu bytes, %zu MB\n", size, bytes >> 20);
+    bad |= bench("copy", MODE_COPY, bytes, size);
+    bad |= bench("span", MODE_SPAN, bytes, size);
+    bad |= bench("record", MODE_REC, bytes, size);
+    return bad;
+}
@@ -0,0 +1,406 @@
+/**********************************************************************
+ *
+ * Filename:    shm_bench.c
+ *
+ * Description: message rate and latency between machines in two
+ *              processes, over a smshm link and over a unix socket.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o shm_bench shm_bench.c smshm.c \
+ *            smreactor.c smsched.c smring.c tmwheel.c cdll.c states.c \
+ *            getms.c "
+ * run: " ./shm_bench [messages [round trips]] "
+ *
+ * The other process is a forked child. rate: a parent machine posts
+ * MSG_SIZE byte messages to a named child machine as fast as they are
+ * taken, BURST per step. latency: a parent machine pings a child machine
+ * which answers, one at a time, both processes sleep in between. The
+ * baseline is the same over a SOCK_SEQPACKET socketpair, a send() and a
+ * recv() per message. shm latency is taken again with spin_us set, which
+ * the link ignores on a single cpu.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "smshm.h"
+#include "bench.h"
+
+#define MSG_SIZE    64
+#define BURST       64          /* posts per step */
+#define RING_SIZE   (1 << 20)
+#define INBOX_SIZE  (1 << 16)
+#define SPIN_US     50
+
+/* what the child found, in memory shared with the parent */
+struct result {
+    uint64_t ns;                /* first to last message */
+    unsigned long count;
+    unsigned long sleeps;       /* child told the parent to ring */
+    unsigned long doorbells;    /* child rang the parent */
+};
+
+static struct result *result;
+static struct sm_sched sched;
+static struct sm_reactor reactor;
+static struct sm_shm shm_link;
+static int sock = -1;
+static int done;
+static unsigned long total;     /* messages or round trips */
+static unsigned long sent;
+static unsigned long count;
+static uint64_t t_first;
+static uint64_t *rtt;
+static uint32_t to_id;          /* the child machine, found by name */
+
+static void end_test(void)
+{
+    done = 1;
+    result->count = count;
+    result->ns = bench_ns() - t_first;
+}
+
+/* shm rate */
+static int shm_source_state(struct state_machine *sm)
+{
+    static uint8_t payload[MSG_SIZE];
+    unsigned int n;
+
+    (void)sm;
+    for (n = 0; n < BURST && sent < total; n++, sent++)
+        if (sm_shm_post(&shm_link, to_id, SM_SHM_NOBODY, payload, MSG_SIZE) < 0)
+            return SM_RETURN_REPEAT; /* ring full, after the flush */
+    if (sent < total)
+        return SM_RETURN_REPEAT; /* end the pass, one doorbell per burst */
+    done = 1;
+    return SM_RETURN_ERROR;
+}
+
+static int shm_sink_state(struct state_machine *sm)
+{
+    struct sm_shm_task *st = cast_sm_to_shm_task(sm);
+    size_t len;
+
+    if (!count)
+        t_first = bench_ns();
+    while (sm_shm_peek(st, &len)) {
+        sm_shm_release(st);
+        count++;
+    }
+    if (count >= total)
+        end_test();
+    return SM_RETURN_DONE;
+}
+
+/* shm latency */
+static int shm_ping_state(struct state_machine *sm)
+{
+    struct sm_shm_task *st = cast_sm_to_shm_task(sm);
+    uint64_t now = bench_ns();
+
+    sm_shm_post(&shm_link, to_id, st->id, &now, sizeof(now));
+    return SM_RETURN_DONE;
+}
+
+static int shm_pinged_state(struct state_machine *sm)
+{
+    struct sm_shm_task *st = cast_sm_to_shm_task(sm);
+    const struct sm_shm_msg *msg;
+    size_t len;
+    uint64_t then;
+
+    msg = sm_shm_peek(st, &len);
+    memcpy(&then, msg->data, sizeof(then));
+    rtt[count++] = bench_ns() - then;
+    sm_shm_release(st);
+    if (count < total)
+        return SM_RETURN_DONE;
+    done = 1;
+    return SM_RETURN_ERROR;
+}
+
+static int shm_pong_state(struct state_machine *sm)
+{
+    struct sm_shm_task *st = cast_sm_to_shm_task(sm);
+    const struct sm_shm_msg *msg;
+    size_t len;
+
+    if (!count)
+        t_first = bench_ns();
+    while ((msg = sm_shm_peek(st, &len))) {
+        if (sm_shm_post(&shm_link, msg->from, st->id, msg->data, len) < 0)
+            break;
+        sm_shm_release(st);
+        count++;
+    }
+    if (count >= total)
+        end_test();
+    return SM_RETURN_DONE;
+}
+
+static state_func shm_source_table[] = {
+    shm_source_state,
+};
+static state_func shm_sink_table[] = {
+    SM_WAIT_SHM(1000),
+    SM_JUMP(shm_sink_table),
+    shm_sink_state,
+    SM_JUMP(shm_sink_table),
+};
+static state_func shm_ping_table[] = {
+    shm_ping_state,
+    SM_WAIT_SHM(1000),
+    SM_JUMP(shm_ping_table),    /* lost, ping again */
+    shm_pinged_state,
+    SM_JUMP(shm_ping_table),
+};
+static state_func shm_pong_table[] = {
+    SM_WAIT_SHM(1000),
+    SM_JUMP(shm_pong_table),
+    shm_pong_state,
+    SM_JUMP(shm_pong_table),
+};
+
+/* socket rate */
+static int sock_source_state(struct state_machine *sm)
+{
+    static uint8_t payload[MSG_SIZE];
+    unsigned int n;
+
+    for (n = 0; n < BURST && sent < total; n++, sent++) {
+        if (send(sock, payload, MSG_SIZE, 0) < 0) {
+            sm_fd_task_wait(cast_sm_to_fd_task(sm), sock, EPOLLOUT);
+            return SM_RETURN_REPEAT;
+        }
+    }
+    if (sent < total)
+        return SM_RETURN_REPEAT;
+    done = 1;
+    return SM_RETURN_ERROR;
+}
+
+static int sock_sink_state(struct state_machine *sm)
+{
+    uint8_t buf[MSG_SIZE];
+
+    (void)sm;
+    if (!count)
+        t_first = bench_ns();
+    while (recv(sock, buf, sizeof(buf), 0) > 0)
+        count++;
+    if (count >= total)
+        end_test();
+    return SM_RETURN_DONE;
+}
+
+/* socket latency */
+static int sock_ping_state(struct state_machine *sm)
+{
+    uint64_t now = bench_ns();
+
+    (void)sm;
+    if (send(sock, &now, sizeof(now), 0) < 0)
+        return SM_RETURN_REPEAT;
+    return SM_RETURN_DONE;
+}
+
+static int sock_pinged_state(struct state_machine *sm)
+{
+    uint64_t then;
+
+    (void)sm;
+    if (recv(sock, &then, sizeof(then), 0) != sizeof(then))
+        return SM_RETURN_DONE;
+    rtt[count++] = bench_ns() - then;
+    if (count < total)
+        return SM_RETURN_DONE;
+    done = 1;
+    return SM_RETURN_ERROR;
+}
+
+static int sock_pong_state(struct state_machine *sm)
+{
+    uint64_t stamp;
+
+    (void)sm;
+    if (!count)
+        t_first = bench_ns();
+    while (recv(sock, &stamp, sizeof(stamp), 0) == sizeof(stamp)) {
+        send(sock, &stamp, sizeof(stamp), 0);
+        count++;
+    }
+    if (count >= total)
+        end_test();
+    return SM_RETURN_DONE;
+}
+
+static state_func sock_source_table[] = {
+    sock_source_state,
+};
+static state_func sock_sink_table[] = {
+    SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 1000),
+    SM_JUMP(sock_sink_table),
+    sock_sink_state,
+    SM_JUMP(sock_sink_table),
+};
+static state_func sock_ping_table[] = {
+    sock_ping_state,
+    SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 1000),
+    SM_JUMP(sock_ping_table),
+    sock_pinged_state,
+    SM_JUMP(sock_ping_table),
+};
+static state_func sock_pong_table[] = {
+    SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 1000),
+    SM_JUMP(sock_pong_table),
+    sock_pong_state,
+    SM_JUMP(sock_pong_table),
+};
+
+/* one side of a test: own scheduler, reactor and machine */
+static void side(int peer, state_func *table, const char *name,
+                 const char *to, unsigned int spin_us)
+{
+    struct sm_shm_task st;
+    struct sm_fd_task ft;
+
+    sm_sched_init(&sched);
+    if (sm_reactor_init(&reactor) < 0)
+        exit(1);
+    sm_reactor_attach(&reactor, &sched);
+    done = 0;
+    sent = count = 0;
+    if (sock < 0) {
+        if (sm_shm_join(&shm_link, peer, &reactor) < 0 ||
+            sm_shm_task_init(&st, INBOX_SIZE, table, NULL) < 0)
+            exit(1);
+        shm_link.spin_us = spin_us;
+        if (name && sm_shm_bind(&shm_link, name, &st) < 0)
+            exit(1);
+        while (to && (int)(to_id = sm_shm_lookup(&shm_link, to)) < 0)
+            usleep(100); /* the child is still binding */
+        sm_sched_add(&sched, &st.task);
+        for (;;) {
+            sm_sched_run_until_blocked(&sched);
+            if (done)
+                break;
+            sm_shm_idle(&shm_link, &reactor, &sched);
+        }
+        sm_shm_flush(&shm_link); /* the last posts */
+        if (peer) {
+            result->sleeps = shm_link.sleeps;
+            result->doorbells = shm_link.doorbells;
+        }
+        sm_shm_task_destroy(&st);
+    } else {
+        sm_fd_task_init(&ft, sock, table, NULL);
+        sm_sched_add(&sched, &ft.task);
+        for (;;) {
+            sm_sched_run_until_blocked(&sched);
+            if (done)
+                break;
+            sm_reactor_idle(&reactor, &sched);
+        }
+        sm_fd_task_release(&reactor, &ft);
+    }
+    sm_reactor_close(&reactor);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* fork the child side, run the parent side, report */
+static void run(const char *what, int use_sock, int latency,
+                unsigned long n, unsigned int spin_us)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (use_sock) {
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sv) < 0)
+            exit(1);
+    } else if (sm_shm_create(&shm_link, RING_SIZE) < 0) {
+        perror("sm_shm_create");
+        exit(1);
+    }
+    total = n;
+    memset(result, 0, sizeof(*result));
+    fflush(stdout);
+    pid = fork();
+    if (!pid) {
+        sock = use_sock ? sv[1] : -1;
+        if (use_sock)
+            side(1, latency ? sock_pong_table : sock_sink_table, NULL, NULL, 0);
+        else
+            side(1, latency ? shm_pong_table : shm_sink_table,
+                 latency ? "pong" : "sink", NULL, spin_us);
+        _exit(0);
+    }
+    sock = use_sock ? sv[0] : -1;
+    if (use_sock)
+        side(0, latency ? sock_ping_table : sock_source_table, NULL, NULL, 0);
+    else
+        side(0, latency ? shm_ping_table : shm_source_table,
+             latency ? "ping" : NULL, latency ? "pong" : "sink", spin_us);
+    waitpid(pid, NULL, 0);
+
+    if (latency) {
+        uint64_t sum = 0;
+        unsigned long i;
+
+        qsort(rtt, n, sizeof(*rtt), cmp_u64);
+        for (i = 0; i < n; i++)
+            sum += rtt[i];
+        printf("%-22s round trip avg %6.1f us  p50 %6.1f  p99 %6.1f\n", what,
+               sum / 1e3 / n, rtt[n / 2] / 1e3, rtt[n * 99 / 100] / 1e3);
+    } else {
+        printf("%-22s %6.2f M msgs/s", what, result->count * 1e3 / result->ns);
+        if (!use_sock)
+            printf("  %lu doorbells from %lu posts, child slept %lu times",
+                   shm_link.doorbells, shm_link.posts, result->sleeps);
+        printf("\n");
+    }
+    if (use_sock) {
+        close(sv[0]);
+        close(sv[1]);
+        sock = -1;
+    } else {
+        sm_shm_close(&shm_link);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long msgs = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+    unsigned long trips = argc > 2 ? strtoul(argv[2], NULL, 0) : 20000;
+
+    result = mmap(NULL, sizeof(*result), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    rtt = malloc(trips * sizeof(*rtt));
+    if (result == MAP_FAILED || !rtt || !msgs || !trips)
+        return 1;
+    printf("%d byte messages\n", MSG_SIZE);
+    run("socket rate", 1, 0, msgs, 0);
+    run("shm rate", 0, 0, msgs, 0);
+    run("socket latency", 1, 1, trips, 0);
+    run("shm latency", 0, 1, trips, 0);
+    run("shm latency spinning", 0, 1, trips, SPIN_US);
+    return 0;
+}
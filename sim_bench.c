@@ -0,0 +1,132 @@
+/**********************************************************************
+ *
+ * Filename:    sim_bench.c
+ *
+ * Description: hours of a big fleet's timeouts in seconds, on the
+ *              virtual clock of smsim.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -DSM_SIMULATION \
+ *            -DSM_TIMER_SIZE=uint32_t -o sim_bench sim_bench.c smsim.c \
+ *            smsched.c tmwheel.c cdll.c states.c getms.c "
+ * run: " ./sim_bench [machines [hours [seed]]] "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "smsim.h"
+#include "bench.h"
+
+#define THINK_MIN_MS    30000   /* idle between requests */
+#define THINK_SPAN_MS   270000
+#define REPLY_SPAN_MS   5000    /* reply latency, 0 .. this */
+#define TIMEOUT_MS      3000    /* give up on a reply after this */
+
+/* a client that idles, sends a request and waits for the reply or times out */
+struct client {
+    struct sm_task task;
+    uint32_t requests;
+    uint32_t timeouts;
+};
+
+#define cast_sm_to_client(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct client, task.sm))
+
+static int think_state(struct state_machine *sm)
+{
+    uint32_t ms = THINK_MIN_MS + sm_sim_random(sm_sim_of(sm)) % THINK_SPAN_MS;
+
+    SM_START_TIMER(sm, SM_MS_TO_TICKS(ms));
+    return SM_RETURN_DONE;
+}
+
+static int request_state(struct state_machine *sm)
+{
+    struct client *c = cast_sm_to_client(sm);
+    uint32_t ms = sm_sim_random(sm_sim_of(sm)) % REPLY_SPAN_MS;
+
+    c->requests++;
+    if (ms >= TIMEOUT_MS) {
+        c->timeouts++;
+        ms = TIMEOUT_MS;
+    }
+    SM_START_TIMER(sm, SM_MS_TO_TICKS(ms));
+    return SM_RETURN_DONE;
+}
+
+state_func client_table[] = {
+    think_state,
+    sm_wait_ticks_state,
+    request_state,
+    sm_wait_ticks_state,
+    SM_JUMP(client_table),
+};
+
+int main(int argc, char **argv)
+{
+    size_t machines = 1000000;
+    double hours = 1;
+    uint64_t seed = 1;
+    struct sm_sim sim;
+    struct client *clients;
+    struct sm_task **order;
+    struct rusage ru;
+    unsigned long steps;
+    uint64_t t0, ns, requests = 0, timeouts = 0, sum = 0;
+    size_t i;
+
+    if (argc > 1)
+        machines = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        hours = atof(argv[2]);
+    if (argc > 3)
+        seed = strtoull(argv[3], NULL, 0);
+
+    clients = calloc(machines, sizeof(*clients));
+    order = malloc(machines * sizeof(*order));
+    if (!clients || !order) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    sm_sim_init(&sim, seed);
+    for (i = 0; i < machines; i++) {
+        sm_task_init(&clients[i].task, client_table, NULL);
+        order[i] = &clients[i].task;
+    }
+    sm_sim_add_all(&sim, order, machines);
+
+    t0 = bench_ns();
+    steps = sm_sim_run(&sim, (uint64_t)(hours * 3600 * SM_TICK_RATE));
+    ns = bench_ns() - t0;
+
+    for (i = 0; i < machines; i++) {
+        requests += clients[i].requests;
+        timeouts += clients[i].timeouts;
+        sum = sum * 31 + clients[i].requests * 7 + clients[i].timeouts;
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%zu machines, %.2f h simulated in %.2f s wall (%.0fx)\n",
+           machines, sm_sim_elapsed(&sim) / (3600.0 * SM_TICK_RATE),
+           ns / 1e9, sm_sim_elapsed(&sim) * (1e9 / SM_TICK_RATE) / ns);
+    printf("%lu steps %.1f Msteps/s, %lu passes, %lu clock jumps\n", steps,
+           steps * 1e3 / ns, sim.passes, sim.jumps);
+    printf("%llu requests %llu timeouts, busiest tick %llu ran %lu steps\n",
+           (unsigned long long)requests, (unsigned long long)timeouts,
+           (unsigned long long)sim.burst_tick, sim.burst);
+    printf("peak memory %ld MB, seed %llu checksum %016llx\n",
+           ru.ru_maxrss / 1024, (unsigned long long)seed,
+           (unsigned long long)sum);
+    free(order);
+    free(clients);
+    return 0;
+}
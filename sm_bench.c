@@ -0,0 +1,535 @@
+/**********************************************************************
+ *
+ * Filename:    sm_bench.c
+ *
+ * Description: benchmark suite for the state engine and the cdll list,
+ *              results as JSON.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -pthread -o sm_bench sm_bench.c \
+ *            states.c getms.c cdll.c "
+ *          add -DSM_CACHED_TICKS -DSM_TICK_TSC to time the cached tick clock
+ * run: " ./sm_bench [scale] > results.json "
+ *      scale (default 1.0) multiplies the operations per benchmark
+ *
+ * Every result is one object in "results":
+ *      {"name": ..., "n": machines or list size, "ops": operations timed,
+ *       "ns_per_op": ..., "cycles_per_op": ...}
+ * cycles_per_op is 0 where there is no cycle counter. An op is one
+ * sm_run_state() call unless the name says otherwise.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "states.h"
+#include "cdll.h"
+#include "bench.h"
+
+static double scale = 1.0;
+static int nresults;
+
+static unsigned long scaled(unsigned long ops)
+{
+    unsigned long n = ops * scale;
+
+    return n ? n : 1;
+}
+
+struct bench_clock {
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+static void bench_start(struct bench_clock *c)
+{
+    c->ns = bench_ns();
+    c->cycles = bench_cycles();
+}
+
+static void bench_report(struct bench_clock *c, const char *name,
+                         unsigned long n, unsigned long ops)
+{
+    uint64_t cycles = bench_cycles() - c->cycles;
+    uint64_t ns = bench_ns() - c->ns;
+
+    printf("%s\n    {\"name\": \"%s\", \"n\": %lu, \"ops\": %lu, "
+           "\"ns_per_op\": %.3f, \"cycles_per_op\": %.3f}",
+           nresults++ ? "," : "", name, n, ops, (double)ns / ops,
+           (double)cycles / ops);
+    fflush(stdout);
+}
+
+/*
+ * state engine
+ */
+static int repeat_state(struct state_machine *sm)
+{
+    (void)sm;
+    return SM_RETURN_REPEAT;
+}
+
+static int done_state(struct state_machine *sm)
+{
+    (void)sm;
+    return SM_RETURN_DONE;
+}
+
+state_func repeat_table[] = {
+    repeat_state,
+};
+
+state_func done_table[] = {
+    done_state, done_state, done_state, done_state,
+    done_state, done_state, done_state, done_state,
+    SM_JUMP(done_table),
+};
+
+extern state_func jump_table_b[];
+state_func jump_table_a[] = {
+    done_state,
+    SM_JUMP(jump_table_b),
+};
+state_func jump_table_b[] = {
+    done_state,
+    SM_JUMP(jump_table_a),
+};
+
+/* never times out while benchmarked, polls sm_wait_ticks_state */
+state_func wait_table[] = {
+    SM_DELAY_MS(60000),
+    SM_JUMP(wait_table),
+};
+
+state_func delay_table[] = {
+    SM_DELAY_MS(0),
+    SM_JUMP(delay_table),
+};
+
+/* a pile of distinct state functions for the scattered fleet */
+static unsigned long fleet_work;
+
+#define FLEET_STATE(n) \
+    static int fleet_state_##n(struct state_machine *sm) \
+    { \
+        (void)sm; \
+        fleet_work += n; \
+        return SM_RETURN_DONE; \
+    }
+FLEET_STATE(1) FLEET_STATE(2) FLEET_STATE(3) FLEET_STATE(4)
+FLEET_STATE(5) FLEET_STATE(6) FLEET_STATE(7) FLEET_STATE(8)
+FLEET_STATE(9) FLEET_STATE(10) FLEET_STATE(11) FLEET_STATE(12)
+FLEET_STATE(13) FLEET_STATE(14) FLEET_STATE(15) FLEET_STATE(16)
+
+static state_func fleet_states[] = {
+    fleet_state_1, fleet_state_2, fleet_state_3, fleet_state_4,
+    fleet_state_5, fleet_state_6, fleet_state_7, fleet_state_8,
+    fleet_state_9, fleet_state_10, fleet_state_11, fleet_state_12,
+    fleet_state_13, fleet_state_14, fleet_state_15, fleet_state_16,
+};
+
+#define FLEET_TABLES    1024    /* tables the scattered fleet runs through */
+#define FLEET_STATES    8       /* states per table, then a jump */
+#define FLEET_SLOTS     (FLEET_STATES + 2)
+#define FLEET_STRIDE    64      /* bytes per machine, a cache line each */
+
+static void bench_table(const char *name, state_func *table,
+                        unsigned long ops)
+{
+    struct state_machine sm;
+    struct bench_clock c;
+    unsigned long i;
+
+    SM_SET_TABLE(&sm, table);
+    sm_run_state(&sm); /* warm up, and get the wait table waiting */
+    sm_run_state(&sm);
+    bench_start(&c);
+    for (i = 0; i < ops; i++)
+        bench_keep(sm_run_state(&sm));
+    bench_report(&c, name, 1, ops);
+}
+
+/*
+ * a machine sitting on an SM_JUMP, the inline jump alone per op. A state
+ * done into a jump is dispatch_done_jump, both in one sm_run_state().
+ */
+static void bench_jump(unsigned long ops)
+{
+    struct state_machine sm;
+    struct bench_clock c;
+    unsigned long i;
+
+    SM_SET_TABLE(&sm, jump_table_a);
+    bench_start(&c);
+    for (i = 0; i < ops; i++) {
+        sm.stateptrptr = &jump_table_a[1];
+        bench_keep(sm_run_state(&sm));
+    }
+    bench_report(&c, "dispatch_jump", 1, ops);
+}
+
+/* a whole SM_DELAY_MS(0): delay, wait and the jump back, per op */
+static void bench_delay(unsigned long ops)
+{
+    struct state_machine sm;
+    struct bench_clock c;
+    unsigned long i;
+
+    SM_SET_TABLE(&sm, delay_table);
+    bench_start(&c);
+    for (i = 0; i < ops; i++) {
+        while (sm_run_state(&sm) > 0)
+            ;
+        if (sm.stateptrptr != delay_table)
+            i--; /* the tick moved under the wait, go round again */
+    }
+    bench_report(&c, "sm_delay_ms_0_cycle", 1, ops);
+}
+
+/*
+ * round robin over n machines like a mainloop, in one array and all on
+ * done_table. The best case, the prefetcher sees every machine coming.
+ */
+static void bench_fleet(unsigned long n, unsigned long ops)
+{
+    struct state_machine *sms = malloc(n * sizeof(*sms));
+    struct bench_clock c;
+    unsigned long i, done = 0;
+
+    if (!sms)
+        return;
+    for (i = 0; i < n; i++)
+        SM_SET_TABLE(&sms[i], done_table);
+    if (ops < n)
+        ops = n;
+    bench_start(&c);
+    while (done < ops) {
+        for (i = 0; i < n; i++)
+            bench_keep(sm_run_state(&sms[i]));
+        done += n;
+    }
+    bench_report(&c, "fleet_round_robin", n, done);
+    free(sms);
+}
+
+/* FLEET_TABLES tables of random states, each jumps to a random table */
+static state_func *fleet_tables(void)
+{
+    state_func *t = malloc(FLEET_TABLES * FLEET_SLOTS * sizeof(*t));
+    unsigned int i, s;
+
+    if (!t)
+        return NULL;
+    for (i = 0; i < FLEET_TABLES; i++) {
+        state_func *table = t + i * FLEET_SLOTS;
+
+        for (s = 0; s < FLEET_STATES; s++)
+            table[s] = fleet_states[rand() % elements_of(fleet_states)];
+        table[s++] = sm_jump_table_state;
+        table[s] = (state_func)(t + (rand() % FLEET_TABLES) * FLEET_SLOTS);
+    }
+    return t;
+}
+
+/*
+ * the same round robin closer to a real program: machines a cache line
+ * apart and visited in random order, each somewhere in its own table.
+ */
+static void bench_fleet_scattered(unsigned long n, unsigned long ops,
+                                  state_func *tables)
+{
+    char *mem = malloc(n * FLEET_STRIDE);
+    struct state_machine **order = malloc(n * sizeof(*order));
+    struct state_machine *sm;
+    struct bench_clock c;
+    unsigned long i, j, done = 0;
+
+    if (!mem || !order || !tables) {
+        free(mem);
+        free(order);
+        return;
+    }
+    for (i = 0; i < n; i++)
+        order[i] = (struct state_machine *)(mem + i * FLEET_STRIDE);
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        sm = order[i];
+        order[i] = order[j];
+        order[j] = sm;
+    }
+    for (i = 0; i < n; i++)
+        SM_SET_TABLE(order[i], tables + (rand() % FLEET_TABLES) * FLEET_SLOTS
+                                      + rand() % FLEET_STATES);
+    if (ops < n)
+        ops = n;
+    bench_start(&c);
+    while (done < ops) {
+        for (i = 0; i < n; i++)
+            bench_keep(sm_run_state(order[i]));
+        done += n;
+    }
+    bench_report(&c, "fleet_scattered", n, done);
+    bench_keep(fleet_work);
+    free(order);
+    free(mem);
+}
+
+static void bench_getms(unsigned long ops)
+{
+    struct bench_clock c;
+    unsigned long i;
+
+    bench_start(&c);
+    for (i = 0; i < ops; i++)
+        bench_keep(getms());
+    bench_report(&c, "getms", 1, ops);
+
+    /* the clock read a state sees, a load with SM_CACHED_TICKS */
+    bench_start(&c);
+    for (i = 0; i < ops; i++)
+        bench_keep(READ_GLOBAL_TICKS);
+    bench_report(&c, "read_global_ticks", 1, ops);
+
+    bench_start(&c);
+    for (i = 0; i < ops; i++)
+        bench_keep(sm_tick_update());
+    bench_report(&c, "sm_tick_update", 1, ops);
+}
+
+/*
+ * cdll, nodes in one array so only the list code is measured
+ */
+struct bench_node {
+    struct cdll node;
+    unsigned long value;
+};
+
+static int bench_node_cmp(void *priv, const void *a, const void *b)
+{
+    const struct bench_node *x = a, *y = b;
+
+    (void)priv;
+    return x->value < y->value ? -1 : x->value > y->value;
+}
+
+#define BENCH_DELETE_MIN 4096   /* nodes deleted per timed run */
+
+static void bench_cdll(unsigned long n, unsigned long ops)
+{
+    /* enough lists of n for the delete runs to dwarf the clock reads */
+    unsigned long nlists = (BENCH_DELETE_MIN + n - 1) / n;
+    struct bench_node *nodes = malloc(nlists * n * sizeof(*nodes));
+    struct cdll *heads = malloc(nlists * sizeof(*heads));
+    unsigned long rounds = ops / n ? ops / n : 1;
+    unsigned long r, i, sum = 0;
+    struct bench_clock c;
+    struct cdll head, *pos;
+
+    if (!nodes || !heads) {
+        free(nodes);
+        free(heads);
+        return;
+    }
+    for (i = 0; i < nlists * n; i++)
+        nodes[i].value = i;
+    cdll_init(&head);
+
+    bench_start(&c);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++)
+            cdll_insert_node_head(&nodes[i].node, &head);
+        cdll_init(&head);
+    }
+    bench_report(&c, "cdll_insert_node_head", n, rounds * n);
+
+    bench_start(&c);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < n; i++)
+            cdll_insert_node_tail(&nodes[i].node, &head);
+        cdll_init(&head);
+    }
+    bench_report(&c, "cdll_insert_node_tail", n, rounds * n);
+
+    /* delete needs full lists each run, only the deletes are timed */
+    {
+        uint64_t ns = 0, cycles = 0;
+
+        for (r = 0; r < rounds; r += nlists) {
+            for (i = 0; i < nlists * n; i++) {
+                if (i % n == 0)
+                    cdll_init(&heads[i / n]);
+                cdll_insert_node_tail(&nodes[i].node, &heads[i / n]);
+            }
+            bench_start(&c);
+            for (i = 0; i < nlists * n; i++)
+                cdll_delete_node(&nodes[i].node);
+            ns += bench_ns() - c.ns;
+            cycles += bench_cycles() - c.cycles;
+        }
+        rounds = r;
+        /* report as if it ran in one go */
+        c.ns = bench_ns() - ns;
+        c.cycles = bench_cycles() - cycles;
+        bench_report(&c, "cdll_delete_node", n, rounds * n);
+    }
+
+    for (i = 0; i < n; i++)
+        cdll_insert_node_tail(&nodes[i].node, &head);
+    bench_start(&c);
+    for (r = 0; r < rounds; r++) {
+        cdll_for_each(pos, &head)
+            sum += cast_p_to_outer(struct cdll *, pos, struct bench_node,
+                                   node)->value;
+    }
+    bench_keep(sum);
+    bench_report(&c, "cdll_for_each", n, rounds * n);
+
+    /* shuffled keys, one sort per op, rebuilding the list is not timed */
+    {
+        uint64_t ns = 0, cycles = 0;
+
+        rounds = ops / (n * 20) ? ops / (n * 20) : 1;
+        for (r = 0; r < rounds; r++) {
+            cdll_init(&head);
+            for (i = 0; i < n; i++) {
+                nodes[i].value = (i * 2654435761UL) % n;
+                cdll_insert_node_tail(&nodes[i].node, &head);
+            }
+            bench_start(&c);
+            cdll_sort_type(&head, struct bench_node, node, bench_node_cmp,
+                           NULL);
+            ns += bench_ns() - c.ns;
+            cycles += bench_cycles() - c.cycles;
+        }
+        c.ns = bench_ns() - ns;
+        c.cycles = bench_cycles() - cycles;
+    }
+    bench_report(&c, "cdll_sort", n, rounds);
+    free(nodes);
+    free(heads);
+}
+
+/*
+ * the list_unit_test pattern, get an object, init and queue it, then
+ * delete and give it back, calloc/free against the cdll_pool
+ */
+struct bench_record {
+    struct cdll node;
+    unsigned long id;
+    char payload[48];
+};
+
+static void bench_alloc(unsigned long ops)
+{
+    struct cdll_pool pool;
+    struct cdll_pool_cache cache;
+    struct bench_record *rec[16];
+    struct bench_clock c;
+    struct cdll queue;
+    unsigned long i, j;
+
+    cdll_init(&queue);
+    bench_start(&c);
+    for (i = 0; i < ops; i += 16) {
+        for (j = 0; j < 16; j++) {
+            rec[j] = calloc(1, sizeof(*rec[j]));
+            cdll_init(&rec[j]->node);
+            rec[j]->id = i + j;
+            cdll_insert_node_tail(&rec[j]->node, &queue);
+        }
+        for (j = 0; j < 16; j++) {
+            cdll_delete_node(&rec[j]->node);
+            free(rec[j]);
+        }
+    }
+    bench_report(&c, "calloc_free_node", 16, ops);
+
+    cdll_pool_init_type(&pool, struct bench_record, node, 0);
+    bench_start(&c);
+    for (i = 0; i < ops; i += 16) {
+        for (j = 0; j < 16; j++) {
+            rec[j] = cdll_pool_zalloc(&pool);
+            rec[j]->id = i + j;
+            cdll_insert_node_tail(&rec[j]->node, &queue);
+        }
+        for (j = 0; j < 16; j++) {
+            cdll_delete_node(&rec[j]->node);
+            cdll_pool_free(&pool, rec[j]);
+        }
+    }
+    bench_report(&c, "cdll_pool_zalloc_free_node", 16, ops);
+
+    bench_start(&c);
+    for (i = 0; i < ops; i += 16) {
+        for (j = 0; j < 16; j++) {
+            rec[j] = cdll_pool_alloc(&pool);
+            rec[j]->id = i + j;
+            cdll_insert_node_tail(&rec[j]->node, &queue);
+        }
+        for (j = 0; j < 16; j++) {
+            cdll_delete_node(&rec[j]->node);
+            cdll_pool_free(&pool, rec[j]);
+        }
+    }
+    bench_report(&c, "cdll_pool_alloc_free_node", 16, ops);
+
+    cdll_pool_cache_init(&cache, &pool);
+    bench_start(&c);
+    for (i = 0; i < ops; i += 16) {
+        for (j = 0; j < 16; j++) {
+            rec[j] = cdll_pool_cache_alloc(&cache);
+            rec[j]->id = i + j;
+            cdll_insert_node_tail(&rec[j]->node, &queue);
+        }
+        for (j = 0; j < 16; j++) {
+            cdll_delete_node(&rec[j]->node);
+            cdll_pool_cache_free(&cache, rec[j]);
+        }
+    }
+    bench_report(&c, "cdll_pool_cache_alloc_free_node", 16, ops);
+    cdll_pool_cache_flush(&cache);
+    cdll_pool_destroy(&pool);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned long fleets[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000
+    };
+    static const unsigned long lists[] = { 16, 1024, 65536, 1048576 };
+    state_func *tables;
+    unsigned int i;
+
+    if (argc > 1)
+        scale = strtod(argv[1], NULL);
+    srand(1);
+    tables = fleet_tables();
+    SM_TICK_UPDATE();
+
+    printf("{\n  \"suite\": \"sm_bench\",\n  \"timer_bits\": %zu,\n"
+           "  \"results\": [", sizeof(SM_TIMER_SIZE) * 8);
+    bench_table("dispatch_repeat", repeat_table, scaled(20000000));
+    bench_table("dispatch_done", done_table, scaled(20000000));
+    bench_table("dispatch_done_jump", jump_table_a, scaled(20000000));
+    bench_jump(scaled(20000000));
+    bench_table("sm_wait_ticks_poll", wait_table, scaled(5000000));
+    bench_delay(scaled(2000000));
+    for (i = 0; i < elements_of(fleets); i++)
+        bench_fleet(fleets[i], scaled(20000000));
+    for (i = 0; i < elements_of(fleets); i++)
+        bench_fleet_scattered(fleets[i], scaled(20000000), tables);
+    bench_getms(scaled(5000000));
+    for (i = 0; i < elements_of(lists); i++)
+        bench_cdll(lists[i], scaled(10000000));
+    bench_alloc(scaled(10000000));
+    printf("\n  ]\n}\n");
+    free(tables);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/**********************************************************************
+ *
+ * Filename:    smbatch.c
+ *
+ * Description: structure of arrays machine pool, steps big fleets of
+ *              small identical machines in batches.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "smbatch.h"
+#include "smtscan.h"
+
+#ifdef __GNUC__
+#define sm_batch_prefetch(p) __builtin_prefetch(p)
+#else
+#define sm_batch_prefetch(p)
+#endif
+
+#define SM_BATCH_ROUND(n) \
+    (((n) + SM_BATCH_ALIGN - 1) & ~(size_t)(SM_BATCH_ALIGN - 1))
+
+static void *sm_batch_alloc(size_t bytes)
+{
+    void *p = aligned_alloc(SM_BATCH_ALIGN, SM_BATCH_ROUND(bytes));
+
+    if (p)
+        memset(p, 0, SM_BATCH_ROUND(bytes));
+    return p;
+}
+
+int sm_batch_init(struct sm_batch_pool *pool, size_t count, size_t ctx_size)
+{
+    size_t i;
+
+    /* keep every context starting on the same alignment */
+    if (ctx_size > SM_BATCH_ALIGN / 2)
+        ctx_size = SM_BATCH_ROUND(ctx_size);
+    else
+        while (ctx_size & (ctx_size - 1))
+            ctx_size++; /* power of 2, never straddles a line */
+    pool->count = count;
+    pool->ncontexts = count;
+    pool->ctx_size = ctx_size;
+    pool->pc = sm_batch_alloc(count * sizeof(*pool->pc));
+    pool->start_timer = sm_batch_alloc(count * sizeof(*pool->start_timer));
+    pool->delay = sm_batch_alloc(count * sizeof(*pool->delay));
+    pool->ctx = sm_batch_alloc(count * sizeof(*pool->ctx));
+    pool->dirty = NULL;
+    pool->contexts = sm_batch_alloc(count * ctx_size + 1);
+    if (!pool->pc || !pool->start_timer || !pool->delay || !pool->ctx ||
+        !pool->contexts) {
+        sm_batch_free(pool);
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+        pool->ctx[i] = i;
+    return 0;
+}
+
+void sm_batch_free(struct sm_batch_pool *pool)
+{
+    free(pool->pc);
+    free(pool->start_timer);
+    free(pool->delay);
+    free(pool->ctx);
+    free(pool->contexts);
+    free(pool->dirty);
+    pool->pc = NULL;
+    pool->start_timer = NULL;
+    pool->delay = NULL;
+    pool->ctx = NULL;
+    pool->contexts = NULL;
+    pool->dirty = NULL;
+    pool->count = 0;
+}
+
+int sm_batch_track_dirty(struct sm_batch_pool *pool)
+{
+    size_t words = (pool->count + 63) / 64;
+
+    if (!pool->dirty) {
+        pool->dirty = sm_batch_alloc(words * sizeof(*pool->dirty) + 1);
+        if (!pool->dirty)
+            return -1;
+    }
+    memset(pool->dirty, 0xff, words * sizeof(*pool->dirty));
+    return 0;
+}
+
+void sm_batch_set_table(struct sm_batch_pool *pool, size_t i,
+                        state_func *table)
+{
+    pool->pc[i] = table;
+    sm_batch_dirty(pool, i);
+}
+
+unsigned long sm_run_batch(struct sm_batch_pool *pool, size_t first,
+                           size_t count)
+{
+    struct sm_batch_cursor cur;
+    SM_TIMER_SIZE now;
+    uint64_t expired[SM_TSCAN_WORDS(SM_BATCH_SCAN)];
+    unsigned long steps = 0;
+    size_t i, bit, end = first + count;
+    int ret;
+
+    if (end > pool->count)
+        end = pool->count;
+    SM_TICK_UPDATE();
+    now = READ_GLOBAL_TICKS; /* only for the skip test */
+    cur.pool = pool;
+#ifdef SM_CALL_DEPTH
+    cur.sm.calls = NULL; /* no return stacks in the pool */
+#endif
+    for (i = first, bit = SM_BATCH_SCAN; i < end; i++, bit++) {
+        state_func *pc = pool->pc[i];
+
+        /* the timers of the next SM_BATCH_SCAN machines in one go */
+        if (bit == SM_BATCH_SCAN) {
+            sm_timer_scan(&pool->start_timer[i], &pool->delay[i],
+                          end - i < SM_BATCH_SCAN ? end - i : SM_BATCH_SCAN,
+                          now, expired);
+            bit = 0;
+        }
+        if (i + SM_BATCH_PREFETCH < end)
+            sm_batch_prefetch(sm_batch_ctx(pool, i + SM_BATCH_PREFETCH));
+        if (!pc)
+            continue;
+        /* waiting on a timer that is not done, do not even load it */
+        if (*pc == sm_wait_ticks_state &&
+            !(expired[bit / 64] & (uint64_t)1 << (bit % 64)))
+            continue;
+        cur.index = i;
+        cur.sm.stateptrptr = pc;
+        cur.sm.start_timer = pool->start_timer[i];
+        cur.sm.delay = pool->delay[i];
+        do {
+            ret = sm_run_state(&cur.sm);
+            steps++;
+        } while (ret > 0 && cur.sm.stateptrptr);
+        /* an end of table NULL leaves stateptrptr alone, park it here */
+        if (ret < 0)
+            cur.sm.stateptrptr = NULL;
+        if (pool->dirty && (cur.sm.stateptrptr != pc ||
+                            cur.sm.start_timer != pool->start_timer[i] ||
+                            cur.sm.delay != pool->delay[i]))
+            sm_batch_dirty(pool, i);
+        pool->pc[i] = cur.sm.stateptrptr;
+        pool->start_timer[i] = cur.sm.start_timer;
+        pool->delay[i] = cur.sm.delay;
+    }
+    return steps;
+}
@@ -0,0 +1,418 @@
+/**********************************************************************
+ *
+ * Filename:    smbc.c
+ *
+ * Description: compact byte code encoding of state machine tables.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <stdlib.h>
+#include "smbc.h"
+#include "smlink.h"
+
+/* converter's view of one table slot */
+#define SMBC_K_CALL     0
+#define SMBC_K_TIMER    1
+#define SMBC_K_WAIT     2
+#define SMBC_K_JUMP     3
+#define SMBC_K_END      4
+#define SMBC_K_OPERAND  5   /* eaten by the op before it */
+
+struct smbc_op {
+    unsigned char kind;
+    unsigned char len;          /* encoded bytes */
+    uintmax_t arg;              /* function index or ticks */
+    size_t target;              /* jump target, index into ops */
+    size_t off;                 /* code offset */
+};
+
+static unsigned int smbc_varint_len(uintmax_t v)
+{
+    unsigned int len = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static uint8_t *smbc_put_varint(uint8_t *p, uintmax_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uintmax_t smbc_get_varint(const uint8_t **pp)
+{
+    const uint8_t *p = *pp;
+    uintmax_t v = 0;
+    unsigned int shift = 0;
+
+    do {
+        v |= (uintmax_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    *pp = p;
+    return v;
+}
+
+#define smbc_zigzag(v)   (((uintmax_t)(v) << 1) ^ \
+                          ((v) < 0 ? ~(uintmax_t)0 : 0))
+#define smbc_unzigzag(v) ((intmax_t)((v) >> 1) ^ -(intmax_t)((v) & 1))
+
+/* find the global op index of a jump target, or -1 */
+static long smbc_find(const struct smbc_table *tables, unsigned int ntables,
+                      const size_t *first, state_func *target)
+{
+    unsigned int t;
+
+    for (t = 0; t < ntables; t++) {
+        if (target >= tables[t].table &&
+            target < tables[t].table + tables[t].nslots)
+            return first[t] + (target - tables[t].table);
+    }
+    return -1;
+}
+
+static int smbc_func_index(struct smbc_program *prog, state_func f)
+{
+    unsigned int i;
+
+    for (i = 0; i < prog->nfuncs; i++) {
+        if (prog->funcs[i] == f)
+            return i;
+    }
+    if (prog->nfuncs == SMBC_MAX_FUNCS)
+        return -1;
+    prog->funcs[prog->nfuncs] = f;
+    return prog->nfuncs++;
+}
+
+/* classify every slot, one op per slot plus an END after each table */
+static int smbc_decode(const struct smbc_table *tables, unsigned int ntables,
+                       struct smbc_op *ops, const size_t *first,
+                       struct smbc_program *prog)
+{
+    unsigned int t;
+    size_t s;
+
+    for (t = 0; t < ntables; t++) {
+        struct smbc_op *op = ops + first[t];
+        state_func *table = tables[t].table;
+
+        for (s = 0; s < tables[t].nslots; s++, op++) {
+            state_func f = table[s];
+            long target;
+            int idx;
+
+            op->len = 1;
+            if (f && (uintptr_t)f < SM_LINK_MIN_FUNC)
+                return -1; /* operand of an op we do not know */
+#ifdef SM_CALL_DEPTH
+            if (f == sm_call_state || f == sm_ret_state ||
+                f == sm_ret_skip_jump_state)
+                return -1; /* no return stack in byte code */
+#endif
+            if (f == sm_delay_ticks_state || f == sm_jump_table_state) {
+                if (s + 1 >= tables[t].nslots)
+                    return -1; /* operand missing */
+                op[1].kind = SMBC_K_OPERAND;
+                op[1].len = 0;
+            }
+            if (f == sm_delay_ticks_state) {
+                op->kind = SMBC_K_TIMER;
+                op->arg = SM_TABLE_OPERAND(&table[s + 1]);
+                op->len = 1 + smbc_varint_len(op->arg);
+                s++, op++;
+            } else if (f == sm_wait_ticks_state) {
+                op->kind = SMBC_K_WAIT;
+            } else if (f == sm_jump_table_state) {
+                target = smbc_find(tables, ntables, first,
+                                   (state_func *)table[s + 1]);
+                if (target < 0)
+                    return -1; /* jumps out of the tables given */
+                op->kind = SMBC_K_JUMP;
+                op->target = target;
+                op->len = 2; /* first guess */
+                s++, op++;
+            } else if (!f) {
+                op->kind = SMBC_K_END;
+            } else {
+                if (sm_link_op_slots(f) > 1)
+                    return -1; /* its operands need the table */
+                idx = smbc_func_index(prog, f);
+                if (idx < 0)
+                    return -1;
+                op->kind = SMBC_K_CALL;
+                op->arg = idx;
+                op->len = idx < SMBC_OP_CALLX ? 1 : 2;
+            }
+        }
+        op->kind = SMBC_K_END; /* falling off the table ends the machine */
+        op->len = 1;
+    }
+    return 0;
+}
+
+/* lay out the code, growing jumps until their offsets fit */
+static size_t smbc_layout(struct smbc_op *ops, size_t nops)
+{
+    size_t i, off;
+    int changed;
+
+    do {
+        for (off = 0, i = 0; i < nops; i++) {
+            ops[i].off = off;
+            off += ops[i].len;
+        }
+        changed = 0;
+        for (i = 0; i < nops; i++) {
+            intmax_t rel;
+            unsigned int len;
+
+            if (ops[i].kind != SMBC_K_JUMP)
+                continue;
+            rel = (intmax_t)ops[ops[i].target].off - (intmax_t)ops[i].off;
+            len = 1 + smbc_varint_len(smbc_zigzag(rel));
+            if (len > ops[i].len) {
+                ops[i].len = len;
+                changed = 1;
+            }
+        }
+    } while (changed);
+    return off;
+}
+
+static void smbc_emit(struct smbc_op *ops, size_t nops, uint8_t *code)
+{
+    size_t i;
+    uint8_t *p;
+
+    for (i = 0; i < nops; i++) {
+        struct smbc_op *op = &ops[i];
+        intmax_t rel;
+
+        p = code + op->off;
+        switch (op->kind) {
+        case SMBC_K_CALL:
+            if (op->arg < SMBC_OP_CALLX) {
+                *p = op->arg;
+            } else {
+                *p++ = SMBC_OP_CALLX;
+                *p = op->arg - SMBC_OP_CALLX;
+            }
+            break;
+        case SMBC_K_TIMER:
+            *p++ = SMBC_OP_TIMER;
+            smbc_put_varint(p, op->arg);
+            break;
+        case SMBC_K_WAIT:
+            *p = SMBC_OP_WAIT;
+            break;
+        case SMBC_K_JUMP:
+            rel = (intmax_t)ops[op->target].off - (intmax_t)op->off;
+            *p++ = SMBC_OP_JUMP;
+            p = smbc_put_varint(p, smbc_zigzag(rel));
+            /* layout may have grown it past what it needs, pad */
+            while (p < code + op->off + op->len) {
+                p[-1] |= 0x80;
+                *p++ = 0;
+            }
+            break;
+        case SMBC_K_END:
+            *p = SMBC_OP_END;
+            break;
+        default:
+            break; /* operand, no bytes */
+        }
+    }
+}
+
+int smbc_convert(const struct smbc_table *tables, unsigned int ntables,
+                 struct smbc_program *prog)
+{
+    struct smbc_op *ops = NULL;
+    size_t *first;
+    size_t nops = 0;
+    unsigned int t;
+
+    prog->code = NULL;
+    prog->nfuncs = 0;
+    prog->funcs = calloc(SMBC_MAX_FUNCS, sizeof(*prog->funcs));
+    prog->entries = first = calloc(ntables, sizeof(*first));
+    prog->nentries = ntables;
+    if (!prog->funcs || !first)
+        goto err;
+    for (t = 0; t < ntables; t++) {
+        first[t] = nops;
+        nops += tables[t].nslots + 1;
+    }
+    ops = calloc(nops, sizeof(*ops));
+    if (!ops || smbc_decode(tables, ntables, ops, first, prog) < 0)
+        goto err;
+    for (t = 0; t < ntables; t++) {
+        /* a jump may not land on an operand */
+        size_t i;
+
+        for (i = first[t]; i < first[t] + tables[t].nslots; i++) {
+            if (ops[i].kind == SMBC_K_JUMP &&
+                ops[ops[i].target].kind == SMBC_K_OPERAND)
+                goto err;
+        }
+    }
+    prog->size = smbc_layout(ops, nops);
+    prog->code = malloc(prog->size);
+    if (!prog->code)
+        goto err;
+    smbc_emit(ops, nops, prog->code);
+    for (t = 0; t < ntables; t++)
+        first[t] = ops[first[t]].off;
+    free(ops);
+    return 0;
+
+err:
+    free(ops);
+    smbc_free(prog);
+    return -1;
+}
+
+void smbc_free(struct smbc_program *prog)
+{
+    free(prog->code);
+    free(prog->funcs);
+    free(prog->entries);
+    prog->code = NULL;
+    prog->funcs = NULL;
+    prog->entries = NULL;
+    prog->size = 0;
+    prog->nfuncs = 0;
+    prog->nentries = 0;
+}
+
+void smbc_set_table(const struct smbc_program *prog, struct smbc_machine *m,
+                    unsigned int entry)
+{
+    m->sm.stateptrptr = NULL;
+    m->pc = prog->code + prog->entries[entry];
+}
+
+/* next op, *slots is how many table slots the op at pc stands for */
+static const uint8_t *smbc_next(const uint8_t *pc, unsigned int *slots)
+{
+    uint8_t op = *pc++;
+
+    *slots = 1;
+    if (op < SMBC_OP_CALLX)
+        return pc;
+    switch (op) {
+    case SMBC_OP_CALLX:
+        return pc + 1;
+    case SMBC_OP_TIMER:
+    case SMBC_OP_JUMP:
+        *slots = 2;
+        smbc_get_varint(&pc);
+        return pc;
+    default:
+        return pc;
+    }
+}
+
+/* move on as many table slots as a state returned, NULL if in an operand */
+static const uint8_t *smbc_skip(const uint8_t *pc, int result)
+{
+    unsigned int slots;
+
+    while (result > 0) {
+        pc = smbc_next(pc, &slots);
+        if ((int)slots > result)
+            return NULL;
+        result -= slots;
+    }
+    return pc;
+}
+
+/* sm_follow_jumps() for byte code, at most SM_JUMP_HOPS jumps in a row */
+static const uint8_t *smbc_follow_jumps(const uint8_t *pc)
+{
+    unsigned int hops = SM_JUMP_HOPS;
+    const uint8_t *p;
+    uintmax_t rel;
+
+    do {
+        p = pc + 1;
+        rel = smbc_get_varint(&p);
+        pc += smbc_unzigzag(rel);
+    } while (*pc == SMBC_OP_JUMP && --hops);
+    return pc;
+}
+
+/*
+ * byte code main state machine execution monitor
+ * Will execute ONE state per call, returns as sm_run_state()
+ * A state returning a skip into the middle of a timer or jump is reported
+ * as SM_RETURN_ERROR, sm_run_state() would have crashed.
+ */
+int smbc_run_state(const struct smbc_program *prog, struct smbc_machine *m)
+{
+    const uint8_t *pc = m->pc;
+    const uint8_t *p;
+    int result;
+
+    if (!pc)
+        return -1;
+    if (*pc < SMBC_OP_CALLX) {
+        result = prog->funcs[*pc](&m->sm);
+    } else {
+        switch (*pc) {
+        case SMBC_OP_CALLX:
+            result = prog->funcs[SMBC_OP_CALLX + pc[1]](&m->sm);
+            break;
+        case SMBC_OP_TIMER:
+            p = pc + 1;
+            SM_START_TIMER(&m->sm, smbc_get_varint(&p));
+            m->pc = p;
+            result = 1;
+            goto landed;
+        case SMBC_OP_WAIT:
+            if (!SM_IS_TIMER_DONE(&m->sm))
+                return 0;
+            m->pc = pc + 1;
+            result = 1;
+            goto landed;
+        case SMBC_OP_JUMP:
+            /* a jump is no state of its own, as in sm_run_state() */
+            m->pc = smbc_follow_jumps(pc);
+            return 0;
+        default:
+            m->pc = NULL;
+            return -1;
+        }
+    }
+    if (result < 0) {
+        m->pc = NULL;
+        SM_STOP_TIMER(&m->sm);
+        return result;
+    }
+    if (result == SM_RETURN_DONE && *pc < SMBC_OP_CALLX)
+        m->pc = pc + 1;
+    else if (!(m->pc = smbc_skip(pc, result)))
+        return SM_RETURN_ERROR;
+landed:
+    /* done into a jump takes it now and yields, like sm_run_state() */
+    if (result && *m->pc == SMBC_OP_JUMP) {
+        m->pc = smbc_follow_jumps(m->pc);
+        result = 0;
+    }
+    return result;
+}
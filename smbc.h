@@ -0,0 +1,95 @@
+/**********************************************************************
+ *
+ * Filename:    smbc.h
+ *
+ * Description: compact byte code encoding of state machine tables.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMBC_H__
+#define __SMBC_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "states.h"
+
+/*
+ * A state_func table spends a pointer (8 bytes on 64 bit) on every slot,
+ * including the delay and jump operands. A byte code program keeps the
+ * state functions once in a per-program function list and encodes:
+ *
+ *  0x00-0x7f       call funcs[op]                          1 slot
+ *  0x80 n          call funcs[128 + n]                     1 slot
+ *  0x81 varint     load sm timer, SM_SET_TIMER_MS          2 slots
+ *  0x82            sm_wait_ticks_state                     1 slot
+ *  0x83 varint     jump, zigzag offset from this opcode    2 slots
+ *  0x84            end of table, machine exits             1 slot
+ *
+ * SM_DELAY_MS becomes timer + wait. Each op remembers how many slots of the
+ * original table it stands for, so states keep returning slot counts
+ * (SM_RETURN_SKIP_JUMP ...) exactly as they do for sm_run_state().
+ *
+ * smbc_run_state() is the drop in for sm_run_state(): same one state per
+ * call, same return values and jumps taken inline the same way. The byte
+ * code pc lives in the smbc_machine, states get the embedded struct
+ * state_machine as always.
+ */
+#define SMBC_OP_CALLX   0x80
+#define SMBC_OP_TIMER   0x81
+#define SMBC_OP_WAIT    0x82
+#define SMBC_OP_JUMP    0x83
+#define SMBC_OP_END     0x84
+#define SMBC_MAX_FUNCS  (128 + 256)
+
+struct smbc_program {
+    uint8_t *code;
+    size_t size;                /* bytes of code */
+    state_func *funcs;          /* function index */
+    unsigned int nfuncs;
+    size_t *entries;            /* code offset of each converted table */
+    unsigned int nentries;
+};
+
+struct smbc_machine {
+    struct state_machine sm;    /* only the timer is used, states get this */
+    const uint8_t *pc;          /* NULL once the machine exited */
+};
+
+/* one table to convert, nslots is elements_of(table) */
+struct smbc_table {
+    state_func *table;
+    size_t nslots;
+};
+
+/*
+ * smbc_convert - encode a set of state_func tables into one program
+ * Every SM_JUMP must land in one of the tables (at a slot that starts an
+ * entry), they become relative jumps. SM_CALL and SM_RET cannot be
+ * converted, byte code machines have no return stack. Nor can any other
+ * op with operands (SM_WAIT_FD, SM_WAIT_SHM ...): their states read them
+ * through sm->stateptrptr and byte code machines have no table. Such ops
+ * are known from sm_link_op(), give it yours before converting, a slot
+ * that is a number and not a function is refused too.
+ * returns 0, or -1 if the tables cannot be converted
+ */
+int smbc_convert(const struct smbc_table *tables, unsigned int ntables,
+                 struct smbc_program *prog);
+void smbc_free(struct smbc_program *prog);
+
+/* start a machine at the start of converted table number entry */
+void smbc_set_table(const struct smbc_program *prog, struct smbc_machine *m,
+                    unsigned int entry);
+
+/* byte code sm_run_state(), one state per call */
+int smbc_run_state(const struct smbc_program *prog, struct smbc_machine *m);
+
+#define cast_sm_to_smbc(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct smbc_machine, sm))
+
+#endif //__SMBC_H__
@@ -0,0 +1,236 @@
+/**********************************************************************
+ *
+ * Filename:    smexec.c
+ *
+ * Description: multi-threaded work stealing executor for state machines.
+ *
+ * Notes:       Needs Posix threads.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "smexec.h"
+
+#define cast_sched_to_worker(ps) (cast_p_to_outer( \
+            struct sm_sched *, ps, \
+            struct sm_worker, sched))
+
+int sm_exec_init(struct sm_exec *exec, unsigned int nworkers)
+{
+    unsigned int i;
+
+    if (!nworkers)
+        return EINVAL;
+    exec->workers = calloc(nworkers, sizeof(*exec->workers));
+    if (!exec->workers)
+        return ENOMEM;
+    exec->nworkers = nworkers;
+    exec->next = 0;
+    exec->stop = 0;
+    for (i = 0; i < nworkers; i++) {
+        struct sm_worker *w = &exec->workers[i];
+
+        sm_sched_init(&w->sched);
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->kick, NULL);
+        w->exec = exec;
+        w->id = i;
+        w->steals = 0;
+    }
+    return 0;
+}
+
+void sm_exec_add_to(struct sm_exec *exec, unsigned int worker,
+                    struct sm_task *task)
+{
+    struct sm_worker *w = &exec->workers[worker % exec->nworkers];
+
+    pthread_mutex_lock(&w->lock);
+    sm_sched_add(&w->sched, task);
+    pthread_cond_signal(&w->kick);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void sm_exec_add(struct sm_exec *exec, struct sm_task *task)
+{
+    unsigned int worker = __atomic_fetch_add(&exec->next, 1,
+                                             __ATOMIC_RELAXED);
+
+    sm_exec_add_to(exec, worker, task);
+}
+
+void sm_exec_wake(struct sm_task *task)
+{
+    for (;;) {
+        /* the owner can change under us if the task gets stolen */
+        struct sm_sched *sched = __atomic_load_n(&task->sched,
+                                                 __ATOMIC_ACQUIRE);
+        struct sm_worker *w;
+
+        if (!sched)
+            return; /* never added */
+        w = cast_sched_to_worker(sched);
+        pthread_mutex_lock(&w->lock);
+        if (task->sched == sched) {
+            sm_sched_wake(task);
+            pthread_cond_signal(&w->kick);
+            pthread_mutex_unlock(&w->lock);
+            return;
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/* try the other workers in turn, returns number of tasks taken */
+static unsigned int sm_worker_steal(struct sm_worker *w,
+                                    struct sm_task **batch)
+{
+    struct sm_exec *exec = w->exec;
+    unsigned int i, n = 0;
+
+    for (i = 1; i < exec->nworkers && !n; i++) {
+        struct sm_worker *victim =
+                &exec->workers[(w->id + i) % exec->nworkers];
+
+        if (pthread_mutex_trylock(&victim->lock))
+            continue; /* busy, do not queue up behind it */
+        /* leave the victim at least as much as we take */
+        while (n < SM_EXEC_BATCH / 2) {
+            struct sm_task *task = sm_sched_steal(&victim->sched, &w->sched);
+
+            if (!task)
+                break;
+            batch[n++] = task;
+            if (!sm_sched_runnable(&victim->sched))
+                break;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    w->steals += n;
+    return n;
+}
+
+/* nap until kicked, the next timer may be due or it is time to steal again */
+static void sm_worker_idle(struct sm_worker *w)
+{
+    struct timespec ts;
+    uint64_t ns = SM_EXEC_IDLE_NS;
+    uint32_t ticks = tmw_next(&w->sched.wheel);
+
+    if (ticks != TMW_NO_TIMER && ticks < ns / (1000000000L / SM_TICK_RATE))
+        ns = (uint64_t)ticks * (1000000000L / SM_TICK_RATE);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += ns;
+    while (ts.tv_nsec >= 1000000000L) {
+        ts.tv_nsec -= 1000000000L;
+        ts.tv_sec++;
+    }
+    pthread_cond_timedwait(&w->kick, &w->lock, &ts);
+}
+
+static void *sm_worker_main(void *arg)
+{
+    struct sm_worker *w = arg;
+    struct sm_task *batch[SM_EXEC_BATCH];
+    int results[SM_EXEC_BATCH];
+    unsigned long steps = 0;
+    unsigned int i, n;
+
+    pthread_mutex_lock(&w->lock);
+    while (!__atomic_load_n(&w->exec->stop, __ATOMIC_ACQUIRE)) {
+        n = 0;
+        /* kept busy by local wakes, timers and remote wakes still count */
+        if (sm_sched_pass_due(&w->sched))
+            sm_sched_begin_pass(&w->sched);
+        while (n < SM_EXEC_BATCH && (batch[n] = sm_sched_pop(&w->sched)))
+            n++;
+        if (!n) {
+            pthread_mutex_unlock(&w->lock);
+            n = sm_worker_steal(w, batch);
+            SM_TICK_UPDATE(); /* no begin pass for stolen work */
+            pthread_mutex_lock(&w->lock);
+        }
+        if (!n) {
+            sm_worker_idle(w);
+            continue;
+        }
+        pthread_mutex_unlock(&w->lock);
+        for (i = 0; i < n; i++)
+            results[i] = sm_task_run(batch[i], &steps);
+        pthread_mutex_lock(&w->lock);
+        for (i = 0; i < n; i++)
+            sm_sched_file(&w->sched, batch[i], results[i]);
+        w->sched.steps += steps;
+        steps = 0;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+int sm_exec_start(struct sm_exec *exec)
+{
+    unsigned int i;
+    int err;
+
+    __atomic_store_n(&exec->stop, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < exec->nworkers; i++) {
+        err = pthread_create(&exec->workers[i].thread, NULL,
+                             sm_worker_main, &exec->workers[i]);
+        if (err) {
+            /* take down the ones already running */
+            __atomic_store_n(&exec->stop, 1, __ATOMIC_RELEASE);
+            while (i--)
+                pthread_join(exec->workers[i].thread, NULL);
+            return err;
+        }
+    }
+    return 0;
+}
+
+void sm_exec_stop(struct sm_exec *exec)
+{
+    unsigned int i;
+
+    __atomic_store_n(&exec->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < exec->nworkers; i++) {
+        struct sm_worker *w = &exec->workers[i];
+
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->kick);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (i = 0; i < exec->nworkers; i++)
+        pthread_join(exec->workers[i].thread, NULL);
+}
+
+void sm_exec_destroy(struct sm_exec *exec)
+{
+    unsigned int i;
+
+    for (i = 0; i < exec->nworkers; i++) {
+        pthread_mutex_destroy(&exec->workers[i].lock);
+        pthread_cond_destroy(&exec->workers[i].kick);
+    }
+    free(exec->workers);
+    exec->workers = NULL;
+    exec->nworkers = 0;
+}
+
+unsigned long sm_exec_steps(struct sm_exec *exec)
+{
+    unsigned long steps = 0;
+    unsigned int i;
+
+    for (i = 0; i < exec->nworkers; i++) {
+        pthread_mutex_lock(&exec->workers[i].lock);
+        steps += exec->workers[i].sched.steps;
+        pthread_mutex_unlock(&exec->workers[i].lock);
+    }
+    return steps;
+}
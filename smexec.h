@@ -0,0 +1,78 @@
+/**********************************************************************
+ *
+ * Filename:    smexec.h
+ *
+ * Description: multi-threaded work stealing executor for state machines.
+ *
+ * Notes:       Needs Posix threads.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMEXEC_H__
+#define __SMEXEC_H__
+#include <pthread.h>
+#include "smsched.h"
+
+/*
+ * The executor shards tasks over N worker threads. Each worker owns a
+ * normal sm_sched (ready/polling/blocked queues and timing wheel) guarded by
+ * a mutex. A worker pops a batch of ready tasks, drops the lock, steps them
+ * with sm_task_run() (so sm_run_state() is unchanged) and files them back.
+ * A worker that runs out of work steals ready tasks from the cold end of
+ * the other workers' queues, a stolen task then belongs to the thief.
+ *
+ * A task is only ever on one queue or in one worker's batch, so a machine
+ * is never stepped by two threads at once. States still run to completion,
+ * but machines on different workers run in parallel: shared data between
+ * machines needs its own locking.
+ *
+ * Inside a state use sm_sched_block()/sm_sched_block_timer() as usual, but
+ * wake tasks with sm_exec_wake(), never sm_sched_wake().
+ */
+#ifndef SM_EXEC_BATCH
+#define SM_EXEC_BATCH   16      /* tasks popped or stolen per lock hold */
+#endif
+#ifndef SM_EXEC_IDLE_NS
+#define SM_EXEC_IDLE_NS 1000000 /* longest idle nap before trying to steal */
+#endif
+
+struct sm_exec;
+
+struct sm_worker {
+    struct sm_sched sched;      /* this worker's queues and timing wheel */
+    pthread_mutex_t lock;       /* guards sched and any task filed in it */
+    pthread_cond_t kick;        /* idle worker naps on this */
+    pthread_t thread;
+    struct sm_exec *exec;
+    unsigned int id;
+    unsigned long steals;       /* tasks taken from other workers */
+};
+
+struct sm_exec {
+    struct sm_worker *workers;
+    unsigned int nworkers;
+    unsigned int next;          /* round robin for sm_exec_add() */
+    int stop;                   /* set by sm_exec_stop(), atomic access */
+};
+
+/* returns 0 or an errno value */
+int sm_exec_init(struct sm_exec *exec, unsigned int nworkers);
+/* shard a task onto a worker, may be called while running */
+void sm_exec_add(struct sm_exec *exec, struct sm_task *task);
+void sm_exec_add_to(struct sm_exec *exec, unsigned int worker,
+                    struct sm_task *task);
+/* thread safe sm_sched_wake() */
+void sm_exec_wake(struct sm_task *task);
+/* returns 0 or an errno value */
+int sm_exec_start(struct sm_exec *exec);
+/* stop and join all workers, tasks stay on their queues */
+void sm_exec_stop(struct sm_exec *exec);
+void sm_exec_destroy(struct sm_exec *exec);
+/* total sm_run_state() calls over all workers, exact once stopped */
+unsigned long sm_exec_steps(struct sm_exec *exec);
+
+#endif //__SMEXEC_H__
@@ -0,0 +1,208 @@
+/**********************************************************************
+ *
+ * Filename:    smio.c
+ *
+ * Description: reusable states moving bytes between fds and rings.
+ *
+ * Notes:       Linux only, uses readv/writev and splice.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* splice, pipe2 */
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include "smio.h"
+
+void sm_io_task_init(struct sm_io_task *io, int fd, int out_fd,
+                     state_func *table, sm_task_exit_func exit_func)
+{
+    sm_fd_task_init(&io->ft, fd, table, exit_func);
+    io->out_fd = out_fd;
+    io->rx = NULL;
+    io->tx = NULL;
+    io->rx_wake = NULL;
+    io->tx_wake = NULL;
+    io->iov = NULL;
+    io->iovcnt = 0;
+    io->pipe[0] = -1;
+    io->pipe[1] = -1;
+    io->piped = 0;
+    io->bytes_in = 0;
+    io->bytes_out = 0;
+    io->syscalls = 0;
+    io->err = 0;
+}
+
+void sm_io_task_release(struct sm_reactor *reactor, struct sm_io_task *io)
+{
+    sm_fd_task_release(reactor, &io->ft);
+    if (io->pipe[0] >= 0) {
+        close(io->pipe[0]);
+        close(io->pipe[1]);
+    }
+    io->pipe[0] = -1;
+    io->pipe[1] = -1;
+    io->piped = 0;
+}
+
+/* not an error, just nothing to do right now */
+static int sm_io_again(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static int sm_io_fail(struct sm_io_task *io, int err)
+{
+    io->err = err;
+    return SM_RETURN_DONE;
+}
+
+/* out_fd took less than offered, come back when it is writable */
+static int sm_io_park(struct sm_io_task *io)
+{
+    if (sm_fd_task_wait(&io->ft, io->out_fd, EPOLLOUT) < 0)
+        return sm_io_fail(io, errno);
+    return SM_RETURN_REPEAT;
+}
+
+int sm_io_read_state(struct state_machine *sm)
+{
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
+    struct iovec iov[2];
+    void *p[2];
+    size_t n[2];
+    ssize_t len;
+
+    if (!sm_ring_write_spans(io->rx, p, n))
+        return SM_RETURN_SKIP_JUMP; /* full, the reader is behind */
+    iov[0].iov_base = p[0];
+    iov[0].iov_len = n[0];
+    iov[1].iov_base = p[1];
+    iov[1].iov_len = n[1];
+    len = readv(io->ft.fd, iov, n[1] ? 2 : 1);
+    io->syscalls++;
+    if (len < 0)
+        return sm_io_again() ? SM_RETURN_SKIP_JUMP : sm_io_fail(io, errno);
+    if (!len)
+        return sm_io_fail(io, 0); /* end of file */
+    sm_ring_write_commit(io->rx, len);
+    io->bytes_in += len;
+    if (io->rx_wake)
+        sm_sched_wake(io->rx_wake);
+    return SM_RETURN_SKIP_JUMP;
+}
+
+int sm_io_write_state(struct state_machine *sm)
+{
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
+    struct iovec iov[2];
+    const void *p[2];
+    size_t n[2], avail;
+    ssize_t len;
+
+    avail = sm_ring_read_spans(io->tx, p, n);
+    if (!avail)
+        return SM_RETURN_SKIP_JUMP;
+    iov[0].iov_base = (void *)p[0];
+    iov[0].iov_len = n[0];
+    iov[1].iov_base = (void *)p[1];
+    iov[1].iov_len = n[1];
+    len = writev(io->out_fd, iov, n[1] ? 2 : 1);
+    io->syscalls++;
+    if (len < 0) {
+        if (!sm_io_again())
+            return sm_io_fail(io, errno);
+        len = 0;
+    }
+    if (len) {
+        sm_ring_read_release(io->tx, len);
+        io->bytes_out += len;
+        if (io->tx_wake)
+            sm_sched_wake(io->tx_wake);
+    }
+    if ((size_t)len == avail)
+        return SM_RETURN_SKIP_JUMP;
+    return sm_io_park(io);
+}
+
+int sm_io_writev_state(struct state_machine *sm)
+{
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
+    ssize_t len;
+
+    while (io->iovcnt && !io->iov->iov_len) {
+        io->iov++;
+        io->iovcnt--;
+    }
+    if (!io->iovcnt)
+        return SM_RETURN_SKIP_JUMP;
+    len = writev(io->out_fd, io->iov,
+                 io->iovcnt < IOV_MAX ? io->iovcnt : IOV_MAX);
+    io->syscalls++;
+    if (len < 0) {
+        if (!sm_io_again())
+            return sm_io_fail(io, errno);
+        len = 0;
+    }
+    io->bytes_out += len;
+    /* step over what went out, the last one may be partly written */
+    while (io->iovcnt && (size_t)len >= io->iov->iov_len) {
+        len -= io->iov->iov_len;
+        io->iov++;
+        io->iovcnt--;
+    }
+    if (io->iovcnt) {
+        io->iov->iov_base = (char *)io->iov->iov_base + len;
+        io->iov->iov_len -= len;
+        return sm_io_park(io);
+    }
+    if (io->tx_wake)
+        sm_sched_wake(io->tx_wake);
+    return SM_RETURN_SKIP_JUMP;
+}
+
+/*
+ * splice() needs a pipe on one side, so bytes go fd -> own pipe -> out_fd
+ * even when one of them is a pipe already: the batch taken in is then
+ * always ours to finish, out_fd blocking half way just parks the machine.
+ */
+int sm_io_splice_state(struct state_machine *sm)
+{
+    struct sm_io_task *io = cast_sm_to_io_task(sm);
+    ssize_t len;
+
+    if (io->pipe[0] < 0 && pipe2(io->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        return sm_io_fail(io, errno);
+    if (!io->piped) {
+        len = splice(io->ft.fd, NULL, io->pipe[1], NULL, SM_IO_SPLICE_MAX,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        io->syscalls++;
+        if (len < 0)
+            return sm_io_again() ? SM_RETURN_SKIP_JUMP : sm_io_fail(io, errno);
+        if (!len)
+            return sm_io_fail(io, 0); /* end of file */
+        io->piped = len;
+        io->bytes_in += len;
+    }
+    while (io->piped) {
+        len = splice(io->pipe[0], NULL, io->out_fd, NULL, io->piped,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        io->syscalls++;
+        if (len < 0) {
+            if (!sm_io_again())
+                return sm_io_fail(io, errno);
+            return sm_io_park(io);
+        }
+        io->piped -= len;
+        io->bytes_out += len;
+    }
+    return SM_RETURN_SKIP_JUMP;
+}
@@ -0,0 +1,90 @@
+/**********************************************************************
+ *
+ * Filename:    smio.h
+ *
+ * Description: reusable states moving bytes between fds and rings.
+ *
+ * Notes:       Linux only, uses readv/writev and splice.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMIO_H__
+#define __SMIO_H__
+#include <sys/uio.h>
+#include "smreactor.h"
+#include "smring.h"
+
+/*
+ * Each state is one step for a whole batch of bytes, one syscall, not a
+ * step (and a stdio call) per byte:
+ *
+ *  SM_IO_READ      readv() whatever the fd has into the free space of rx
+ *  SM_IO_WRITE     writev() everything in tx to out_fd
+ *  SM_IO_WRITEV    writev() the iov list to out_fd, moving it along
+ *  SM_IO_SPLICE    splice() a batch from fd to out_fd through a pipe, the
+ *                  bytes never come up to user space
+ *
+ * They continue like a state returning SM_RETURN_SKIP_JUMP when all is
+ * well, and SM_RETURN_DONE at end of file or on an error (err says which),
+ * so follow each with the SM_JUMP for that:
+ *
+ *      SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 5000),
+ *      SM_JUMP(timed_out_table),
+ *      SM_IO_READ,
+ *      SM_JUMP(closed_table),
+ *      parse_state,
+ *
+ * SM_IO_READ does not wait, nothing there (or rx full) is fine too, wait
+ * first with SM_WAIT_FD. The writing states do wait: when out_fd takes
+ * only part they park the machine until it is writable (sm_fd_task_wait())
+ * and carry on, so they only move on once everything is out.
+ *
+ * The machine is a struct sm_io_task, fd is its sm_fd_task's own fd. For
+ * sm_link() register each state with max_skip SM_RETURN_SKIP_JUMP.
+ */
+#define SM_IO_READ      (sm_io_read_state)
+#define SM_IO_WRITE     (sm_io_write_state)
+#define SM_IO_WRITEV    (sm_io_writev_state)
+#define SM_IO_SPLICE    (sm_io_splice_state)
+
+#ifndef SM_IO_SPLICE_MAX
+#define SM_IO_SPLICE_MAX    (64 * 1024) /* bytes per SM_IO_SPLICE step */
+#endif
+
+struct sm_io_task {
+    struct sm_fd_task ft;       /* ft.fd is read, SM_WAIT_FD(SM_FD_OWN ...) */
+    int out_fd;                 /* written, may be the same fd */
+    struct sm_ring *rx;         /* SM_IO_READ fills it */
+    struct sm_ring *tx;         /* SM_IO_WRITE drains it */
+    struct sm_task *rx_wake;    /* woken when rx got bytes, may be NULL */
+    struct sm_task *tx_wake;    /* woken when tx was drained, may be NULL */
+    struct iovec *iov;          /* what SM_IO_WRITEV still has to write */
+    int iovcnt;
+    int pipe[2];                /* SM_IO_SPLICE's, made on first use */
+    size_t piped;               /* bytes in the pipe not written yet */
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long syscalls;
+    int err;                    /* errno of the failure, 0 at end of file */
+};
+
+#define cast_sm_to_io_task(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct sm_io_task, ft.task.sm))
+
+/* like sm_fd_task_init(), rings and wakes start out NULL */
+void sm_io_task_init(struct sm_io_task *io, int fd, int out_fd,
+                     state_func *table, sm_task_exit_func exit_func);
+/* sm_fd_task_release() and close the splice pipe */
+void sm_io_task_release(struct sm_reactor *reactor, struct sm_io_task *io);
+
+int sm_io_read_state(struct state_machine *sm);
+int sm_io_write_state(struct state_machine *sm);
+int sm_io_writev_state(struct state_machine *sm);
+int sm_io_splice_state(struct state_machine *sm);
+
+#endif //__SMIO_H__
@@ -0,0 +1,296 @@
+/**********************************************************************
+ *
+ * Filename:    smlink.c
+ *
+ * Description: link pass for state machine tables, resolves and checks
+ *              jumps once at startup.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include "smlink.h"
+
+struct sm_link_opinfo {
+    state_func func;
+    unsigned int slots;
+    unsigned int max_skip;
+};
+
+#ifdef SM_CALL_DEPTH
+#define SM_LINK_BUILTIN_OPS 6
+#else
+#define SM_LINK_BUILTIN_OPS 3
+#endif
+
+static struct sm_link_opinfo sm_link_ops[SM_LINK_MAX_OPS] = {
+    { sm_delay_ticks_state, 2, 2 },     /* moves past its operand itself */
+    { sm_wait_ticks_state, 1, 1 },
+    { sm_jump_table_state, 2, 0 },
+#ifdef SM_CALL_DEPTH
+    { sm_call_state, SM_CALL_SLOTS, SM_CALL_SLOTS }, /* returns after it */
+    { sm_ret_state, 1, 0 },
+    { sm_ret_skip_jump_state, 1, 0 },
+#endif
+};
+static unsigned int sm_link_nops = SM_LINK_BUILTIN_OPS;
+
+int sm_link_op(state_func func, unsigned int slots, unsigned int max_skip)
+{
+    unsigned int i;
+
+    for (i = 0; i < sm_link_nops; i++) {
+        if (sm_link_ops[i].func == func)
+            break;
+    }
+    if (i == SM_LINK_MAX_OPS)
+        return -1;
+    sm_link_ops[i].func = func;
+    sm_link_ops[i].slots = slots ? slots : 1;
+    sm_link_ops[i].max_skip = max_skip;
+    if (i == sm_link_nops)
+        sm_link_nops++;
+    return 0;
+}
+
+/* plain states take one slot and are done into the next */
+static const struct sm_link_opinfo *sm_link_find_op(state_func func)
+{
+    static const struct sm_link_opinfo plain = { NULL, 1, 1 };
+    unsigned int i;
+
+    for (i = 0; i < sm_link_nops; i++) {
+        if (sm_link_ops[i].func == func)
+            return &sm_link_ops[i];
+    }
+    return &plain;
+}
+
+unsigned int sm_link_op_slots(state_func func)
+{
+    return sm_link_find_op(func)->slots;
+}
+
+/* slot kinds, one per slot of each table */
+#define SM_LINK_OP      0
+#define SM_LINK_OPERAND 1
+#define SM_LINK_END     2   /* NULL slot */
+
+struct sm_link_ctx {
+    const struct sm_link_table *tables;
+    unsigned int ntables;
+    unsigned char **kinds;
+    struct sm_link_stats *stats;
+    FILE *log;
+};
+
+static void sm_link_problem(struct sm_link_ctx *ctx, int error,
+                            const struct sm_link_table *t, size_t slot,
+                            const char *what)
+{
+    if (error)
+        ctx->stats->errors++;
+    else
+        ctx->stats->warnings++;
+    if (ctx->log)
+        fprintf(ctx->log, "smlink: %s: %s[%zu] %s\n",
+                error ? "error" : "warning", t->name ? t->name : "?",
+                slot, what);
+}
+
+/* table number holding slot p, its index in *slot, or -1 */
+static int sm_link_where(struct sm_link_ctx *ctx, state_func *p, size_t *slot)
+{
+    unsigned int t;
+
+    for (t = 0; t < ctx->ntables; t++) {
+        if (p >= ctx->tables[t].table &&
+            p < ctx->tables[t].table + ctx->tables[t].nslots) {
+            *slot = p - ctx->tables[t].table;
+            return t;
+        }
+    }
+    return -1;
+}
+
+/* mark every slot, check operands and skips */
+static void sm_link_decode(struct sm_link_ctx *ctx, unsigned int ti)
+{
+    const struct sm_link_table *t = &ctx->tables[ti];
+    unsigned char *kind = ctx->kinds[ti];
+    size_t i, n = t->nslots;
+
+    for (i = 0; i < n; ) {
+        state_func f = t->table[i];
+        const struct sm_link_opinfo *op;
+        size_t k;
+
+        if (!f) {
+            kind[i++] = SM_LINK_END;
+            continue;
+        }
+        if ((uintptr_t)f < SM_LINK_MIN_FUNC) {
+            sm_link_problem(ctx, 1, t, i,
+                            "is a number, operand of an op unknown to the "
+                            "linker?");
+            kind[i++] = SM_LINK_OPERAND;
+            continue;
+        }
+        op = sm_link_find_op(f);
+        kind[i] = SM_LINK_OP;
+        if (i + op->slots > n) {
+            sm_link_problem(ctx, 1, t, i, "operands run off the end");
+            break;
+        }
+        for (k = 1; k < op->slots; k++)
+            kind[i + k] = SM_LINK_OPERAND;
+        if (f == sm_jump_table_state)
+            ctx->stats->jumps++;
+        else if (i + op->max_skip >= n)
+            /* a plain state there may well never be done */
+            sm_link_problem(ctx, op->func != NULL, t, i,
+                            "can run off the end of the table");
+        i += op->slots;
+    }
+}
+
+/* skips may not land on operands, known once all slots are marked */
+static void sm_link_check_skips(struct sm_link_ctx *ctx, unsigned int ti)
+{
+    const struct sm_link_table *t = &ctx->tables[ti];
+    unsigned char *kind = ctx->kinds[ti];
+    size_t i, n = t->nslots;
+
+    for (i = 0; i < n; i++) {
+        const struct sm_link_opinfo *op;
+
+        if (kind[i] != SM_LINK_OP || t->table[i] == sm_jump_table_state)
+            continue;
+        op = sm_link_find_op(t->table[i]);
+        if (i + op->max_skip < n && kind[i + op->max_skip] == SM_LINK_OPERAND)
+            sm_link_problem(ctx, 1, t, i, "can skip into an operand");
+    }
+}
+
+/* ops whose operand is a table slot to go to */
+static int sm_link_is_jump(state_func f)
+{
+#ifdef SM_CALL_DEPTH
+    if (f == sm_call_state)
+        return 1;
+#endif
+    return f == sm_jump_table_state;
+}
+
+/*
+ * final destination of the jump (or call) in slot i of table ti, or NULL if
+ * it goes nowhere good. *hops counts the jumps folded away.
+ */
+static state_func *sm_link_resolve(struct sm_link_ctx *ctx, unsigned int ti,
+                                   size_t i, unsigned long *hops)
+{
+    const struct sm_link_table *t = &ctx->tables[ti];
+    state_func *dest = (state_func *)t->table[i + 1];
+    unsigned long limit = 0;
+    unsigned int u;
+    size_t slot;
+    int where;
+
+    for (u = 0; u < ctx->ntables; u++)
+        limit += ctx->tables[u].nslots;
+    *hops = 0;
+    for (;;) {
+        if (!dest)
+            return NULL; /* SM_JUMP(NULL) ends the machine, fine as is */
+        where = sm_link_where(ctx, dest, &slot);
+        if (where < 0) {
+            sm_link_problem(ctx, 1, t, i,
+                            "jumps out of the linked tables");
+            return NULL;
+        }
+        if (ctx->kinds[where][slot] == SM_LINK_OPERAND) {
+            sm_link_problem(ctx, 1, t, i, "jumps into an operand");
+            return NULL;
+        }
+        if (*dest != sm_jump_table_state)
+            return dest;
+        if (++*hops > limit) {
+            sm_link_problem(ctx, 1, t, i,
+                            "is a loop of jumps with no state in it");
+            return NULL;
+        }
+        dest = (state_func *)dest[1];
+    }
+}
+
+int sm_link(const struct sm_link_table *tables, unsigned int ntables,
+            struct sm_link_stats *stats, FILE *log)
+{
+    struct sm_link_stats local;
+    struct sm_link_ctx ctx;
+    state_func **dest = NULL;
+    size_t i, total = 0;
+    unsigned int t;
+    unsigned long hops;
+    int ret = -1;
+
+    ctx.tables = tables;
+    ctx.ntables = ntables;
+    ctx.stats = stats ? stats : &local;
+    ctx.log = log;
+    ctx.stats->jumps = ctx.stats->folded = ctx.stats->hops = 0;
+    ctx.stats->warnings = ctx.stats->errors = 0;
+    ctx.kinds = calloc(ntables, sizeof(*ctx.kinds));
+    if (!ctx.kinds)
+        return -1;
+    for (t = 0; t < ntables; t++) {
+        ctx.kinds[t] = calloc(tables[t].nslots + 1, 1);
+        if (!ctx.kinds[t])
+            goto out;
+        total += tables[t].nslots;
+    }
+    dest = calloc(total + 1, sizeof(*dest));
+    if (!dest)
+        goto out;
+    for (t = 0; t < ntables; t++)
+        sm_link_decode(&ctx, t);
+    for (t = 0; t < ntables; t++)
+        sm_link_check_skips(&ctx, t);
+    /* resolve everything first, folding must see the tables as written */
+    for (total = 0, t = 0; t < ntables; total += tables[t].nslots, t++) {
+        for (i = 0; i < tables[t].nslots; i++) {
+            if (ctx.kinds[t][i] != SM_LINK_OP ||
+                !sm_link_is_jump(tables[t].table[i]))
+                continue;
+            dest[total + i] = sm_link_resolve(&ctx, t, i, &hops);
+            if (hops) {
+                ctx.stats->folded++;
+                ctx.stats->hops += hops;
+            }
+        }
+    }
+    if (ctx.stats->errors)
+        goto out;
+    for (total = 0, t = 0; t < ntables; total += tables[t].nslots, t++) {
+        for (i = 0; i < tables[t].nslots; i++) {
+            if (dest[total + i])
+                tables[t].table[i + 1] = (state_func)dest[total + i];
+        }
+    }
+    ret = 0;
+
+out:
+    if (ret < 0 && log && !ctx.stats->errors)
+        fprintf(log, "smlink: out of memory\n");
+    for (t = 0; t < ntables && ctx.kinds; t++)
+        free(ctx.kinds[t]);
+    free(ctx.kinds);
+    free(dest);
+    return ret;
+}
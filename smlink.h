@@ -0,0 +1,88 @@
+/**********************************************************************
+ *
+ * Filename:    smlink.h
+ *
+ * Description: link pass for state machine tables, resolves and checks
+ *              jumps once at startup.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMLINK_H__
+#define __SMLINK_H__
+#include <stdio.h>
+#include "states.h"
+
+/*
+ * sm_run_state() takes an SM_JUMP inline: a state returning into a jump,
+ * or skipping onto one (SM_RETURN_SKIP_JUMP past the first of two), moves
+ * the machine to the jump's target in the same call. What is left is
+ * jumps landing on jumps, each one more hop, and tables nobody checked.
+ *
+ * sm_link() goes over a set of tables once, before any machine runs:
+ *  - every jump is pointed at its final destination, a chain of jumps
+ *    (a table that starts with SM_JUMP ...) is folded into one hop
+ *  - jump targets must be inside the linked tables, not on an operand
+ *  - pseudo states must have their operands in the table
+ *  - slots a state can skip to must be in the table
+ *
+ * SM_CALL targets are checked and folded the same way as jumps.
+ *
+ * Ops taking operands or skipping over jumps have to be known to the
+ * linker, SM_DELAY_MS, SM_SET_TIMER_MS, SM_JUMP and SM_CALL are built in. Others,
+ * eg SM_WAIT_FD, are made known with sm_link_op() first:
+ *
+ *      sm_link_op(sm_wait_fd_state, SM_WAIT_FD_SLOTS,
+ *                 SM_WAIT_FD_SLOTS + SM_RETURN_SKIP_JUMP_SIZE);
+ *
+ * The same goes for a plain state that returns SM_RETURN_SKIP_JUMP ..., any
+ * other state is checked for SM_RETURN_DONE only.
+ */
+struct sm_link_table {
+    state_func *table;
+    size_t nslots;
+    const char *name;           /* for the log */
+};
+
+#define SM_LINK_TABLE(t) { (t), elements_of(t), #t }
+
+struct sm_link_stats {
+    unsigned long jumps;        /* SM_JUMPs seen */
+    unsigned long folded;       /* jumps pointed past another jump */
+    unsigned long hops;         /* jump hops the folding saved */
+    unsigned long warnings;     /* a state may run off the end */
+    unsigned long errors;       /* the tables cannot be linked */
+};
+
+#ifndef SM_LINK_MAX_OPS
+#define SM_LINK_MAX_OPS 32
+#endif
+/* a table slot below this is a number, not a function */
+#define SM_LINK_MIN_FUNC    4096
+
+/*
+ * sm_link_op - tell the linker about an op
+ * slots: table slots the op takes, itself and its operands
+ * max_skip: the biggest result it returns
+ * returns 0 or -1 if there are SM_LINK_MAX_OPS already
+ */
+int sm_link_op(state_func func, unsigned int slots, unsigned int max_skip);
+/* table slots func takes as given to sm_link_op(), 1 for a plain state */
+unsigned int sm_link_op_slots(state_func func);
+
+/*
+ * sm_link - check the tables and fold their jump chains
+ * Problems are written to log (may be NULL). Nothing is changed unless
+ * there are no errors, warnings (a state in the last slot ...) are fine.
+ * stats may be NULL.
+ * returns 0, or -1 if the tables have errors
+ */
+int sm_link(const struct sm_link_table *tables, unsigned int ntables,
+            struct sm_link_stats *stats, FILE *log);
+
+#endif //__SMLINK_H__
@@ -0,0 +1,119 @@
+/**********************************************************************
+ *
+ * Filename:    smmbox.c
+ *
+ * Description: per machine mailboxes, lock free multi producer single
+ *              consumer message queues with scheduler wakeup.
+ *
+ * Notes:       Needs GCC atomics.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <stddef.h>
+#include "smmbox.h"
+
+/*
+ * Producers swing head to their message, then link the old head to it.
+ * The consumer follows next pointers from tail. Between a producer's two
+ * steps the list is cut, the consumer sees the rest as not there yet.
+ */
+void sm_mbox_init(struct sm_mbox *mbox)
+{
+    mbox->stub.next = NULL;
+    mbox->head = &mbox->stub;
+    mbox->tail = &mbox->stub;
+}
+
+void sm_mbox_push(struct sm_mbox *mbox, struct sm_msg *msg)
+{
+    struct sm_msg *prev;
+
+    __atomic_store_n(&msg->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&mbox->head, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+struct sm_msg *sm_mbox_pop(struct sm_mbox *mbox)
+{
+    struct sm_msg *tail = mbox->tail;
+    struct sm_msg *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &mbox->stub) {
+        if (!next)
+            return NULL;
+        /* step over the stub */
+        mbox->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        mbox->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&mbox->head, __ATOMIC_ACQUIRE))
+        return NULL; /* a post is half way */
+    /* tail is the last one, put the stub behind it so it can go */
+    sm_mbox_push(mbox, &mbox->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        mbox->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+int sm_mbox_empty(struct sm_mbox *mbox)
+{
+    struct sm_msg *tail = mbox->tail;
+
+    return tail == &mbox->stub &&
+           !__atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+}
+
+void sm_msg_task_init(struct sm_msg_task *mt, state_func *table,
+                      sm_task_exit_func exit_func)
+{
+    sm_task_init(&mt->task, table, exit_func);
+    sm_mbox_init(&mt->mbox);
+    mt->waiting = 0;
+}
+
+void sm_mbox_post(struct sm_msg_task *mt, struct sm_msg *msg)
+{
+    sm_mbox_push(&mt->mbox, msg);
+    sm_sched_wake(&mt->task);
+}
+
+void sm_mbox_post_remote(struct sm_msg_task *mt, struct sm_msg *msg)
+{
+    sm_mbox_push(&mt->mbox, msg);
+    sm_sched_wake_remote(&mt->task);
+}
+
+/*
+ * state machine function for SM_WAIT_MSG, the timeout ticks follow in the
+ * table
+ */
+int sm_wait_msg_state(struct state_machine *sm)
+{
+    struct sm_msg_task *mt = cast_sm_to_msg_task(sm);
+
+    if (!mt->waiting) {
+        SM_START_TIMER(sm, SM_TABLE_OPERAND(sm->stateptrptr + 1));
+        mt->waiting = 1;
+    }
+    if (!sm_mbox_empty(&mt->mbox)) {
+        mt->waiting = 0;
+        return SM_WAIT_MSG_SLOTS + SM_RETURN_SKIP_JUMP_SIZE;
+    }
+    if (SM_IS_TIMER_DONE(sm)) {
+        mt->waiting = 0;
+        return SM_WAIT_MSG_SLOTS;
+    }
+    sm_sched_block_timer(sm);
+    return SM_RETURN_REPEAT;
+}
@@ -0,0 +1,104 @@
+/**********************************************************************
+ *
+ * Filename:    smmbox.h
+ *
+ * Description: per machine mailboxes, lock free multi producer single
+ *              consumer message queues with scheduler wakeup.
+ *
+ * Notes:       Needs GCC atomics.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMMBOX_H__
+#define __SMMBOX_H__
+#include <stdint.h>
+#include "smsched.h"
+
+/*
+ * A machine that wants to be fed messages is a struct sm_msg_task, a
+ * sm_task plus a mailbox. Anybody, from any thread, posts messages with
+ * sm_mbox_post(), the machine sits in SM_WAIT_MSG parked (never stepped)
+ * until there is mail or the timeout hits. Many producers feeding one
+ * machine then cost no steps at all while there is nothing to do.
+ *
+ * Messages are intrusive: embed a struct sm_msg in your own struct and get
+ * back to it with cast_p_to_outer(). Posting is a single atomic exchange
+ * (wait free), only the owning machine takes messages out, oldest first.
+ * A message must not be posted again until it has been taken out.
+ */
+struct sm_msg {
+    struct sm_msg *next;
+};
+
+struct sm_mbox {
+    struct sm_msg *head __attribute__((aligned(64)));  /* last posted */
+    struct sm_msg *tail __attribute__((aligned(64)));  /* next to take */
+    struct sm_msg stub;         /* keeps the queue from ever being empty */
+};
+
+struct sm_msg_task {
+    struct sm_task task;
+    struct sm_mbox mbox;
+    unsigned char waiting;      /* inside SM_WAIT_MSG, timer started */
+};
+
+#define cast_sm_to_msg_task(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct sm_msg_task, task.sm))
+
+void sm_mbox_init(struct sm_mbox *mbox);
+/* queue a message, any thread, does not wake anybody */
+void sm_mbox_push(struct sm_mbox *mbox, struct sm_msg *msg);
+/*
+ * take the oldest message, owner only. NULL when empty, or when the next
+ * message is half posted, its poster's wake follows.
+ */
+struct sm_msg *sm_mbox_pop(struct sm_mbox *mbox);
+/*
+ * owner only, non zero if there is no message at all. 0 does not promise a
+ * message for sm_mbox_pop(): while a post is half done (its message linked
+ * in but the one before not yet pointing to it) this returns 0 and pop
+ * still returns NULL. SM_WAIT_MSG then goes on to the message state, which
+ * must take a NULL pop as "nothing yet" and wait again, the poster's wake
+ * follows.
+ */
+int sm_mbox_empty(struct sm_mbox *mbox);
+
+/* like sm_task_init() */
+void sm_msg_task_init(struct sm_msg_task *mt, state_func *table,
+                      sm_task_exit_func exit_func);
+/*
+ * sm_mbox_post - push a message and wake the machine
+ * From the thread running the machine's scheduler (its own states or
+ * other machines on it) the wake is a plain sm_sched_wake(), any other
+ * thread must use sm_mbox_post_remote().
+ */
+void sm_mbox_post(struct sm_msg_task *mt, struct sm_msg *msg);
+void sm_mbox_post_remote(struct sm_msg_task *mt, struct sm_msg *msg);
+
+/*
+ * SM_WAIT_MSG - table entry waiting for mail or a timeout
+ * ms: timeout, uses the sm timer like SM_DELAY_MS
+ *
+ * Continues like a state returning SM_RETURN_DONE on timeout and
+ * SM_RETURN_SKIP_JUMP when there is mail, the message stays in the box
+ * for the next state to sm_mbox_pop():
+ *
+ *      SM_WAIT_MSG(5000),
+ *      SM_JUMP(timed_out_table),
+ *      handle_msg_state,
+ *
+ * The machine must be a struct sm_msg_task on a scheduler.
+ */
+#define SM_WAIT_MSG(ms) (sm_wait_msg_state), \
+                        (state_func)(uintptr_t)(SM_MS_TO_TICKS(ms))
+/* table slots taken by SM_WAIT_MSG, a timeout returns this */
+#define SM_WAIT_MSG_SLOTS 2
+
+int sm_wait_msg_state(struct state_machine *sm);
+
+#endif //__SMMBOX_H__
@@ -0,0 +1,222 @@
+/**********************************************************************
+ *
+ * Filename:    smprof.c
+ *
+ * Description: per state function profiling counters and latency
+ *              histograms, built into sm_run_state() with SM_PROFILE.
+ *
+ * Notes:       Needs GCC atomics and thread local storage.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smprof.h"
+
+/*
+ * One per thread, only the owner writes it. Counters are stored with
+ * relaxed atomic stores (a plain add on x86) so a merge running on another
+ * thread reads whole values, a slot's func is published last with release.
+ */
+struct smprof_thread {
+    struct smprof_thread *next;
+    struct smprof_stat slot[SMPROF_SLOTS];
+    struct smprof_stat overflow;        /* table full */
+};
+
+static struct smprof_thread *smprof_threads;    /* pushed with CAS */
+static _Thread_local struct smprof_thread *smprof_self;
+
+#define smprof_bump(p, n) \
+    __atomic_store_n((p), *(p) + (n), __ATOMIC_RELAXED)
+#define smprof_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
+static struct smprof_thread *smprof_attach(void)
+{
+    struct smprof_thread *t = calloc(1, sizeof(*t));
+
+    if (!t)
+        return NULL;
+    t->next = __atomic_load_n(&smprof_threads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&smprof_threads, &t->next, t, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    smprof_self = t;
+    return t;
+}
+
+static unsigned int smprof_hash(state_func func)
+{
+    uintptr_t a = (uintptr_t)func;
+
+    a ^= a >> 17;
+    a *= 0x9e3779b1u;
+    return (unsigned int)(a >> 7);
+}
+
+static unsigned int smprof_bucket(uint64_t elapsed)
+{
+    unsigned int b;
+
+    if (!elapsed)
+        return 0;
+    b = 64 - __builtin_clzll(elapsed);
+    return b < SMPROF_BUCKETS ? b : SMPROF_BUCKETS - 1;
+}
+
+static struct smprof_stat *smprof_find(struct smprof_thread *t,
+                                       state_func func)
+{
+    unsigned int h = smprof_hash(func);
+    unsigned int i;
+
+    for (i = 0; i < SMPROF_SLOTS; i++) {
+        struct smprof_stat *st = &t->slot[(h + i) & (SMPROF_SLOTS - 1)];
+
+        if (st->func == func)
+            return st;
+        if (!st->func) {
+            __atomic_store_n(&st->func, func, __ATOMIC_RELEASE);
+            return st;
+        }
+    }
+    return &t->overflow;
+}
+
+void smprof_record(state_func func, int result, uint64_t elapsed)
+{
+    struct smprof_thread *t = smprof_self;
+    struct smprof_stat *st;
+
+    if (!t && !(t = smprof_attach()))
+        return;
+    st = smprof_find(t, func);
+    smprof_bump(&st->calls, 1);
+    if (result == SM_RETURN_REPEAT)
+        smprof_bump(&st->repeats, 1);
+    else if (result < 0)
+        smprof_bump(&st->errors, 1);
+    smprof_bump(&st->time, elapsed);
+    smprof_bump(&st->hist[smprof_bucket(elapsed)], 1);
+}
+
+static void smprof_add(struct smprof_stat *to, struct smprof_stat *from)
+{
+    unsigned int b;
+
+    to->calls += smprof_load(&from->calls);
+    to->repeats += smprof_load(&from->repeats);
+    to->errors += smprof_load(&from->errors);
+    to->time += smprof_load(&from->time);
+    for (b = 0; b < SMPROF_BUCKETS; b++)
+        to->hist[b] += smprof_load(&from->hist[b]);
+}
+
+static int smprof_cmp(const void *a, const void *b)
+{
+    const struct smprof_stat *x = a, *y = b;
+
+    return x->time < y->time ? 1 : x->time > y->time ? -1 : 0;
+}
+
+unsigned int smprof_merge(struct smprof_stat *out, unsigned int max)
+{
+    struct smprof_thread *t;
+    struct smprof_stat over;
+    unsigned int n = 0;
+    unsigned int i, j;
+
+    memset(&over, 0, sizeof(over));
+    for (t = __atomic_load_n(&smprof_threads, __ATOMIC_ACQUIRE); t;
+         t = t->next) {
+        for (i = 0; i < SMPROF_SLOTS; i++) {
+            state_func func = __atomic_load_n(&t->slot[i].func,
+                                              __ATOMIC_ACQUIRE);
+
+            if (!func)
+                continue;
+            for (j = 0; j < n && out[j].func != func; j++)
+                ;
+            if (j == n) {
+                if (n == max) {
+                    smprof_add(&over, &t->slot[i]);
+                    continue;
+                }
+                memset(&out[n], 0, sizeof(out[n]));
+                out[n++].func = func;
+            }
+            smprof_add(&out[j], &t->slot[i]);
+        }
+        smprof_add(&over, &t->overflow);
+    }
+    qsort(out, n, sizeof(*out), smprof_cmp);
+    if (over.calls && max) {
+        if (n == max)
+            smprof_add(&over, &out[--n]); /* smallest joins the overflow */
+        out[n++] = over;
+        qsort(out, n, sizeof(*out), smprof_cmp);
+    }
+    return n;
+}
+
+uint64_t smprof_percentile(const struct smprof_stat *st, double pct)
+{
+    uint64_t want = (uint64_t)(st->calls * pct / 100.0);
+    uint64_t seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < SMPROF_BUCKETS; b++) {
+        seen += st->hist[b];
+        if (seen > want)
+            return b ? (uint64_t)1 << b : 0; /* bucket's upper bound */
+    }
+    return (uint64_t)1 << (SMPROF_BUCKETS - 1);
+}
+
+void smprof_dump(FILE *f)
+{
+    struct smprof_stat *st = malloc(SMPROF_SLOTS * sizeof(*st));
+    unsigned int n, i;
+    uint64_t total = 0;
+
+    if (!st)
+        return;
+    n = smprof_merge(st, SMPROF_SLOTS);
+    for (i = 0; i < n; i++)
+        total += st[i].time;
+    fprintf(f, "%-32s %12s %12s %8s %6s %10s %10s %10s\n", "state", "calls",
+            "repeats", "errors", "time%", "avg", "p50", "p99");
+    for (i = 0; i < n; i++) {
+        char addr[2 + 2 * sizeof(void *) + 1];
+        const char *name = "(table full)";
+        Dl_info info;
+
+        if (st[i].func) {
+            void *p = (void *)(uintptr_t)st[i].func;
+
+            if (dladdr(p, &info) && info.dli_sname &&
+                info.dli_saddr == p) {
+                name = info.dli_sname;
+            } else {
+                snprintf(addr, sizeof(addr), "%p", p);
+                name = addr;
+            }
+        }
+        fprintf(f, "%-32s %12llu %12llu %8llu %6.2f %10.1f %10llu %10llu\n",
+                name, (unsigned long long)st[i].calls,
+                (unsigned long long)st[i].repeats,
+                (unsigned long long)st[i].errors,
+                total ? 100.0 * st[i].time / total : 0.0,
+                st[i].calls ? (double)st[i].time / st[i].calls : 0.0,
+                (unsigned long long)smprof_percentile(&st[i], 50),
+                (unsigned long long)smprof_percentile(&st[i], 99));
+    }
+    fprintf(f, "times in %s\n", SMPROF_UNIT);
+    free(st);
+}
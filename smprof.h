@@ -0,0 +1,92 @@
+/**********************************************************************
+ *
+ * Filename:    smprof.h
+ *
+ * Description: per state function profiling counters and latency
+ *              histograms, built into sm_run_state() with SM_PROFILE.
+ *
+ * Notes:       Needs GCC atomics and thread local storage.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMPROF_H__
+#define __SMPROF_H__
+#include <stdio.h>
+#include <stdint.h>
+#include "states.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/*
+ * Compile states.c (and nothing else needs to change) with -DSM_PROFILE and
+ * every state call made by sm_run_state() is counted against its state_func
+ * address: calls, SM_RETURN_REPEAT returns, error returns, total time and a
+ * log2 histogram of the time of one call. Without SM_PROFILE none of this
+ * is compiled in.
+ *
+ * Each thread counts into its own table, found through a thread local
+ * pointer, so recording takes no locks and no atomic read-modify-writes.
+ * smprof_merge() sums all threads' tables, it may run while the machines
+ * do. Tables of threads that exit are kept, their counts stay in the sums.
+ *
+ * Time is in cycles (TSC) on x86, ns elsewhere, see SMPROF_UNIT.
+ * smprof_dump() names states with dladdr(), which only knows exported
+ * symbols: link with -rdynamic for the executable's own states, static
+ * ones print as addresses (look them up with addr2line or nm).
+ */
+#ifndef SMPROF_SLOTS
+#define SMPROF_SLOTS    512     /* state functions per thread, power of 2 */
+#endif
+#define SMPROF_BUCKETS  32      /* bucket b counts times < 2^b, b > 0 */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SMPROF_UNIT     "cycles"
+static inline uint64_t smprof_clock(void)
+{
+    return __rdtsc();
+}
+#else
+#define SMPROF_UNIT     "ns"
+static inline uint64_t smprof_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+struct smprof_stat {
+    state_func func;            /* NULL: unused, or overflow in a merge */
+    uint64_t calls;
+    uint64_t repeats;           /* returned SM_RETURN_REPEAT */
+    uint64_t errors;            /* returned < 0 */
+    uint64_t time;              /* total, SMPROF_UNIT */
+    uint64_t hist[SMPROF_BUCKETS];
+};
+
+/* count one call, sm_run_state() does this under SM_PROFILE */
+void smprof_record(state_func func, int result, uint64_t elapsed);
+
+/*
+ * smprof_merge - sum every thread's counters
+ * out: room for max entries, sorted by total time, biggest first
+ * returns entries filled in. Calls from threads whose table was full are
+ * summed in an entry with a NULL func.
+ */
+unsigned int smprof_merge(struct smprof_stat *out, unsigned int max);
+
+/* estimate a percentile (0 .. 100) of one call's time from the histogram */
+uint64_t smprof_percentile(const struct smprof_stat *st, double pct);
+
+/* print the merged table, one line per state function */
+void smprof_dump(FILE *f);
+
+#endif //__SMPROF_H__
@@ -0,0 +1,289 @@
+/**********************************************************************
+ *
+ * Filename:    smreactor.c
+ *
+ * Description: tickless idle and fd readiness for the state machine
+ *              scheduler.
+ *
+ * Notes:       Linux only, uses epoll and timerfd.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "smreactor.h"
+
+#define SM_NS_PER_TICK (1000000000ULL / SM_TICK_RATE)
+
+/* epoll data of the doorbell, every watch has its own pointer */
+static char sm_reactor_doorbell;
+#define SM_REACTOR_DOORBELL ((void *)&sm_reactor_doorbell)
+
+int sm_reactor_init(struct sm_reactor *reactor)
+{
+    struct epoll_event ev;
+
+    reactor->armed_ns = 0;
+    reactor->wakeups = 0;
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epfd < 0)
+        return -1;
+    reactor->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC);
+    if (reactor->timerfd < 0)
+        goto err;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the timer, every watch has a pointer */
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->timerfd, &ev) < 0)
+        goto err_timer;
+    reactor->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->eventfd < 0)
+        goto err_timer;
+    ev.events = EPOLLIN;
+    ev.data.ptr = SM_REACTOR_DOORBELL;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->eventfd, &ev) < 0)
+        goto err_event;
+    return 0;
+
+err_event:
+    close(reactor->eventfd);
+err_timer:
+    close(reactor->timerfd);
+err:
+    close(reactor->epfd);
+    return -1;
+}
+
+void sm_reactor_close(struct sm_reactor *reactor)
+{
+    close(reactor->eventfd);
+    close(reactor->timerfd);
+    close(reactor->epfd);
+}
+
+static int sm_reactor_ctl(struct sm_reactor *reactor, int op,
+                          struct sm_fd_watch *watch)
+{
+    struct epoll_event ev;
+
+    ev.events = watch->events;
+    ev.data.ptr = watch;
+    return epoll_ctl(reactor->epfd, op, watch->fd, &ev);
+}
+
+int sm_reactor_add(struct sm_reactor *reactor, struct sm_fd_watch *watch)
+{
+    watch->revents = 0;
+    return sm_reactor_ctl(reactor, EPOLL_CTL_ADD, watch);
+}
+
+int sm_reactor_mod(struct sm_reactor *reactor, struct sm_fd_watch *watch)
+{
+    return sm_reactor_ctl(reactor, EPOLL_CTL_MOD, watch);
+}
+
+int sm_reactor_del(struct sm_reactor *reactor, struct sm_fd_watch *watch)
+{
+    return sm_reactor_ctl(reactor, EPOLL_CTL_DEL, watch);
+}
+
+void sm_reactor_kick(struct sm_reactor *reactor)
+{
+    uint64_t one = 1;
+
+    if (write(reactor->eventfd, &one, sizeof(one)) < 0)
+        return; /* counter full, it is ringing anyway */
+}
+
+static void sm_reactor_sched_kick(struct sm_sched *sched)
+{
+    sm_reactor_kick(sched->reactor);
+}
+
+void sm_reactor_attach(struct sm_reactor *reactor, struct sm_sched *sched)
+{
+    sched->reactor = reactor;
+    sched->kick = sm_reactor_sched_kick;
+}
+
+void sm_fd_task_init(struct sm_fd_task *ft, int fd, state_func *table,
+                     sm_task_exit_func exit_func)
+{
+    sm_task_init(&ft->task, table, exit_func);
+    ft->fd = fd;
+    ft->watch.fd = -1;
+    ft->watch.events = 0;
+    ft->watch.revents = 0;
+    ft->watch.task = &ft->task;
+    ft->registered = 0;
+    ft->waiting = 0;
+}
+
+void sm_fd_task_release(struct sm_reactor *reactor, struct sm_fd_task *ft)
+{
+    if (ft->registered)
+        sm_reactor_del(reactor, &ft->watch);
+    ft->registered = 0;
+    ft->waiting = 0;
+}
+
+/*
+ * arm a one shot wait, so an fd nobody waits on never wakes the reactor.
+ * After the first wait that is one epoll_ctl(MOD) per wait.
+ */
+static int sm_fd_task_arm(struct sm_reactor *reactor, struct sm_fd_task *ft,
+                          int fd, uint32_t events)
+{
+    if (ft->registered && ft->watch.fd != fd)
+        sm_fd_task_release(reactor, ft);
+    ft->watch.fd = fd;
+    ft->watch.events = events | EPOLLONESHOT;
+    ft->watch.revents = 0;
+    if (ft->registered)
+        return sm_reactor_mod(reactor, &ft->watch);
+    if (sm_reactor_add(reactor, &ft->watch) < 0)
+        return -1;
+    ft->registered = 1;
+    return 0;
+}
+
+/*
+ * state machine function for SM_WAIT_FD, operands follow in the table:
+ * fd, events, timeout ticks
+ */
+int sm_wait_fd_state(struct state_machine *sm)
+{
+    struct sm_fd_task *ft = cast_sm_to_fd_task(sm);
+    struct sm_reactor *reactor = ft->task.sched ? ft->task.sched->reactor
+                                                : NULL;
+    int fd = (intptr_t)SM_TABLE_OPERAND(sm->stateptrptr + 1);
+
+    if (fd == SM_FD_OWN)
+        fd = ft->fd;
+    if (!reactor || fd < 0)
+        return SM_RETURN_ERROR;
+    if (!ft->waiting) {
+        SM_START_TIMER(sm, SM_TABLE_OPERAND(sm->stateptrptr + 3));
+        if (sm_fd_task_arm(reactor, ft, fd,
+                           SM_TABLE_OPERAND(sm->stateptrptr + 2)) < 0) {
+            if (errno != EPERM)
+                return SM_RETURN_ERROR;
+            /* epoll does not do regular files, they are always ready */
+            ft->watch.revents = ft->watch.events;
+        }
+        ft->waiting = 1;
+    }
+    if (ft->watch.revents) {
+        /* ready, or error/hangup which the next state will find out */
+        ft->watch.revents = 0;
+        ft->waiting = 0;
+        return SM_WAIT_FD_SLOTS + SM_RETURN_SKIP_JUMP_SIZE;
+    }
+    if (SM_IS_TIMER_DONE(sm)) {
+        /* the one shot is still armed, keep it from waking us later */
+        ft->watch.events = 0;
+        if (ft->registered)
+            sm_reactor_mod(reactor, &ft->watch);
+        ft->waiting = 0;
+        return SM_WAIT_FD_SLOTS;
+    }
+    sm_sched_block_timer(sm);
+    return SM_RETURN_REPEAT;
+}
+
+int sm_fd_task_wait(struct sm_fd_task *ft, int fd, uint32_t events)
+{
+    struct sm_reactor *reactor = ft->task.sched ? ft->task.sched->reactor
+                                                : NULL;
+
+    if (!reactor)
+        return 0; /* plain mainloop, it polls */
+    if (sm_fd_task_arm(reactor, ft, fd, events) < 0)
+        return errno == EPERM ? 0 : -1; /* regular files are always ready */
+    sm_sched_block(&ft->task.sm);
+    return 0;
+}
+
+/* (re)arm the timerfd, skip the syscall if the deadline did not move */
+static int sm_reactor_arm(struct sm_reactor *reactor, uint64_t deadline_ns)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    if (deadline_ns == reactor->armed_ns)
+        return 0;
+    its.it_value.tv_sec = deadline_ns / 1000000000ULL;
+    its.it_value.tv_nsec = deadline_ns % 1000000000ULL;
+    if (timerfd_settime(reactor->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        return -1;
+    reactor->armed_ns = deadline_ns;
+    return 0;
+}
+
+/* returns epoll_wait() timeout in ms, timer deadlines go to the timerfd */
+static int sm_reactor_timeout(struct sm_reactor *reactor,
+                              struct sm_sched *sched)
+{
+    struct timespec now;
+    uint64_t now_ns;
+    uint32_t ticks;
+
+    if (sm_sched_runnable(sched))
+        return 0;
+    SM_TICK_UPDATE(); /* the pass may have taken a while */
+    ticks = sm_sched_next_timer(sched);
+    if (ticks == SM_SCHED_NO_TIMER) {
+        sm_reactor_arm(reactor, 0);
+        return -1;
+    }
+    if (!ticks)
+        return 0;
+    /* wake at the start of the tick the timer is due in */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if (sm_reactor_arm(reactor,
+                       (now_ns / SM_NS_PER_TICK + ticks) * SM_NS_PER_TICK) < 0)
+        return 1; /* no timer, fall back to a short sleep */
+    return -1;
+}
+
+int sm_reactor_idle(struct sm_reactor *reactor, struct sm_sched *sched)
+{
+    struct epoll_event evs[SM_REACTOR_EVENTS];
+    int i, n, handled = 0;
+    uint64_t expirations;
+
+    n = epoll_wait(reactor->epfd, evs, SM_REACTOR_EVENTS,
+                   sm_reactor_timeout(reactor, sched));
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+    reactor->wakeups++;
+    for (i = 0; i < n; i++) {
+        struct sm_fd_watch *watch = evs[i].data.ptr;
+
+        if (!watch) {
+            /* timer fired, next idle has to arm it again */
+            if (read(reactor->timerfd, &expirations, sizeof(expirations)) < 0)
+                expirations = 0;
+            reactor->armed_ns = 0;
+            continue;
+        }
+        if (watch == SM_REACTOR_DOORBELL) {
+            /* remote wakes, the next pass takes them */
+            if (read(reactor->eventfd, &expirations, sizeof(expirations)) < 0)
+                expirations = 0;
+            continue;
+        }
+        watch->revents |= evs[i].events;
+        if (watch->task)
+            sm_sched_wake(watch->task);
+        handled++;
+    }
+    return handled;
+}
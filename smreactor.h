@@ -0,0 +1,144 @@
+/**********************************************************************
+ *
+ * Filename:    smreactor.h
+ *
+ * Description: tickless idle and fd readiness for the state machine
+ *              scheduler.
+ *
+ * Notes:       Linux only, uses epoll and timerfd.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMREACTOR_H__
+#define __SMREACTOR_H__
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "smsched.h"
+
+/*
+ * Replaces the fixed sleep at the bottom of a mainloop. sm_reactor_idle()
+ * asks the scheduler for its next timer and blocks in one epoll_wait()
+ * until then, or until a watched fd gets ready. A timerfd armed at the
+ * exact tick boundary does the timeout, so wakeups are as late as the
+ * kernel makes them, not rounded to a sleep granularity.
+ *
+ * The timerfd deadline assumes READ_GLOBAL_TICKS counts CLOCK_MONOTONIC
+ * at SM_TICK_RATE, like getms() does.
+ *
+ * An eventfd doorbell lets other threads end the wait, an attached
+ * scheduler rings it from sm_sched_wake_remote().
+ */
+#ifndef SM_REACTOR_EVENTS
+#define SM_REACTOR_EVENTS 64    /* fd events taken per epoll_wait() */
+#endif
+
+/*
+ * One watched fd. When the fd reports any of events, they are or'ed into
+ * revents and task (if any) is woken with sm_sched_wake(). The state
+ * checking the fd clears revents once it has consumed the readiness.
+ */
+struct sm_fd_watch {
+    int fd;
+    uint32_t events;            /* EPOLLIN, EPOLLOUT ... */
+    uint32_t revents;           /* what was reported since last cleared */
+    struct sm_task *task;       /* woken on readiness, may be NULL */
+};
+
+/*
+ * A scheduled machine that can sit in SM_WAIT_FD. States get a pointer to
+ * task.sm as usual, the fd wait keeps its registration in watch.
+ */
+struct sm_fd_task {
+    struct sm_task task;
+    int fd;                     /* the machine's own fd, for SM_FD_OWN */
+    struct sm_fd_watch watch;   /* epoll registration of the fd waited on */
+    unsigned char registered;   /* watch.fd is known to epoll */
+    unsigned char waiting;      /* inside SM_WAIT_FD, timer started */
+};
+
+#define cast_sm_to_fd_task(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct sm_fd_task, task.sm))
+
+/*
+ * SM_WAIT_FD - table entry waiting for fd readiness or a timeout
+ * fd: an fd known when the table is built (STDIN_FILENO), or SM_FD_OWN to
+ *     wait on the fd of the machine's sm_fd_task
+ * events: EPOLLIN and/or EPOLLOUT
+ * ms: timeout, a machine sitting here is parked (not stepped) until either
+ *     happens. Uses the sm timer, like SM_DELAY_MS.
+ *
+ * Continues like a state returning SM_RETURN_DONE on timeout and
+ * SM_RETURN_SKIP_JUMP when the fd is ready (or has an error/hangup), so
+ * follow it with the timeout SM_JUMP:
+ *
+ *      SM_WAIT_FD(SM_FD_OWN, EPOLLIN, 5000),
+ *      SM_JUMP(timed_out_table),
+ *      read_state,
+ *
+ * The machine must be a struct sm_fd_task on a scheduler that has a reactor
+ * attached with sm_reactor_attach().
+ */
+#define SM_FD_OWN -1
+#define SM_WAIT_FD(fd, events, ms) (sm_wait_fd_state), \
+                        (state_func)(intptr_t)(fd), \
+                        (state_func)(uintptr_t)(events), \
+                        (state_func)(uintptr_t)(SM_MS_TO_TICKS(ms))
+/* table slots taken by SM_WAIT_FD, a timeout returns this */
+#define SM_WAIT_FD_SLOTS 4
+
+int sm_wait_fd_state(struct state_machine *sm);
+
+struct sm_reactor {
+    int epfd;
+    int timerfd;
+    int eventfd;                /* doorbell, see sm_reactor_kick() */
+    uint64_t armed_ns;          /* timerfd deadline, 0 if disarmed */
+    unsigned long wakeups;      /* epoll_wait() calls that returned */
+};
+
+/* returns 0 or -1 with errno set */
+int sm_reactor_init(struct sm_reactor *reactor);
+void sm_reactor_close(struct sm_reactor *reactor);
+/* start/change/stop watching, return 0 or -1 with errno set */
+int sm_reactor_add(struct sm_reactor *reactor, struct sm_fd_watch *watch);
+int sm_reactor_mod(struct sm_reactor *reactor, struct sm_fd_watch *watch);
+int sm_reactor_del(struct sm_reactor *reactor, struct sm_fd_watch *watch);
+
+/*
+ * make the reactor serve SM_WAIT_FD for machines on this scheduler, and
+ * have remote wakes of its tasks kick the reactor
+ */
+void sm_reactor_attach(struct sm_reactor *reactor, struct sm_sched *sched);
+/* end a sm_reactor_idle() wait from any thread */
+void sm_reactor_kick(struct sm_reactor *reactor);
+/* like sm_task_init(), fd is the one SM_FD_OWN waits on, may be -1 */
+void sm_fd_task_init(struct sm_fd_task *ft, int fd, state_func *table,
+                     sm_task_exit_func exit_func);
+/* forget the epoll registration, call before closing or changing the fd */
+void sm_fd_task_release(struct sm_reactor *reactor, struct sm_fd_task *ft);
+
+/*
+ * sm_fd_task_wait - park the machine until fd reports events, no timeout
+ * For a state that finds an fd not ready half way through, eg a short
+ * write: it calls this, returns SM_RETURN_REPEAT and is stepped again when
+ * the fd is ready. Without a reactor the machine just polls.
+ * returns 0 or -1 with errno set
+ */
+int sm_fd_task_wait(struct sm_fd_task *ft, int fd, uint32_t events);
+
+/*
+ * sm_reactor_idle - wait for the next thing the scheduler can act on
+ *
+ * Does not block at all if a machine is runnable, only collects fd events.
+ * Otherwise sleeps until the next timer or fd event, forever if there is
+ * neither. Call it between sm_sched_run_until_blocked() passes.
+ * returns number of fd events handled, or -1 with errno set
+ */
+int sm_reactor_idle(struct sm_reactor *reactor, struct sm_sched *sched);
+
+#endif //__SMREACTOR_H__
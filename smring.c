@@ -0,0 +1,278 @@
+/**********************************************************************
+ *
+ * Filename:    smring.c
+ *
+ * Description: lock free single producer single consumer byte ring, with
+ *              bulk, zero copy and record access.
+ *
+ * Notes:       Needs GCC atomics.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "smring.h"
+
+#define sm_ring_load(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define sm_ring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* record header: payload length, or SM_RING_REC_PAD to skip to the front */
+#define SM_RING_REC_PAD     ((uint32_t)-1)
+#define SM_RING_REC_ROUND(n) (((n) + 7) & ~(size_t)7)
+
+/* the buffer is found from the ring itself, see buf_off */
+static inline uint8_t *sm_ring_buf(struct sm_ring *ring)
+{
+    return (uint8_t *)((uintptr_t)ring + ring->buf_off);
+}
+
+int sm_ring_init_buf(struct sm_ring *ring, void *buf, size_t size)
+{
+    if (size < 2 * SM_RING_REC_HDR || (size & (size - 1)))
+        return -1;
+    ring->head = 0;
+    ring->tail_seen = 0;
+    ring->tail = 0;
+    ring->head_seen = 0;
+    ring->buf_off = (uintptr_t)buf - (uintptr_t)ring;
+    ring->size = size;
+    ring->own_buf = 0;
+    return 0;
+}
+
+int sm_ring_init(struct sm_ring *ring, size_t size)
+{
+    void *buf;
+
+    if (size < SM_RING_ALIGN)
+        size = SM_RING_ALIGN;
+    buf = aligned_alloc(SM_RING_ALIGN, size);
+    if (!buf || sm_ring_init_buf(ring, buf, size) < 0) {
+        free(buf);
+        return -1;
+    }
+    ring->own_buf = 1;
+    return 0;
+}
+
+void sm_ring_destroy(struct sm_ring *ring)
+{
+    if (ring->own_buf)
+        free(sm_ring_buf(ring));
+    ring->own_buf = 0;
+}
+
+size_t sm_ring_used(struct sm_ring *ring)
+{
+    return sm_ring_load(&ring->head) - sm_ring_load(&ring->tail);
+}
+
+size_t sm_ring_space(struct sm_ring *ring)
+{
+    return ring->size - sm_ring_used(ring);
+}
+
+/* producer: free bytes, only loads the consumer's line when needed */
+static size_t sm_ring_room(struct sm_ring *ring, size_t want)
+{
+    size_t room = ring->size - (ring->head - ring->tail_seen);
+
+    if (room < want) {
+        ring->tail_seen = sm_ring_load(&ring->tail);
+        room = ring->size - (ring->head - ring->tail_seen);
+    }
+    return room;
+}
+
+/* consumer: bytes there, only loads the producer's line when needed */
+static size_t sm_ring_avail(struct sm_ring *ring, size_t want)
+{
+    size_t avail = ring->head_seen - ring->tail;
+
+    if (avail < want) {
+        ring->head_seen = sm_ring_load(&ring->head);
+        avail = ring->head_seen - ring->tail;
+    }
+    return avail;
+}
+
+size_t sm_ring_push(struct sm_ring *ring, const void *data, size_t len)
+{
+    size_t room = sm_ring_room(ring, len);
+    size_t off = ring->head & (ring->size - 1);
+    size_t first;
+
+    if (len > room)
+        len = room;
+    first = ring->size - off;
+    if (first > len)
+        first = len;
+    memcpy(sm_ring_buf(ring) + off, data, first);
+    memcpy(sm_ring_buf(ring), (const uint8_t *)data + first, len - first);
+    sm_ring_store(&ring->head, ring->head + len);
+    return len;
+}
+
+size_t sm_ring_pop(struct sm_ring *ring, void *data, size_t len)
+{
+    size_t avail = sm_ring_avail(ring, len);
+    size_t off = ring->tail & (ring->size - 1);
+    size_t first;
+
+    if (len > avail)
+        len = avail;
+    first = ring->size - off;
+    if (first > len)
+        first = len;
+    memcpy(data, sm_ring_buf(ring) + off, first);
+    memcpy((uint8_t *)data + first, sm_ring_buf(ring), len - first);
+    sm_ring_store(&ring->tail, ring->tail + len);
+    return len;
+}
+
+size_t sm_ring_write_span(struct sm_ring *ring, void **p)
+{
+    size_t off = ring->head & (ring->size - 1);
+    size_t len = ring->size - off;
+    size_t room = sm_ring_room(ring, len);
+
+    *p = sm_ring_buf(ring) + off;
+    return room < len ? room : len;
+}
+
+void sm_ring_write_commit(struct sm_ring *ring, size_t len)
+{
+    sm_ring_store(&ring->head, ring->head + len);
+}
+
+size_t sm_ring_read_span(struct sm_ring *ring, const void **p)
+{
+    size_t off = ring->tail & (ring->size - 1);
+    size_t len = ring->size - off;
+    size_t avail = sm_ring_avail(ring, len);
+
+    *p = sm_ring_buf(ring) + off;
+    return avail < len ? avail : len;
+}
+
+void sm_ring_read_release(struct sm_ring *ring, size_t len)
+{
+    sm_ring_store(&ring->tail, ring->tail + len);
+}
+
+size_t sm_ring_write_spans(struct sm_ring *ring, void *p[2], size_t n[2])
+{
+    size_t off = ring->head & (ring->size - 1);
+    size_t room = sm_ring_room(ring, ring->size);
+    size_t end = ring->size - off;
+
+    p[0] = sm_ring_buf(ring) + off;
+    p[1] = sm_ring_buf(ring);
+    n[0] = room < end ? room : end;
+    n[1] = room - n[0];
+    return room;
+}
+
+size_t sm_ring_read_spans(struct sm_ring *ring, const void *p[2],
+                          size_t n[2])
+{
+    size_t off = ring->tail & (ring->size - 1);
+    size_t avail = sm_ring_avail(ring, ring->size);
+    size_t end = ring->size - off;
+
+    p[0] = sm_ring_buf(ring) + off;
+    p[1] = sm_ring_buf(ring);
+    n[0] = avail < end ? avail : end;
+    n[1] = avail - n[0];
+    return avail;
+}
+
+/*
+ * records, the header is 8 bytes so payloads stay 8 byte aligned, headers
+ * never wrap since everything is a multiple of 8
+ */
+void *sm_ring_rec_reserve(struct sm_ring *ring, size_t len)
+{
+    size_t need = SM_RING_REC_HDR + SM_RING_REC_ROUND(len);
+    size_t off = ring->head & (ring->size - 1);
+    size_t end = ring->size - off;
+
+    if (len > SM_RING_REC_MAX(ring))
+        return NULL;
+    if (need > end) {
+        /* pad out the end, the record goes at the front */
+        if (sm_ring_room(ring, end + need) < end + need)
+            return NULL;
+        *(uint32_t *)(sm_ring_buf(ring) + off) = SM_RING_REC_PAD;
+        sm_ring_store(&ring->head, ring->head + end);
+        off = 0;
+    } else if (sm_ring_room(ring, need) < need) {
+        return NULL;
+    }
+    return sm_ring_buf(ring) + off + SM_RING_REC_HDR;
+}
+
+void sm_ring_rec_commit(struct sm_ring *ring, size_t len)
+{
+    size_t off = ring->head & (ring->size - 1);
+
+    *(uint32_t *)(sm_ring_buf(ring) + off) = len;
+    sm_ring_store(&ring->head,
+                  ring->head + SM_RING_REC_HDR + SM_RING_REC_ROUND(len));
+}
+
+const void *sm_ring_rec_peek(struct sm_ring *ring, size_t *len)
+{
+    size_t off;
+    uint32_t hdr;
+
+    for (;;) {
+        if (sm_ring_avail(ring, SM_RING_REC_HDR) < SM_RING_REC_HDR)
+            return NULL;
+        off = ring->tail & (ring->size - 1);
+        hdr = *(uint32_t *)(sm_ring_buf(ring) + off);
+        if (hdr != SM_RING_REC_PAD)
+            break;
+        sm_ring_store(&ring->tail, ring->tail + (ring->size - off));
+    }
+    *len = hdr;
+    return sm_ring_buf(ring) + off + SM_RING_REC_HDR;
+}
+
+void sm_ring_rec_release(struct sm_ring *ring)
+{
+    size_t off = ring->tail & (ring->size - 1);
+    uint32_t hdr = *(uint32_t *)(sm_ring_buf(ring) + off);
+
+    sm_ring_store(&ring->tail,
+                  ring->tail + SM_RING_REC_HDR + SM_RING_REC_ROUND(hdr));
+}
+
+int sm_ring_rec_put(struct sm_ring *ring, const void *data, size_t len)
+{
+    void *p = sm_ring_rec_reserve(ring, len);
+
+    if (!p)
+        return -1;
+    memcpy(p, data, len);
+    sm_ring_rec_commit(ring, len);
+    return 0;
+}
+
+long sm_ring_rec_get(struct sm_ring *ring, void *data, size_t max)
+{
+    size_t len;
+    const void *p = sm_ring_rec_peek(ring, &len);
+
+    if (!p)
+        return -1;
+    if (len > max)
+        return -2;
+    memcpy(data, p, len);
+    sm_ring_rec_release(ring);
+    return len;
+}
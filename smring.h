@@ -0,0 +1,114 @@
+/**********************************************************************
+ *
+ * Filename:    smring.h
+ *
+ * Description: lock free single producer single consumer byte ring, with
+ *              bulk, zero copy and record access.
+ *
+ * Notes:       Needs GCC atomics.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMRING_H__
+#define __SMRING_H__
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One machine (or thread) writes, one reads, no locks. head and tail count
+ * bytes ever written and read, each on its own cache line with the other
+ * side's last seen value, so a side only touches the other's line when its
+ * cached view says the ring is full (or empty). Index stores are release,
+ * loads of the other side's index acquire, so the data is visible before
+ * the index that covers it.
+ *
+ * Byte mode: sm_ring_push()/sm_ring_pop() copy as much as fits in at most
+ * two memcpy, the zero copy calls hand out the contiguous span up to the
+ * end of the buffer:
+ *
+ *      n = sm_ring_write_span(ring, &p);      fill up to n bytes at p
+ *      sm_ring_write_commit(ring, used);
+ *      n = sm_ring_read_span(ring, &p);       use up to n bytes at p
+ *      sm_ring_read_release(ring, used);
+ *
+ * Record mode: variable length records, each contiguous in the buffer (a
+ * record that would wrap leaves a pad and starts over at the front), so
+ * both sides can use them in place. Do not mix modes on one ring. A record
+ * can be at most SM_RING_REC_MAX(ring) bytes.
+ *
+ * The buffer is kept as an offset from the ring, not a pointer, so a ring
+ * and its buffer in one shared memory segment work from every process that
+ * maps it, at whatever address. Never copy an initialized struct sm_ring.
+ */
+#ifndef SM_RING_ALIGN
+#define SM_RING_ALIGN   64      /* cache line */
+#endif
+
+struct sm_ring {
+    /* producer's line */
+    size_t head __attribute__((aligned(SM_RING_ALIGN)));
+    size_t tail_seen;
+    /* consumer's line */
+    size_t tail __attribute__((aligned(SM_RING_ALIGN)));
+    size_t head_seen;
+    /* read only after init */
+    uintptr_t buf_off __attribute__((aligned(SM_RING_ALIGN))); /* buf - ring */
+    size_t size;                /* power of 2 */
+    int own_buf;
+};
+
+/* record header, records are 8 byte aligned */
+#define SM_RING_REC_HDR     8
+#define SM_RING_REC_MAX(r)  ((r)->size / 2 - SM_RING_REC_HDR)
+
+/*
+ * sm_ring_init - allocate a ring of size bytes, a power of 2
+ * returns 0 or -1
+ * sm_ring_init_buf() uses the caller's buffer, eg shared memory.
+ */
+int sm_ring_init(struct sm_ring *ring, size_t size);
+int sm_ring_init_buf(struct sm_ring *ring, void *buf, size_t size);
+void sm_ring_destroy(struct sm_ring *ring);
+
+/* either side, exact only from the side that asks */
+size_t sm_ring_used(struct sm_ring *ring);
+size_t sm_ring_space(struct sm_ring *ring);
+
+/* bulk copy, return bytes moved, may be less than len */
+size_t sm_ring_push(struct sm_ring *ring, const void *data, size_t len);
+size_t sm_ring_pop(struct sm_ring *ring, void *data, size_t len);
+
+/* zero copy, spans are contiguous, 0 when full (empty) */
+size_t sm_ring_write_span(struct sm_ring *ring, void **p);
+void sm_ring_write_commit(struct sm_ring *ring, size_t len);
+size_t sm_ring_read_span(struct sm_ring *ring, const void **p);
+void sm_ring_read_release(struct sm_ring *ring, size_t len);
+
+/*
+ * both spans at once, for readv()/writev(): p[0] up to the end of the
+ * buffer, p[1] at its front, n[1] may be 0. returns n[0] + n[1], commit or
+ * release as above.
+ */
+size_t sm_ring_write_spans(struct sm_ring *ring, void *p[2], size_t n[2]);
+size_t sm_ring_read_spans(struct sm_ring *ring, const void *p[2],
+                          size_t n[2]);
+
+/*
+ * records, zero copy: reserve returns room for len bytes or NULL if full,
+ * commit publishes it (len may shrink). peek returns the oldest record and
+ * its length or NULL, release drops it.
+ */
+void *sm_ring_rec_reserve(struct sm_ring *ring, size_t len);
+void sm_ring_rec_commit(struct sm_ring *ring, size_t len);
+const void *sm_ring_rec_peek(struct sm_ring *ring, size_t *len);
+void sm_ring_rec_release(struct sm_ring *ring);
+/* records, copying: put returns 0 or -1 if full, get returns the record
+ * length, -1 if empty, or -2 if it did not fit in max (left in the ring) */
+int sm_ring_rec_put(struct sm_ring *ring, const void *data, size_t len);
+long sm_ring_rec_get(struct sm_ring *ring, void *data, size_t max);
+
+#endif //__SMRING_H__
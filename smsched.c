@@ -0,0 +1,765 @@
+/**********************************************************************
+ *
+ * Filename:    smsched.c
+ *
+ * Description: run queue scheduler for table driven state machines.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <string.h>
+#include <time.h>
+#include "smsched.h"
+
+#define cast_cdll_to_task(pt) (cast_p_to_outer( \
+            struct cdll *, pt, \
+            struct sm_task, node))
+#define cast_heap_to_task(ph) (cast_p_to_outer( \
+            struct sm_heap_node *, ph, \
+            struct sm_task, edf))
+
+/* true if tick a comes before tick b, for ticks less than half a wrap apart */
+static int sm_tick_before(SM_TIMER_SIZE a, SM_TIMER_SIZE b)
+{
+    SM_TIMER_SIZE diff = b - a;
+
+    return diff && diff <= (SM_TIMER_SIZE)~(SM_TIMER_SIZE)0 / 2;
+}
+
+static int sm_heap_less(struct sm_heap_node *a, struct sm_heap_node *b)
+{
+    return sm_tick_before(cast_heap_to_task(a)->due,
+                          cast_heap_to_task(b)->due);
+}
+
+/* swap child with its parent, only links move */
+static void sm_heap_swap(struct sm_heap *heap, struct sm_heap_node *parent,
+                         struct sm_heap_node *child)
+{
+    struct sm_heap_node *sibling;
+    struct sm_heap_node t;
+
+    t = *parent;
+    *parent = *child;
+    *child = t;
+    parent->parent = child;
+    if (child->left == child) {
+        child->left = parent;
+        sibling = child->right;
+    } else {
+        child->right = parent;
+        sibling = child->left;
+    }
+    if (sibling)
+        sibling->parent = child;
+    if (parent->left)
+        parent->left->parent = parent;
+    if (parent->right)
+        parent->right->parent = parent;
+    if (!child->parent)
+        heap->min = child;
+    else if (child->parent->left == parent)
+        child->parent->left = child;
+    else
+        child->parent->right = child;
+}
+
+/* link to the slot numbered n (1 is the root), following n's bits down */
+static struct sm_heap_node **sm_heap_slot(struct sm_heap *heap,
+                                          struct sm_heap_node **parent,
+                                          unsigned int n)
+{
+    struct sm_heap_node **link = &heap->min;
+    unsigned int path = 0, k;
+
+    for (k = 0; n >= 2; k++, n /= 2)
+        path = (path << 1) | (n & 1);
+    *parent = NULL;
+    for (; k > 0; k--, path >>= 1) {
+        *parent = *link;
+        link = path & 1 ? &(*link)->right : &(*link)->left;
+    }
+    return link;
+}
+
+static void sm_heap_insert(struct sm_heap *heap, struct sm_heap_node *node)
+{
+    struct sm_heap_node *parent;
+    struct sm_heap_node **link = sm_heap_slot(heap, &parent,
+                                              heap->nelts + 1);
+
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = parent;
+    *link = node;
+    heap->nelts++;
+    while (node->parent && sm_heap_less(node, node->parent))
+        sm_heap_swap(heap, node->parent, node);
+}
+
+static void sm_heap_remove(struct sm_heap *heap, struct sm_heap_node *node)
+{
+    struct sm_heap_node *parent, *child, *smallest;
+    struct sm_heap_node **last = sm_heap_slot(heap, &parent, heap->nelts);
+
+    /* the last node takes node's place, then sifts down or up */
+    child = *last;
+    *last = NULL;
+    heap->nelts--;
+    if (child == node)
+        return;
+    child->left = node->left;
+    child->right = node->right;
+    child->parent = node->parent;
+    if (child->left)
+        child->left->parent = child;
+    if (child->right)
+        child->right->parent = child;
+    if (!node->parent)
+        heap->min = child;
+    else if (node->parent->left == node)
+        node->parent->left = child;
+    else
+        node->parent->right = child;
+    for (;;) {
+        smallest = child;
+        if (child->left && sm_heap_less(child->left, smallest))
+            smallest = child->left;
+        if (child->right && sm_heap_less(child->right, smallest))
+            smallest = child->right;
+        if (smallest == child)
+            break;
+        sm_heap_swap(heap, child, smallest);
+    }
+    while (child->parent && sm_heap_less(child, child->parent))
+        sm_heap_swap(heap, child->parent, child);
+}
+
+void sm_sched_init(struct sm_sched *sched)
+{
+    unsigned int p;
+
+    for (p = 0; p < SM_SCHED_PRIOS; p++) {
+        cdll_init(&sched->ready[p].fifo);
+        sched->ready[p].edf.min = NULL;
+        sched->ready[p].edf.nelts = 0;
+        cdll_init(&sched->polling[p]);
+    }
+    sched->ready_mask = 0;
+    cdll_init(&sched->deadline_polling);
+    cdll_init(&sched->blocked);
+    tmw_init(&sched->wheel);
+    SM_TICK_UPDATE();
+    sched->wheel_tick = READ_GLOBAL_TICKS;
+    sched->steps = 0;
+    sched->deadline_misses = 0;
+    sched->max_late = 0;
+    sched->urgent = 0;
+    sched->measure = 0;
+    sched->quantum = 0;
+    sched->pass_ns = 0;
+    sched->overrun = NULL;
+    memset(&sched->pass, 0, sizeof(sched->pass));
+    sched->reactor = NULL;
+    sched->remote = NULL;
+    sched->kick = NULL;
+}
+
+void sm_task_init(struct sm_task *task, state_func *table,
+                  sm_task_exit_func exit_func)
+{
+    task->sm.stateptrptr = table;
+    task->sm.start_timer = 0;
+    task->sm.delay = 0;
+#ifdef SM_CALL_DEPTH
+    task->sm.calls = NULL;
+#endif
+    cdll_init(&task->node);
+    tmw_timer_init(&task->timer);
+    task->sched = NULL;
+    task->exit_func = exit_func;
+    task->where = SM_TASK_IDLE;
+    task->flags = 0;
+    task->woken = 0;
+    task->remote = 0;
+    task->prio = SM_PRIO_NORMAL;
+    task->due_set = 0;
+    task->deadline = 0;
+    task->due = 0;
+    task->misses = 0;
+    task->quantum = 0;
+    task->overruns = 0;
+    task->remote_next = NULL;
+}
+
+/* ticks until the sm timer is done, 0 if it already is */
+static SM_TIMER_SIZE sm_timer_left(struct state_machine *sm, SM_TIMER_SIZE now)
+{
+    SM_TIMER_SIZE elapsed = (SM_TIMER_SIZE)(now - sm->start_timer);
+
+    if (elapsed >= sm->delay)
+        return 0;
+    return sm->delay - elapsed;
+}
+
+static void sm_sched_queue(struct sm_sched *sched, struct sm_task *task,
+                           struct cdll *queue, unsigned char where)
+{
+    cdll_insert_node_tail(&task->node, queue);
+    /* remote wakers read it without holding anything */
+    __atomic_store_n(&task->sched, sched, __ATOMIC_RELEASE);
+    task->where = where;
+}
+
+/* a deadline task got runnable, its due time starts now */
+static void sm_sched_release(struct sm_task *task)
+{
+    if (task->deadline && !task->due_set) {
+        task->due = READ_GLOBAL_TICKS + task->deadline;
+        task->due_set = 1;
+    }
+}
+
+/* make the task ready in its priority's bucket */
+static void sm_sched_ready(struct sm_sched *sched, struct sm_task *task)
+{
+    struct sm_prio_queue *q = &sched->ready[task->prio];
+
+    if (task->deadline) {
+        sm_sched_release(task);
+        sm_heap_insert(&q->edf, &task->edf);
+        __atomic_store_n(&task->sched, sched, __ATOMIC_RELEASE);
+        task->where = SM_TASK_READY;
+    } else {
+        sm_sched_queue(sched, task, &q->fifo, SM_TASK_READY);
+    }
+    sched->ready_mask |= 1u << task->prio;
+    if (task->deadline || task->prio < SM_PRIO_NORMAL)
+        sched->urgent = 1;
+}
+
+/* the task gets one more try next pass */
+static void sm_sched_poll(struct sm_sched *sched, struct sm_task *task)
+{
+    if (task->deadline) {
+        sm_sched_release(task);
+        sm_sched_queue(sched, task, &sched->deadline_polling,
+                       SM_TASK_POLLING);
+    } else {
+        sm_sched_queue(sched, task, &sched->polling[task->prio],
+                       SM_TASK_POLLING);
+    }
+}
+
+/* take a READY or POLLING task off its queue */
+static void sm_sched_unready(struct sm_sched *sched, struct sm_task *task)
+{
+    struct sm_prio_queue *q = &sched->ready[task->prio];
+
+    if (task->where == SM_TASK_READY && task->deadline)
+        sm_heap_remove(&q->edf, &task->edf);
+    else
+        cdll_delete_node(&task->node);
+    /* a polling task may sit in a ready fifo after begin pass */
+    if (cdll_empty(&q->fifo) && !q->edf.nelts)
+        sched->ready_mask &= ~(1u << task->prio);
+}
+
+/* hang the task on the wheel until its sm timer is done */
+static void sm_sched_queue_timer(struct sm_sched *sched, struct sm_task *task,
+                                 SM_TIMER_SIZE now)
+{
+    /* wheel time lags until the next pass, count the lag in */
+    uint32_t ticks = (SM_TIMER_SIZE)(now - sched->wheel_tick);
+    SM_TIMER_SIZE left = sm_timer_left(&task->sm, now);
+
+    /* a wide timer past the wheel's reach gets filed again when it pops */
+    if (left > TMW_MAX_TICKS - ticks)
+        left = TMW_MAX_TICKS - ticks;
+    tmw_add(&sched->wheel, &task->timer, ticks + left);
+    __atomic_store_n(&task->sched, sched, __ATOMIC_RELEASE);
+    task->where = SM_TASK_TIMER;
+}
+
+/* move every task whose timer is done to the ready queue */
+static void sm_sched_expire_timers(struct sm_sched *sched)
+{
+    SM_TIMER_SIZE now = READ_GLOBAL_TICKS;
+    struct cdll expired;
+
+    cdll_init(&expired);
+    tmw_advance(&sched->wheel, (SM_TIMER_SIZE)(now - sched->wheel_tick),
+                &expired);
+    sched->wheel_tick = now;
+    while (!cdll_empty(&expired)) {
+        struct tmw_timer *timer = cast_cdll_to_tmw_timer(expired.next);
+        struct sm_task *task = cast_p_to_outer(
+                struct tmw_timer *, timer, struct sm_task, timer);
+
+        cdll_delete_node(&timer->node);
+        task->flags = 0;
+        sm_sched_ready(sched, task);
+    }
+}
+
+void sm_sched_add(struct sm_sched *sched, struct sm_task *task)
+{
+    sm_sched_remove(task);
+    task->flags = 0;
+    sm_sched_ready(sched, task);
+}
+
+void sm_sched_remove(struct sm_task *task)
+{
+    if (task->where == SM_TASK_TIMER)
+        tmw_cancel(&task->sched->wheel, &task->timer);
+    else if (task->where == SM_TASK_READY || task->where == SM_TASK_POLLING)
+        sm_sched_unready(task->sched, task);
+    else if (task->where == SM_TASK_BLOCKED)
+        cdll_delete_node(&task->node);
+    task->where = SM_TASK_IDLE;
+    task->due_set = 0;
+}
+
+/* requeue a runnable task around a change of its queue keys */
+void sm_task_set_prio(struct sm_task *task, unsigned int prio)
+{
+    unsigned char where = task->where;
+
+    if (prio > SM_PRIO_LOWEST)
+        prio = SM_PRIO_LOWEST;
+    if (where != SM_TASK_READY && where != SM_TASK_POLLING) {
+        task->prio = prio;
+        return;
+    }
+    sm_sched_unready(task->sched, task);
+    task->prio = prio;
+    if (where == SM_TASK_READY)
+        sm_sched_ready(task->sched, task);
+    else
+        sm_sched_poll(task->sched, task);
+}
+
+void sm_sched_set_budget(struct sm_sched *sched, unsigned int quantum,
+                         uint64_t pass_ns, sm_task_overrun_func overrun)
+{
+    sched->quantum = quantum;
+    sched->pass_ns = pass_ns;
+    sched->overrun = overrun;
+}
+
+void sm_task_set_quantum(struct sm_task *task, unsigned int quantum)
+{
+    task->quantum = quantum;
+}
+
+void sm_sched_measure(struct sm_sched *sched, int on)
+{
+    sched->measure = on;
+}
+
+void sm_task_set_deadline(struct sm_task *task, SM_TIMER_SIZE ticks)
+{
+    unsigned char where = task->where;
+
+    if (where != SM_TASK_READY && where != SM_TASK_POLLING) {
+        task->deadline = ticks;
+        task->due_set = 0;
+        return;
+    }
+    sm_sched_unready(task->sched, task);
+    task->deadline = ticks;
+    task->due_set = 0;
+    if (where == SM_TASK_READY)
+        sm_sched_ready(task->sched, task);
+    else
+        sm_sched_poll(task->sched, task);
+}
+
+void sm_sched_block(struct state_machine *sm)
+{
+    struct sm_task *task = cast_sm_to_task(sm);
+
+    task->flags |= SM_TASK_F_BLOCK;
+}
+
+void sm_sched_block_timer(struct state_machine *sm)
+{
+    struct sm_task *task = cast_sm_to_task(sm);
+
+    task->flags |= SM_TASK_F_BLOCK | SM_TASK_F_TIMEOUT;
+}
+
+void sm_sched_wake(struct sm_task *task)
+{
+    switch (task->where) {
+    case SM_TASK_TIMER:
+        tmw_cancel(&task->sched->wheel, &task->timer);
+        task->flags = 0;
+        sm_sched_ready(task->sched, task);
+        break;
+    case SM_TASK_BLOCKED:
+        cdll_delete_node(&task->node);
+        task->flags = 0;
+        sm_sched_ready(task->sched, task);
+        break;
+    case SM_TASK_RUNNING:
+        /* do not lose a wake that races the state parking itself */
+        task->woken = 1;
+        break;
+    default:
+        break; /* already runnable or not scheduled */
+    }
+}
+
+void sm_sched_wake_remote(struct sm_task *task)
+{
+    struct sm_sched *sched = __atomic_load_n(&task->sched, __ATOMIC_ACQUIRE);
+    struct sm_task *head;
+
+    if (!sched)
+        return; /* never added */
+    /* once on the list is enough until the next pass takes it off */
+    if (__atomic_exchange_n(&task->remote, 1, __ATOMIC_ACQ_REL))
+        return;
+    head = __atomic_load_n(&sched->remote, __ATOMIC_RELAXED);
+    do {
+        task->remote_next = head;
+    } while (!__atomic_compare_exchange_n(&sched->remote, &head, task, 1,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+    if (!head && sched->kick)
+        sched->kick(sched);
+}
+
+/* wake everything other threads asked for since the last pass */
+static void sm_sched_take_remote(struct sm_sched *sched)
+{
+    struct sm_task *task, *next;
+
+    if (!__atomic_load_n(&sched->remote, __ATOMIC_RELAXED))
+        return;
+    task = __atomic_exchange_n(&sched->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; task; task = next) {
+        next = task->remote_next;
+        /* a wake from now on queues it again, none get lost */
+        __atomic_store_n(&task->remote, 0, __ATOMIC_RELEASE);
+        sm_sched_wake(task);
+    }
+}
+
+/* deadline tasks that polled go by their due time, not at the back */
+static void sm_sched_ready_deadline_polling(struct sm_sched *sched)
+{
+    while (!cdll_empty(&sched->deadline_polling)) {
+        struct sm_task *task = cast_cdll_to_task(sched->deadline_polling.next);
+
+        cdll_delete_node(&task->node);
+        sm_sched_ready(sched, task);
+    }
+}
+
+void sm_sched_begin_pass(struct sm_sched *sched)
+{
+    unsigned int p;
+
+    SM_TICK_UPDATE(); /* the one clock read of the pass, if cached */
+    sm_sched_take_remote(sched);
+    sm_sched_expire_timers(sched);
+    sm_sched_ready_deadline_polling(sched);
+    /* all at once, polling tasks are already runnable and filed here */
+    for (p = 0; p < SM_SCHED_PRIOS; p++) {
+        if (cdll_empty(&sched->polling[p]))
+            continue;
+        cdll_splice_tail(&sched->polling[p], &sched->ready[p].fifo);
+        sched->ready_mask |= 1u << p;
+    }
+}
+
+int sm_sched_pass_due(struct sm_sched *sched)
+{
+    SM_TICK_UPDATE();
+    return !sched->ready_mask ||
+           __atomic_load_n(&sched->remote, __ATOMIC_RELAXED) ||
+           READ_GLOBAL_TICKS != sched->wheel_tick;
+}
+
+/* next task of the highest (or lowest) priority bucket, taken off it */
+static struct sm_task *sm_sched_take(struct sm_sched *sched, int lowest)
+{
+    struct sm_prio_queue *q;
+    struct sm_task *task;
+
+    if (!sched->ready_mask)
+        return NULL;
+    q = &sched->ready[lowest ? 31 - __builtin_clz(sched->ready_mask)
+                             : __builtin_ctz(sched->ready_mask)];
+    if (q->edf.min && (!lowest || cdll_empty(&q->fifo)))
+        task = cast_heap_to_task(q->edf.min);
+    else if (lowest)
+        task = cast_cdll_to_task(q->fifo.prev);
+    else
+        task = cast_cdll_to_task(q->fifo.next);
+    sm_sched_unready(sched, task);
+    task->where = SM_TASK_RUNNING;
+    task->woken = 0;
+    return task;
+}
+
+struct sm_task *sm_sched_pop(struct sm_sched *sched)
+{
+    return sm_sched_take(sched, 0);
+}
+
+struct sm_task *sm_sched_steal(struct sm_sched *sched, struct sm_sched *thief)
+{
+    /* the owner pops the most urgent, take the coldest */
+    struct sm_task *task = sm_sched_take(sched, 1);
+
+    if (!task)
+        return NULL;
+    __atomic_store_n(&task->sched, thief, __ATOMIC_RELEASE);
+    return task;
+}
+
+int sm_task_run(struct sm_task *task, unsigned long *steps)
+{
+    int ret;
+    unsigned long n = 0;
+    unsigned int quantum = task->quantum ? task->quantum
+                         : task->sched ? task->sched->quantum : 0;
+
+    do {
+        ret = sm_run_state(&task->sm);
+        n++;
+    } while (ret > 0 && task->sm.stateptrptr && n != quantum);
+    *steps += n;
+    return ret;
+}
+
+/* a deadline task's run is over, did it make it */
+static void sm_sched_check_due(struct sm_sched *sched, struct sm_task *task)
+{
+    SM_TIMER_SIZE late = READ_GLOBAL_TICKS - task->due;
+
+    task->due_set = 0;
+    if (late && late <= (SM_TIMER_SIZE)~(SM_TIMER_SIZE)0 / 2) {
+        task->misses++;
+        sched->deadline_misses++;
+        if (late > sched->max_late)
+            sched->max_late = late;
+    }
+}
+
+void sm_sched_file(struct sm_sched *sched, struct sm_task *task, int ret)
+{
+    unsigned char flags = task->flags;
+    SM_TIMER_SIZE now;
+
+    task->flags = 0;
+    if (task->due_set)
+        sm_sched_check_due(sched, task);
+    /* an end of table NULL leaves stateptrptr alone, it exited all the same */
+    if (ret < 0)
+        task->sm.stateptrptr = NULL;
+    if (!task->sm.stateptrptr) {
+        task->where = SM_TASK_IDLE;
+        if (task->exit_func)
+            task->exit_func(task, ret);
+        /* restarted by callback? give the others a turn first */
+        if (task->sm.stateptrptr && task->where == SM_TASK_IDLE)
+            sm_sched_poll(sched, task);
+        return;
+    }
+    if (ret > 0 && !(flags & SM_TASK_F_BLOCK)) {
+        /* quantum used up, carry on after the others */
+        task->overruns++;
+        if (sched->measure)
+            sched->pass.overruns++;
+        if (sched->overrun)
+            sched->overrun(task);
+        sm_sched_poll(sched, task);
+        return;
+    }
+    if (flags & SM_TASK_F_BLOCK) {
+        if (task->woken) {
+            sm_sched_poll(sched, task);
+        } else if (flags & SM_TASK_F_TIMEOUT) {
+            task->flags = SM_TASK_F_BLOCK | SM_TASK_F_TIMEOUT;
+            now = READ_GLOBAL_TICKS;
+            if (sm_timer_left(&task->sm, now))
+                sm_sched_queue_timer(sched, task, now);
+            else
+                sm_sched_poll(sched, task);
+        } else {
+            task->flags = SM_TASK_F_BLOCK;
+            sm_sched_queue(sched, task, &sched->blocked, SM_TASK_BLOCKED);
+        }
+        return;
+    }
+    if (*task->sm.stateptrptr == sm_wait_ticks_state) {
+        now = READ_GLOBAL_TICKS;
+        if (sm_timer_left(&task->sm, now)) {
+            sm_sched_queue_timer(sched, task, now);
+            return;
+        }
+    }
+    /* repeating without telling us why, or just jumped, try next pass */
+    sm_sched_poll(sched, task);
+}
+
+static uint64_t sm_sched_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* histogram bucket, 4 per power of 2 */
+static unsigned int sm_sched_hist_bucket(uint64_t ns)
+{
+    unsigned int msb;
+
+    if (ns < 4)
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+/* largest ns landing in bucket */
+static uint64_t sm_sched_hist_top(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < 4)
+        return bucket;
+    shift = bucket / 4 - 1;
+    return ((uint64_t)(4 + bucket % 4) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+static uint64_t sm_sched_hist_pct(const uint32_t *hist, unsigned long total,
+                                  unsigned int pct)
+{
+    unsigned long want = (total * pct + 99) / 100, seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < SM_SCHED_HIST; b++) {
+        seen += hist[b];
+        if (seen >= want && seen)
+            return sm_sched_hist_top(b);
+    }
+    return 0;
+}
+
+/* ready tasks a cut pass leaves behind */
+static unsigned long sm_sched_count_ready(struct sm_sched *sched)
+{
+    unsigned long n = 0;
+    unsigned int p;
+    struct cdll *node;
+
+    for (p = 0; p < SM_SCHED_PRIOS; p++) {
+        n += sched->ready[p].edf.nelts;
+        for (node = sched->ready[p].fifo.next; node != &sched->ready[p].fifo;
+             node = node->next)
+            n++;
+    }
+    return n;
+}
+
+static void sm_sched_end_measure(struct sm_sched *sched, unsigned long steps,
+                                 uint64_t ns, int cut)
+{
+    struct sm_sched_pass_stats *pass = &sched->pass;
+
+    pass->steps = steps;
+    pass->ns = ns;
+    pass->left = cut ? sm_sched_count_ready(sched) : 0;
+    /* bucket tops, but never past what was seen */
+    pass->run_p50_ns = sm_sched_hist_pct(pass->run, pass->runs, 50);
+    pass->run_p99_ns = sm_sched_hist_pct(pass->run, pass->runs, 99);
+    if (pass->run_p50_ns > pass->run_max_ns)
+        pass->run_p50_ns = pass->run_max_ns;
+    if (pass->run_p99_ns > pass->run_max_ns)
+        pass->run_p99_ns = pass->run_max_ns;
+}
+
+unsigned long sm_sched_run_until_blocked(struct sm_sched *sched)
+{
+    unsigned long start = sched->steps;
+    struct sm_task *task;
+    uint64_t t0 = 0, t = 0, before = 0;
+    int ret, cut = 0;
+
+    if (sched->measure || sched->pass_ns)
+        t0 = sm_sched_ns();
+    if (sched->measure)
+        memset(&sched->pass, 0, sizeof(sched->pass));
+    sm_sched_begin_pass(sched);
+    while ((task = sm_sched_pop(sched))) {
+        if (sched->measure)
+            before = sm_sched_ns();
+        ret = sm_task_run(task, &sched->steps);
+        if (sched->measure) {
+            t = sm_sched_ns();
+            sched->pass.runs++;
+            sched->pass.run[sm_sched_hist_bucket(t - before)]++;
+            if (t - before > sched->pass.run_max_ns)
+                sched->pass.run_max_ns = t - before;
+        } else if (sched->pass_ns) {
+            t = sm_sched_ns();
+        }
+        if (sched->urgent) {
+            /*
+             * do not let a long pass hold up urgent timers and wakes, nor
+             * deadline tasks that polled before this one ran
+             */
+            SM_TICK_UPDATE();
+            sm_sched_take_remote(sched);
+            if (READ_GLOBAL_TICKS != sched->wheel_tick)
+                sm_sched_expire_timers(sched);
+            sm_sched_ready_deadline_polling(sched);
+        }
+        sm_sched_file(sched, task, ret);
+        if (sched->pass_ns && t - t0 >= sched->pass_ns) {
+            /* out of time, what is still ready goes first next pass */
+            cut = 1;
+            break;
+        }
+    }
+    if (sched->measure)
+        sm_sched_end_measure(sched, sched->steps - start, sm_sched_ns() - t0,
+                             cut);
+    return sched->steps - start;
+}
+
+int sm_sched_runnable(struct sm_sched *sched)
+{
+    unsigned int p;
+
+    if (sched->ready_mask || !cdll_empty(&sched->deadline_polling) ||
+        __atomic_load_n(&sched->remote, __ATOMIC_RELAXED))
+        return 1;
+    for (p = 0; p < SM_SCHED_PRIOS; p++) {
+        if (!cdll_empty(&sched->polling[p]))
+            return 1;
+    }
+    return 0;
+}
+
+uint32_t sm_sched_next_timer(struct sm_sched *sched)
+{
+    uint32_t next = tmw_next(&sched->wheel);
+    /* wheel time is as of the last pass */
+    uint32_t lag = (SM_TIMER_SIZE)(READ_GLOBAL_TICKS - sched->wheel_tick);
+
+    if (next == TMW_NO_TIMER)
+        return SM_SCHED_NO_TIMER;
+    return next > lag ? next - lag : 0;
+}
@@ -0,0 +1,287 @@
+/**********************************************************************
+ *
+ * Filename:    smsched.h
+ *
+ * Description: run queue scheduler for table driven state machines.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMSCHED_H__
+#define __SMSCHED_H__
+#include "states.h"
+#include "cdll.h"
+#include "tmwheel.h"
+
+/*
+ * Instead of calling sm_run_state() on every machine every mainloop, wrap
+ * each machine in a sm_task and hand it to a scheduler. The scheduler only
+ * steps machines that can make progress:
+ *
+ *  ready   - runnable now, stepped this pass
+ *  polling - returned SM_RETURN_REPEAT without parking, stepped once per pass
+ *  timers  - sitting in sm_wait_ticks_state (or parked with a timeout),
+ *            hung on a timing wheel, not stepped until the timer is done
+ *  blocked - parked by sm_sched_block(), not stepped until sm_sched_wake()
+ *
+ * Runnable machines go in strict priority order, SM_PRIO_HIGHEST first.
+ * Within a priority, machines with a deadline (sm_task_set_deadline()) go
+ * earliest deadline first, ahead of the ones without, which go round robin.
+ * Ready queues are one bucket per priority and a bitmap of the non empty
+ * ones, deadline machines sit in a heap per bucket, O(log n).
+ *
+ * A machine runs until it repeats, jumps or exits, like the classic
+ * do/while mainloop, or until its step quantum is used up. Then it goes to
+ * the back of the line and carries on next pass. A pass may also get a
+ * wall time budget, the tasks not run yet go first next pass.
+ *
+ * A machine that sits in sm_wait_ticks_state is parked automatically, no
+ * table changes needed. A state that waits for some event calls
+ * sm_sched_block() or sm_sched_block_timer() and returns SM_RETURN_REPEAT,
+ * whoever produces the event calls sm_sched_wake().
+ *
+ * Like the rest of the state machines this is single task/thread, do not
+ * touch a scheduler from more than one thread without a lock around it
+ * (see smexec.h for the multi-threaded executor built on top of this).
+ * The one exception is sm_sched_wake_remote(), which other threads may
+ * call to wake a task, the next pass picks the wake up.
+ */
+
+/* which scheduler queue the task is on */
+#define SM_TASK_IDLE    0   /* not on any queue, exited or not added */
+#define SM_TASK_READY   1
+#define SM_TASK_POLLING 2   /* polling tasks move to ready still saying so */
+#define SM_TASK_TIMER   3
+#define SM_TASK_BLOCKED 4
+#define SM_TASK_RUNNING 5
+
+/* priorities, 0 goes first */
+#ifndef SM_SCHED_PRIOS
+#define SM_SCHED_PRIOS  4   /* at most 32 */
+#endif
+#define SM_PRIO_HIGHEST 0
+#define SM_PRIO_NORMAL  (SM_SCHED_PRIOS / 2)
+#define SM_PRIO_LOWEST  (SM_SCHED_PRIOS - 1)
+
+/* sm_sched_pass_stats.run histogram, 4 buckets per power of 2 ns */
+#define SM_SCHED_HIST   256
+
+/* task flags */
+#define SM_TASK_F_BLOCK     0x01    /* state asked to park on return */
+#define SM_TASK_F_TIMEOUT   0x02    /* ... and also wake when timer done */
+
+/* intrusive binary heap, a tree shaped by the element count */
+struct sm_heap_node {
+    struct sm_heap_node *left;
+    struct sm_heap_node *right;
+    struct sm_heap_node *parent;
+};
+
+struct sm_heap {
+    struct sm_heap_node *min;
+    unsigned int nelts;
+};
+
+struct sm_task;
+/*
+ * called when the machine exits (error or NULL state), result is the last
+ * sm_run_state() return. The callback may SM_SET_TABLE() to restart it.
+ */
+typedef void (*sm_task_exit_func)(struct sm_task *task, int result);
+
+struct sm_task {
+    struct state_machine sm;    /* the machine, states get a ptr to this */
+    struct cdll node;           /* links task into one scheduler queue */
+    struct tmw_timer timer;     /* used instead of node while on the wheel */
+    struct sm_heap_node edf;    /* used instead of node while ready with a
+                                   deadline */
+    struct sm_sched *sched;     /* scheduler owning this task */
+    sm_task_exit_func exit_func;/* may be NULL, task then just goes idle */
+    unsigned char where;        /* SM_TASK_xxx queue holding the task */
+    unsigned char flags;        /* SM_TASK_F_xxx, only touched by runner */
+    unsigned char woken;        /* wake arrived while running */
+    unsigned char remote;       /* on sched->remote, atomic access */
+    unsigned char prio;         /* SM_PRIO_xxx */
+    unsigned char due_set;      /* due is running, task is released */
+    SM_TIMER_SIZE deadline;     /* ticks from release, 0 for none */
+    SM_TIMER_SIZE due;          /* tick this release has to be done by */
+    unsigned long misses;       /* releases that ran past due */
+    unsigned int quantum;       /* steps per run, 0 uses the sched's */
+    unsigned long overruns;     /* runs cut short by the quantum */
+    struct sm_task *remote_next;/* links task into sched->remote */
+};
+
+/* one priority's ready tasks */
+struct sm_prio_queue {
+    struct cdll fifo;           /* no deadline, round robin */
+    struct sm_heap edf;         /* deadline tasks, earliest first */
+};
+
+/* what one sm_sched_run_until_blocked() did, when measuring */
+struct sm_sched_pass_stats {
+    unsigned long steps;
+    unsigned long runs;         /* tasks run, a run is up to a quantum */
+    unsigned long overruns;     /* runs cut short by the quantum */
+    unsigned long left;         /* ready tasks left over by the wall budget */
+    uint64_t ns;                /* wall time of the pass */
+    uint64_t run_p50_ns;        /* run latency, to the histogram bucket */
+    uint64_t run_p99_ns;
+    uint64_t run_max_ns;
+    uint32_t run[SM_SCHED_HIST];/* run latency histogram */
+};
+
+/* told about a task that used up its quantum, see sm_sched_set_budget() */
+typedef void (*sm_task_overrun_func)(struct sm_task *task);
+
+struct sm_reactor;
+struct sm_sched {
+    struct sm_prio_queue ready[SM_SCHED_PRIOS];
+    uint32_t ready_mask;        /* bit per non empty ready[] */
+    struct cdll polling[SM_SCHED_PRIOS];
+    struct cdll deadline_polling; /* polling tasks with a deadline */
+    struct cdll blocked;
+    struct tmwheel wheel;       /* tasks waiting for their sm timer */
+    SM_TIMER_SIZE wheel_tick;   /* READ_GLOBAL_TICKS matching wheel.now */
+    unsigned long steps;        /* total sm_run_state() calls */
+    unsigned long deadline_misses; /* over all tasks */
+    SM_TIMER_SIZE max_late;     /* worst miss in ticks */
+    /*
+     * some task has a deadline or is above SM_PRIO_NORMAL, the pass looks
+     * for due timers between runs so they do not wait out the whole pass,
+     * and a polling deadline task is back in line after one other run
+     */
+    unsigned char urgent;
+    unsigned char measure;      /* keep pass stats */
+    unsigned int quantum;       /* steps per run, 0 for no limit */
+    uint64_t pass_ns;           /* wall budget per pass, 0 for none */
+    sm_task_overrun_func overrun;
+    struct sm_sched_pass_stats pass; /* last pass, when measuring */
+    struct sm_reactor *reactor; /* for fd waits, see smreactor.h, or NULL */
+    struct sm_task *remote;     /* woken by other threads, atomic access */
+    /* called by sm_sched_wake_remote() to get an idle thread going */
+    void (*kick)(struct sm_sched *sched);
+};
+
+#define cast_sm_to_task(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct sm_task, sm))
+
+void sm_sched_init(struct sm_sched *sched);
+void sm_task_init(struct sm_task *task, state_func *table,
+                  sm_task_exit_func exit_func);
+/*
+ * sm_task_set_prio - SM_PRIO_HIGHEST .. SM_PRIO_LOWEST, tasks start out
+ * SM_PRIO_NORMAL. May be called any time, also from the task's states.
+ */
+void sm_task_set_prio(struct sm_task *task, unsigned int prio);
+/*
+ * sm_task_set_deadline - make the task a deadline task, 0 for none
+ * ticks: SM_MS_TO_TICKS(ms). Each time the task gets runnable (is woken,
+ * its timer is done or it polls again) it is released with a due time this
+ * far ahead, and is run earliest due first within its priority. A run that
+ * ends past due counts a miss in task->misses and sched->deadline_misses.
+ * Keep it under half the SM_TIMER_SIZE range.
+ */
+void sm_task_set_deadline(struct sm_task *task, SM_TIMER_SIZE ticks);
+/*
+ * sm_sched_set_budget - limit how long machines and passes run
+ * quantum: most sm_run_state() calls per task run, 0 for no limit. A task
+ * using it up is counted in task->overruns and sched->pass.overruns,
+ * overrun (may be NULL) is called and the task continues next pass.
+ * pass_ns: wall time after which a pass stops starting tasks, 0 for none.
+ * The ready tasks left go first next pass.
+ */
+void sm_sched_set_budget(struct sm_sched *sched, unsigned int quantum,
+                         uint64_t pass_ns, sm_task_overrun_func overrun);
+/* a task's own quantum, 0 goes back to the scheduler's */
+void sm_task_set_quantum(struct sm_task *task, unsigned int quantum);
+/*
+ * sm_sched_measure - keep sched->pass stats of every pass, run latency
+ * percentiles need two clock reads per task run
+ */
+void sm_sched_measure(struct sm_sched *sched, int on);
+/* add an initialized task, it is runnable on the next pass */
+void sm_sched_add(struct sm_sched *sched, struct sm_task *task);
+/* take a task off its scheduler, it will not be stepped again */
+void sm_sched_remove(struct sm_task *task);
+
+/*
+ * sm_sched_block - park the calling machine
+ * sm: machine passed to the running state
+ *
+ * Call from a state that is about to return SM_RETURN_REPEAT because it is
+ * waiting for an event. The machine will not be stepped until somebody
+ * calls sm_sched_wake(). The _timer variant also wakes the machine when the
+ * sm timer (SM_SET_TIMER_MS) is done, so the state can notice the timeout.
+ */
+void sm_sched_block(struct state_machine *sm);
+void sm_sched_block_timer(struct state_machine *sm);
+/* make a parked task runnable, harmless if it is not parked */
+void sm_sched_wake(struct sm_task *task);
+/*
+ * sm_sched_wake_remote - sm_sched_wake() from any thread
+ * Lock free, the task goes on the scheduler's remote list and is woken at
+ * the start of the next pass. The first wake after a pass calls the
+ * scheduler's kick, a reactor attached to it gets its epoll_wait() kicked.
+ * Not for tasks of the executor, use sm_exec_wake() there.
+ */
+void sm_sched_wake_remote(struct sm_task *task);
+
+/*
+ * sm_sched_run_until_blocked - step every runnable machine
+ *
+ * Moves due timers to ready, gives each polling machine one more try and
+ * then runs ready machines (each until it repeats, jumps or exits, same as
+ * the classic do/while mainloop, or for a quantum) until none are left or
+ * the pass's wall budget is used up. Machines woken during the pass are
+ * run in the same pass, in priority order. Once there are urgent tasks,
+ * timers coming due during the pass are too.
+ * returns number of sm_run_state() calls made, 0 means everything is parked
+ */
+unsigned long sm_sched_run_until_blocked(struct sm_sched *sched);
+
+/* returns non zero if some machine may still make progress without waiting */
+int sm_sched_runnable(struct sm_sched *sched);
+
+/* sm_sched_next_timer() value when no machine waits on a timer */
+#define SM_SCHED_NO_TIMER   TMW_NO_TIMER
+/*
+ * sm_sched_next_timer - ticks from READ_GLOBAL_TICKS until the next pass has
+ * timer work to do, 0 if that is now. Never later than the earliest parked
+ * timer, so a mainloop with nothing runnable may sleep this long.
+ */
+uint32_t sm_sched_next_timer(struct sm_sched *sched);
+
+/*
+ * The pieces sm_sched_run_until_blocked() is made of, for executors that
+ * need to drop a lock while a machine runs. A popped task is RUNNING and on
+ * no queue, so nobody else can pop or steal it until it is filed again.
+ */
+/* move remote wakes, due timers and last pass's polling tasks to ready */
+void sm_sched_begin_pass(struct sm_sched *sched);
+/*
+ * non zero if a pass should begin before the next pop: nothing is ready,
+ * remote wakes wait or the tick moved on (timers, polling tasks)
+ */
+int sm_sched_pass_due(struct sm_sched *sched);
+/* next ready task or NULL, highest priority, earliest deadline */
+struct sm_task *sm_sched_pop(struct sm_sched *sched);
+/*
+ * pop from the cold end (lowest priority) of another scheduler, task now
+ * belongs to thief
+ */
+struct sm_task *sm_sched_steal(struct sm_sched *sched, struct sm_sched *thief);
+/*
+ * step a popped task like the classic mainloop, up to its quantum, adds
+ * steps made to *steps
+ */
+int sm_task_run(struct sm_task *task, unsigned long *steps);
+/* put a task that just ran on the right queue, ret from sm_task_run() */
+void sm_sched_file(struct sm_sched *sched, struct sm_task *task, int ret);
+
+#endif //__SMSCHED_H__
@@ -0,0 +1,504 @@
+/**********************************************************************
+ *
+ * Filename:    smshm.c
+ *
+ * Description: shared memory message link between the machines of two
+ *              processes.
+ *
+ * Notes:       Linux only, uses memfd, eventfd and GCC atomics.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memfd_create */
+#endif
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "smshm.h"
+
+#define SM_SHM_MAGIC    "SMSHM01"
+#define SM_SHM_PAGE     4096
+
+/* name states */
+#define SM_SHM_FREE     0
+#define SM_SHM_CLAIMED  1       /* being filled in */
+#define SM_SHM_BOUND    2
+#define SM_SHM_NAMED    3       /* filled in, looking for a twin */
+
+/* ring buffers start on the first page after the segment header */
+#define SM_SHM_RINGS_AT ((sizeof(struct sm_shm_seg) + SM_SHM_PAGE - 1) & \
+                         ~(size_t)(SM_SHM_PAGE - 1))
+
+static void sm_shm_reset(struct sm_shm *shm)
+{
+    memset(shm, 0, sizeof(*shm));
+    shm->fd = -1;
+    shm->doorbell[0] = -1;
+    shm->doorbell[1] = -1;
+    shm->peer = -1;
+    shm->watch.fd = -1;
+}
+
+static int sm_shm_map(struct sm_shm *shm, size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+
+    if (p == MAP_FAILED)
+        return -1;
+    shm->seg = p;
+    shm->map_size = size;
+    return 0;
+}
+
+int sm_shm_create(struct sm_shm *shm, size_t ring_size)
+{
+    size_t size = SM_SHM_RINGS_AT + 2 * ring_size;
+    struct sm_shm_seg *seg;
+    int p;
+
+    sm_shm_reset(shm);
+    if (ring_size < SM_RING_ALIGN || (ring_size & (ring_size - 1))) {
+        errno = EINVAL;
+        return -1;
+    }
+    shm->fd = memfd_create("smshm", MFD_CLOEXEC);
+    if (shm->fd < 0)
+        return -1;
+    /* a new memfd reads as zeros, every name is free */
+    if (ftruncate(shm->fd, size) < 0 || sm_shm_map(shm, size) < 0)
+        goto err;
+    seg = shm->seg;
+    seg->map_size = size;
+    seg->ring_size = ring_size;
+    for (p = 0; p < 2; p++) {
+        sm_ring_init_buf(&seg->side[p].ring,
+                         (uint8_t *)seg + SM_SHM_RINGS_AT + p * ring_size,
+                         ring_size);
+        shm->doorbell[p] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shm->doorbell[p] < 0)
+            goto err;
+    }
+    memcpy(seg->magic, SM_SHM_MAGIC, sizeof(seg->magic));
+    return 0;
+
+err:
+    sm_shm_close(shm);
+    return -1;
+}
+
+/* the memfd and both doorbells go as SCM_RIGHTS, the map size as data */
+int sm_shm_send(struct sm_shm *shm, int sock)
+{
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    int fds[3] = { shm->fd, shm->doorbell[0], shm->doorbell[1] };
+    uint64_t size = shm->map_size;
+    struct iovec iov = { &size, sizeof(size) };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    return sendmsg(sock, &msg, 0) == sizeof(size) ? 0 : -1;
+}
+
+/* close every fd a message we do not take brought along */
+static void sm_shm_close_rights(struct msghdr *msg)
+{
+    struct cmsghdr *cm;
+    size_t k, n;
+    int fd;
+
+    for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (k = 0; k < n; k++) {
+            memcpy(&fd, CMSG_DATA(cm) + k * sizeof(int), sizeof(fd));
+            close(fd);
+        }
+    }
+}
+
+int sm_shm_recv(struct sm_shm *shm, int sock)
+{
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    int fds[3];
+    uint64_t size;
+    struct iovec iov = { &size, sizeof(size) };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    ssize_t len;
+
+    sm_shm_reset(shm);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (len < 0)
+        return -1;
+    cm = CMSG_FIRSTHDR(&msg);
+    if (len != sizeof(size) || (msg.msg_flags & MSG_CTRUNC) || !cm ||
+        cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        sm_shm_close_rights(&msg);
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    shm->fd = fds[0];
+    shm->doorbell[0] = fds[1];
+    shm->doorbell[1] = fds[2];
+    if (sm_shm_map(shm, size) < 0)
+        goto err;
+    if (memcmp(shm->seg->magic, SM_SHM_MAGIC, sizeof(shm->seg->magic)) ||
+        shm->seg->map_size != size) {
+        errno = EPROTO;
+        goto err;
+    }
+    return 0;
+
+err:
+    sm_shm_close(shm);
+    return -1;
+}
+
+int sm_shm_join(struct sm_shm *shm, int peer, struct sm_reactor *reactor)
+{
+    shm->peer = peer;
+    shm->in = &shm->seg->side[peer].ring;
+    shm->out = &shm->seg->side[!peer].ring;
+    shm->reactor = reactor;
+    shm->watch.fd = shm->doorbell[peer];
+    shm->watch.events = EPOLLIN;
+    shm->watch.task = NULL; /* it only has to end the wait */
+    shm->one_cpu = sysconf(_SC_NPROCESSORS_ONLN) < 2;
+    return sm_reactor_add(reactor, &shm->watch);
+}
+
+void sm_shm_close(struct sm_shm *shm)
+{
+    int err = errno;
+
+    if (shm->reactor)
+        sm_reactor_del(shm->reactor, &shm->watch);
+    if (shm->seg)
+        munmap(shm->seg, shm->map_size);
+    if (shm->fd >= 0)
+        close(shm->fd);
+    if (shm->doorbell[0] >= 0)
+        close(shm->doorbell[0]);
+    if (shm->doorbell[1] >= 0)
+        close(shm->doorbell[1]);
+    sm_shm_reset(shm);
+    errno = err;
+}
+
+int sm_shm_task_init(struct sm_shm_task *st, size_t inbox_size,
+                     state_func *table, sm_task_exit_func exit_func)
+{
+    sm_task_init(&st->task, table, exit_func);
+    st->id = SM_SHM_NOBODY;
+    st->waiting = 0;
+    return sm_ring_init(&st->inbox, inbox_size);
+}
+
+void sm_shm_task_destroy(struct sm_shm_task *st)
+{
+    sm_ring_destroy(&st->inbox);
+}
+
+/*
+ * another slot that has name and goes before slot i
+ * Both binders of a name publish it (NAMED) before they look, so at least
+ * one sees the other. A BOUND twin or a NAMED one in a lower slot wins. A
+ * NAMED one in a higher slot either sees us and backs off or binds, wait
+ * for which.
+ */
+static int sm_shm_taken(struct sm_shm *shm, uint32_t i, const char *name)
+{
+    uint32_t j, state;
+
+    for (j = 0; j < SM_SHM_NAMES; j++) {
+        struct sm_shm_name *n = &shm->seg->names[j];
+
+        if (j == i)
+            continue;
+        for (;;) {
+            state = __atomic_load_n(&n->state, __ATOMIC_SEQ_CST);
+            if ((state != SM_SHM_NAMED && state != SM_SHM_BOUND) ||
+                strncmp(n->name, name, SM_SHM_NAME_LEN))
+                break;
+            if (state == SM_SHM_BOUND || j < i)
+                return 1;
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+int sm_shm_bind(struct sm_shm *shm, const char *name,
+                struct sm_shm_task *st)
+{
+    uint32_t i;
+
+    if (strlen(name) >= SM_SHM_NAME_LEN || sm_shm_lookup(shm, name) >= 0)
+        return -1;
+    for (i = 0; i < SM_SHM_NAMES; i++) {
+        struct sm_shm_name *n = &shm->seg->names[i];
+        uint32_t state = SM_SHM_FREE;
+
+        if (!__atomic_compare_exchange_n(&n->state, &state, SM_SHM_CLAIMED,
+                                         0, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED))
+            continue;
+        strcpy(n->name, name);
+        n->peer = shm->peer;
+        __atomic_store_n(&n->state, SM_SHM_NAMED, __ATOMIC_SEQ_CST);
+        if (sm_shm_taken(shm, i, name)) {
+            /* the other process binding it at the same time won */
+            __atomic_store_n(&n->state, SM_SHM_FREE, __ATOMIC_RELEASE);
+            return -1;
+        }
+        shm->bound[i] = st;
+        st->id = i;
+        __atomic_store_n(&n->state, SM_SHM_BOUND, __ATOMIC_RELEASE);
+        return i;
+    }
+    return -1;
+}
+
+int sm_shm_lookup(struct sm_shm *shm, const char *name)
+{
+    int i;
+
+    for (i = 0; i < SM_SHM_NAMES; i++) {
+        struct sm_shm_name *n = &shm->seg->names[i];
+
+        if (__atomic_load_n(&n->state, __ATOMIC_ACQUIRE) == SM_SHM_BOUND &&
+            !strncmp(n->name, name, SM_SHM_NAME_LEN))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * The peer sets its asleep, then looks at the ring. We publish the message,
+ * then look at asleep. With a full fence on both sides at least one of us
+ * sees the other, a message never sits in the ring of a sleeping peer.
+ */
+static void sm_shm_ring(struct sm_shm *shm)
+{
+    uint32_t *asleep = &shm->seg->side[!shm->peer].asleep;
+    uint64_t one = 1;
+
+    shm->dirty = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    /* read first, a busy peer's line is not written at all */
+    if (!__atomic_load_n(asleep, __ATOMIC_RELAXED) ||
+        !__atomic_exchange_n(asleep, 0, __ATOMIC_ACQ_REL))
+        return;
+    if (write(shm->doorbell[!shm->peer], &one, sizeof(one)) == sizeof(one))
+        shm->doorbells++;
+}
+
+void sm_shm_flush(struct sm_shm *shm)
+{
+    if (shm->dirty)
+        sm_shm_ring(shm);
+}
+
+struct sm_shm_msg *sm_shm_reserve(struct sm_shm *shm, uint32_t to,
+                                  uint32_t from, size_t len)
+{
+    struct sm_shm_msg *msg;
+
+    if (to >= SM_SHM_NAMES ||
+        __atomic_load_n(&shm->seg->names[to].state, __ATOMIC_ACQUIRE) !=
+        SM_SHM_BOUND)
+        return NULL;
+    if (shm->seg->names[to].peer == (uint32_t)shm->peer) {
+        shm->resv_task = shm->bound[to];
+        shm->resv_ring = &shm->resv_task->inbox;
+    } else {
+        shm->resv_task = NULL;
+        shm->resv_ring = shm->out;
+    }
+    msg = sm_ring_rec_reserve(shm->resv_ring, sizeof(*msg) + len);
+    if (!msg) {
+        if (!shm->resv_task && len <= SM_RING_REC_MAX(shm->out))
+            sm_shm_ring(shm); /* full, get the peer emptying it now */
+        return NULL;
+    }
+    msg->to = to;
+    msg->from = from;
+    return msg;
+}
+
+void sm_shm_commit(struct sm_shm *shm, size_t len)
+{
+    sm_ring_rec_commit(shm->resv_ring, sizeof(struct sm_shm_msg) + len);
+    shm->posts++;
+    if (shm->resv_task)
+        sm_sched_wake(&shm->resv_task->task);
+    else
+        shm->dirty = 1;
+}
+
+int sm_shm_post(struct sm_shm *shm, uint32_t to, uint32_t from,
+                const void *data, size_t len)
+{
+    struct sm_shm_msg *msg = sm_shm_reserve(shm, to, from, len);
+
+    if (!msg)
+        return -1;
+    memcpy(msg->data, data, len);
+    sm_shm_commit(shm, len);
+    return 0;
+}
+
+/*
+ * Messages are delivered in order. One for a full inbox stops the pump,
+ * the ones behind it wait too until that machine has taken some.
+ */
+unsigned long sm_shm_pump(struct sm_shm *shm)
+{
+    const struct sm_shm_msg *msg;
+    unsigned long n = 0;
+    size_t len;
+
+    shm->stalled = 0;
+    while ((msg = sm_ring_rec_peek(shm->in, &len))) {
+        struct sm_shm_task *st = msg->to < SM_SHM_NAMES ? shm->bound[msg->to]
+                                                        : NULL;
+
+        if (!st || len > SM_RING_REC_MAX(&st->inbox)) {
+            shm->dropped++;
+        } else if (sm_ring_rec_put(&st->inbox, msg, len) < 0) {
+            shm->stalled = 1;
+            break;
+        } else {
+            sm_sched_wake(&st->task);
+            n++;
+        }
+        sm_ring_rec_release(shm->in);
+    }
+    shm->delivered += n;
+    return n;
+}
+
+static uint64_t sm_shm_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* poll the ring a while before paying for a sleep and the peer's doorbell */
+static unsigned long sm_shm_spin(struct sm_shm *shm)
+{
+    uint64_t end = sm_shm_ns() + shm->spin_us * 1000ULL;
+
+    do {
+        if (sm_ring_used(shm->in))
+            return sm_shm_pump(shm);
+    } while (sm_shm_ns() < end);
+    return 0;
+}
+
+int sm_shm_idle(struct sm_shm *shm, struct sm_reactor *reactor,
+                struct sm_sched *sched)
+{
+    uint32_t *asleep = &shm->seg->side[shm->peer].asleep;
+    uint64_t count;
+    int n;
+
+    sm_shm_flush(shm);
+    sm_shm_pump(shm);
+    if (!sm_sched_runnable(sched) && !shm->stalled) {
+        if (shm->spin_us && !shm->one_cpu && sm_shm_spin(shm))
+            return 0;
+        __atomic_store_n(asleep, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (sm_ring_used(shm->in)) {
+            /* came in while we were deciding, no need to be rung */
+            __atomic_store_n(asleep, 0, __ATOMIC_RELAXED);
+            sm_shm_pump(shm);
+            return 0;
+        }
+        shm->sleeps++;
+    }
+    n = sm_reactor_idle(reactor, sched);
+    __atomic_store_n(asleep, 0, __ATOMIC_RELAXED);
+    if (shm->watch.revents) {
+        shm->watch.revents = 0;
+        if (read(shm->watch.fd, &count, sizeof(count)) < 0)
+            count = 0;
+    }
+    sm_shm_pump(shm);
+    return n;
+}
+
+const struct sm_shm_msg *sm_shm_peek(struct sm_shm_task *st, size_t *len)
+{
+    const struct sm_shm_msg *msg = sm_ring_rec_peek(&st->inbox, len);
+
+    if (msg)
+        *len -= sizeof(*msg);
+    return msg;
+}
+
+void sm_shm_release(struct sm_shm_task *st)
+{
+    sm_ring_rec_release(&st->inbox);
+}
+
+/*
+ * state machine function for SM_WAIT_SHM, the timeout ticks follow in the
+ * table
+ */
+int sm_wait_shm_state(struct state_machine *sm)
+{
+    struct sm_shm_task *st = cast_sm_to_shm_task(sm);
+
+    if (!st->waiting) {
+        SM_START_TIMER(sm, SM_TABLE_OPERAND(sm->stateptrptr + 1));
+        st->waiting = 1;
+    }
+    if (sm_ring_used(&st->inbox)) {
+        st->waiting = 0;
+        return SM_WAIT_SHM_SLOTS + SM_RETURN_SKIP_JUMP_SIZE;
+    }
+    if (SM_IS_TIMER_DONE(sm)) {
+        st->waiting = 0;
+        return SM_WAIT_SHM_SLOTS;
+    }
+    sm_sched_block_timer(sm);
+    return SM_RETURN_REPEAT;
+}
@@ -0,0 +1,203 @@
+/**********************************************************************
+ *
+ * Filename:    smshm.h
+ *
+ * Description: shared memory message link between the machines of two
+ *              processes.
+ *
+ * Notes:       Linux only, uses memfd, eventfd and GCC atomics.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMSHM_H__
+#define __SMSHM_H__
+#include <stdint.h>
+#include "smreactor.h"
+#include "smring.h"
+
+/*
+ * A link is one memfd segment shared by two processes, peer 0 and peer 1.
+ * It holds a lock free record ring per direction, and a table of names.
+ * Each peer has an eventfd doorbell the other side rings to wake it.
+ *
+ * A machine that takes messages is a struct sm_shm_task, bound to a name
+ * with sm_shm_bind(). Any machine in either process finds it with
+ * sm_shm_lookup() and posts to the id it returns. A post to the other
+ * process is a copy into the shared ring, no syscall. The receiver's
+ * mainloop copies it into the target's inbox and wakes the target. A post
+ * to a machine of the same process goes straight to its inbox.
+ *
+ * Doorbells are batched. Posts only mark the link, sm_shm_flush() rings
+ * the peer at most once for everything posted since the last flush. It
+ * rings only if the peer said it is going to sleep, a busy peer finds the
+ * messages on its next pass without ever being rung. sm_shm_idle() flushes
+ * once per pass. It replaces sm_reactor_idle() in the mainloop:
+ *
+ *      while (1) {
+ *          sm_sched_run_until_blocked(&sched);
+ *          sm_shm_idle(&link, &reactor, &sched);
+ *      }
+ *
+ * Setting up: one process sm_shm_create()s the link. A forked child
+ * inherits it, an unrelated process gets it with sm_shm_send() and
+ * sm_shm_recv() over a unix socket. Then each side calls sm_shm_join()
+ * with its own peer number, after it has its reactor.
+ */
+#ifndef SM_SHM_NAMES
+#define SM_SHM_NAMES        64  /* named machines per link */
+#endif
+#define SM_SHM_NAME_LEN     32  /* including the 0 */
+#define SM_SHM_NOBODY       ((uint32_t)-1) /* from of an anonymous post */
+
+/* a message as it sits in the rings and the inbox */
+struct sm_shm_msg {
+    uint32_t to;                /* id of the receiving machine */
+    uint32_t from;              /* id to reply to, or SM_SHM_NOBODY */
+    uint8_t data[];
+};
+
+/* a name in the segment, state goes free, claimed, bound */
+struct sm_shm_name {
+    uint32_t state;
+    uint32_t peer;              /* process the machine lives in */
+    char name[SM_SHM_NAME_LEN];
+};
+
+/* what peer p receives, the ring's buffer follows the segment */
+struct sm_shm_side {
+    uint32_t asleep __attribute__((aligned(SM_RING_ALIGN)));
+    struct sm_ring ring;
+};
+
+/* the start of the shared segment */
+struct sm_shm_seg {
+    char magic[8];
+    uint64_t map_size;
+    uint64_t ring_size;
+    struct sm_shm_name names[SM_SHM_NAMES];
+    struct sm_shm_side side[2];
+};
+
+struct sm_shm_task;
+
+/* one process's end of a link */
+struct sm_shm {
+    struct sm_shm_seg *seg;
+    size_t map_size;
+    int fd;                     /* the memfd */
+    int doorbell[2];            /* eventfds, doorbell[p] wakes peer p */
+    int peer;                   /* own peer number, -1 until joined */
+    struct sm_ring *in;         /* what the other side posts to us */
+    struct sm_ring *out;
+    struct sm_reactor *reactor;
+    struct sm_fd_watch watch;   /* own doorbell */
+    struct sm_shm_task *bound[SM_SHM_NAMES]; /* own machines by id */
+    struct sm_ring *resv_ring;  /* where sm_shm_commit() commits */
+    struct sm_shm_task *resv_task; /* the target if it is one of ours */
+    unsigned char dirty;        /* posted since the last flush */
+    unsigned char stalled;      /* a target's inbox is full */
+    unsigned int spin_us;       /* poll the ring this long before sleeping */
+    unsigned char one_cpu;      /* spinning would only starve the peer */
+    unsigned long posts;
+    unsigned long doorbells;    /* eventfd writes */
+    unsigned long delivered;    /* messages moved to inboxes */
+    unsigned long dropped;      /* to an id not bound here */
+    unsigned long sleeps;       /* idles that told the peer to ring */
+};
+
+/*
+ * A machine taking messages. They arrive in its inbox, a record ring
+ * only its own states read (see sm_shm_peek()).
+ */
+struct sm_shm_task {
+    struct sm_task task;
+    struct sm_ring inbox;
+    uint32_t id;                /* SM_SHM_NOBODY until bound */
+    unsigned char waiting;      /* inside SM_WAIT_SHM, timer started */
+};
+
+#define cast_sm_to_shm_task(psm) (cast_p_to_outer( \
+            struct state_machine *, psm, \
+            struct sm_shm_task, task.sm))
+
+/*
+ * sm_shm_create - make a link with rings of ring_size bytes, a power of 2
+ * sm_shm_send() passes it to the process at the other end of a unix
+ * socket, which sm_shm_recv()s it. All return 0 or -1 with errno set.
+ */
+int sm_shm_create(struct sm_shm *shm, size_t ring_size);
+int sm_shm_send(struct sm_shm *shm, int sock);
+int sm_shm_recv(struct sm_shm *shm, int sock);
+/* take side peer (0 or 1) and watch its doorbell, returns 0 or -1 */
+int sm_shm_join(struct sm_shm *shm, int peer, struct sm_reactor *reactor);
+void sm_shm_close(struct sm_shm *shm);
+
+/* like sm_task_init(), inbox_size is a power of 2, returns 0 or -1 */
+int sm_shm_task_init(struct sm_shm_task *st, size_t inbox_size,
+                     state_func *table, sm_task_exit_func exit_func);
+void sm_shm_task_destroy(struct sm_shm_task *st);
+
+/*
+ * give st a name, returns its id or -1 if taken or the table is full
+ * Of two processes binding one name at the same time, one gets it.
+ */
+int sm_shm_bind(struct sm_shm *shm, const char *name,
+                struct sm_shm_task *st);
+/* id of a bound name or -1, in either process */
+int sm_shm_lookup(struct sm_shm *shm, const char *name);
+
+/*
+ * sm_shm_post - send len bytes to machine id, from is the id to reply to
+ * or SM_SHM_NOBODY. The copy goes out on the next flush.
+ * returns 0, or -1 when the ring (or inbox) is full, the message too big
+ * or id unknown. A full ring is rung at once, retry on a later step.
+ * The zero copy form reserves the message in the ring (NULL as -1 above),
+ * the caller fills data and commits, len may shrink.
+ */
+int sm_shm_post(struct sm_shm *shm, uint32_t to, uint32_t from,
+                const void *data, size_t len);
+struct sm_shm_msg *sm_shm_reserve(struct sm_shm *shm, uint32_t to,
+                                  uint32_t from, size_t len);
+void sm_shm_commit(struct sm_shm *shm, size_t len);
+
+/* ring the peer if anything was posted and it sleeps */
+void sm_shm_flush(struct sm_shm *shm);
+/* move incoming messages to their machines' inboxes, returns how many */
+unsigned long sm_shm_pump(struct sm_shm *shm);
+/*
+ * sm_shm_idle - sm_reactor_idle() for a process on a link
+ * Flushes and pumps, tells the peer to ring when about to sleep.
+ * returns what sm_reactor_idle() returned
+ */
+int sm_shm_idle(struct sm_shm *shm, struct sm_reactor *reactor,
+                struct sm_sched *sched);
+
+/* owner's states: oldest message and its data length, NULL if none */
+const struct sm_shm_msg *sm_shm_peek(struct sm_shm_task *st, size_t *len);
+void sm_shm_release(struct sm_shm_task *st);
+
+/*
+ * SM_WAIT_SHM - table entry waiting for a message or a timeout
+ * ms: timeout, uses the sm timer like SM_DELAY_MS
+ *
+ * Continues like a state returning SM_RETURN_DONE on timeout and
+ * SM_RETURN_SKIP_JUMP when the inbox has a message, like SM_WAIT_MSG:
+ *
+ *      SM_WAIT_SHM(5000),
+ *      SM_JUMP(timed_out_table),
+ *      handle_msg_state,
+ *
+ * The machine must be a struct sm_shm_task on a scheduler.
+ */
+#define SM_WAIT_SHM(ms) (sm_wait_shm_state), \
+                        (state_func)(uintptr_t)(SM_MS_TO_TICKS(ms))
+/* table slots taken by SM_WAIT_SHM, a timeout returns this */
+#define SM_WAIT_SHM_SLOTS 2
+
+int sm_wait_shm_state(struct state_machine *sm);
+
+#endif //__SMSHM_H__
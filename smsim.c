@@ -0,0 +1,91 @@
+/**********************************************************************
+ *
+ * Filename:    smsim.c
+ *
+ * Description: discrete event simulation of a fleet on a virtual clock.
+ *
+ * Notes:       Everything must be built with -DSM_SIMULATION.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include "smsim.h"
+
+void sm_sim_init(struct sm_sim *sim, uint64_t seed)
+{
+    sm_sched_init(&sim->sched);
+    sim->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+    if (!sim->rng)
+        sim->rng = 1;
+    sim->start = sm_sim_now;
+    sim->passes = 0;
+    sim->jumps = 0;
+    sim->burst = 0;
+    sim->burst_tick = 0;
+}
+
+/* xorshift64*, plenty for picking delays and orders */
+uint32_t sm_sim_random(struct sm_sim *sim)
+{
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return (sim->rng * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+void sm_sim_add_all(struct sm_sim *sim, struct sm_task **tasks, size_t n)
+{
+    size_t i;
+
+    for (i = n; i > 1; i--) {
+        size_t j = ((uint64_t)sm_sim_random(sim) << 32 |
+                    sm_sim_random(sim)) % i;
+        struct sm_task *t = tasks[i - 1];
+
+        tasks[i - 1] = tasks[j];
+        tasks[j] = t;
+    }
+    for (i = 0; i < n; i++)
+        sm_sched_add(&sim->sched, tasks[i]);
+}
+
+unsigned long sm_sim_run(struct sm_sim *sim, uint64_t ticks)
+{
+    uint64_t end = sm_sim_now + ticks;
+    unsigned long steps = 0, at_tick = 0;
+
+    if (end < sm_sim_now)
+        end = UINT64_MAX;
+    for (;;) {
+        unsigned long n = sm_sched_run_until_blocked(&sim->sched);
+        uint32_t next;
+
+        sim->passes++;
+        steps += n;
+        at_tick += n;
+        if (at_tick > sim->burst) {
+            sim->burst = at_tick;
+            sim->burst_tick = sm_sim_elapsed(sim);
+        }
+        next = sm_sched_next_timer(&sim->sched);
+        if (sm_sched_runnable(&sim->sched)) {
+            if (next > SM_SIM_POLL_TICKS)
+                next = SM_SIM_POLL_TICKS;
+        } else if (next == SM_SCHED_NO_TIMER) {
+            break; /* all blocked or exited, nothing will ever happen */
+        }
+        if (!next)
+            continue;
+        if (end - sm_sim_now < next) {
+            sm_sim_now = end;
+            break;
+        }
+        sm_sim_now += next;
+        sim->jumps++;
+        at_tick = 0;
+    }
+    return steps;
+}
@@ -0,0 +1,86 @@
+/**********************************************************************
+ *
+ * Filename:    smsim.h
+ *
+ * Description: discrete event simulation of a fleet on a virtual clock.
+ *
+ * Notes:       Everything must be built with -DSM_SIMULATION.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMSIM_H__
+#define __SMSIM_H__
+#include <stdint.h>
+#include "states.h"
+#include "smsched.h"
+
+#ifndef SM_SIMULATION
+#error "smsim needs states.c, getms.c etc built with -DSM_SIMULATION"
+#endif
+
+/*
+ * The simulator runs an ordinary sm_sched, only the clock is virtual. It
+ * runs passes until nothing is ready, then moves sm_sim_now straight to the
+ * next timer on the wheel. Waiting costs no wall time, an hour of timeouts
+ * takes as long as the states it runs.
+ *
+ * A pass takes no virtual time. Polling machines (returning REPEAT without
+ * parking) would stop the clock, so while any poll the clock moves on
+ * SM_SIM_POLL_TICKS per pass.
+ *
+ * Runs are repeatable: the scheduler is deterministic for a given order of
+ * sm_sched_add() calls, sm_sim_add_all() makes that order a seeded shuffle,
+ * and states that need randomness take it from sm_sim_random(). Same seed,
+ * same run, tick for tick.
+ *
+ * Use SM_TIMER_SIZE uint32_t or wider for delays over 65 s at 1 kHz.
+ */
+#ifndef SM_SIM_POLL_TICKS
+#define SM_SIM_POLL_TICKS   1
+#endif
+
+struct sm_sim {
+    struct sm_sched sched;
+    uint64_t rng;               /* xorshift state, never 0 */
+    uint64_t start;             /* sm_sim_now at sm_sim_init() */
+    unsigned long passes;
+    unsigned long jumps;        /* times the clock skipped ahead */
+    unsigned long burst;        /* most steps run at one tick, timer storms */
+    uint64_t burst_tick;        /* when */
+};
+
+#define cast_sched_to_sim(ps) (cast_p_to_outer( \
+            struct sm_sched *, ps, \
+            struct sm_sim, sched))
+
+/* the simulation a state's machine runs in */
+static inline struct sm_sim *sm_sim_of(struct state_machine *sm)
+{
+    return cast_sched_to_sim(cast_sm_to_task(sm)->sched);
+}
+
+/* set up the scheduler and random numbers, the clock keeps its value */
+void sm_sim_init(struct sm_sim *sim, uint64_t seed);
+/* next deterministic random number */
+uint32_t sm_sim_random(struct sm_sim *sim);
+/* add tasks in a seeded random order, the tasks array gets shuffled */
+void sm_sim_add_all(struct sm_sim *sim, struct sm_task **tasks, size_t n);
+
+/*
+ * sm_sim_run - run the simulation for up to ticks of virtual time
+ * Stops early if no machine is runnable or waiting on a timer.
+ * returns sm_run_state() calls made
+ */
+unsigned long sm_sim_run(struct sm_sim *sim, uint64_t ticks);
+
+/* virtual ticks since sm_sim_init() */
+static inline uint64_t sm_sim_elapsed(struct sm_sim *sim)
+{
+    return sm_sim_now - sim->start;
+}
+
+#endif //__SMSIM_H__
@@ -0,0 +1,380 @@
+/**********************************************************************
+ *
+ * Filename:    smsnap.c
+ *
+ * Description: snapshot and restore of machine fleets in a mapped file.
+ *
+ * Notes:       Needs Posix mmap.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "smsnap.h"
+
+/* keep the compiler from moving record stores across the sequence */
+#define sm_snap_barrier() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+static uint64_t sm_snap_wall_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct sm_snap_rec *sm_snap_rec(struct sm_snap *snap, size_t i)
+{
+    return (struct sm_snap_rec *)(snap->map + sizeof(struct sm_snap_hdr) +
+                                  i * snap->rec_size);
+}
+
+static int sm_snap_cmp(const void *a, const void *b)
+{
+    const struct sm_snap_range *ra = a, *rb = b;
+
+    return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+/* table id holding pc, or -1 */
+static long sm_snap_find(struct sm_snap *snap, state_func *pc)
+{
+    const struct sm_snap_range *r = &snap->by_addr[snap->last];
+    unsigned int lo = 0, hi = snap->ntables;
+
+    if (snap->ntables && pc >= r->lo && pc < r->hi)
+        return r->id;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+
+        r = &snap->by_addr[mid];
+        if (pc < r->lo) {
+            hi = mid;
+        } else if (pc >= r->hi) {
+            lo = mid + 1;
+        } else {
+            snap->last = mid;
+            return r->id;
+        }
+    }
+    return -1;
+}
+
+/* FNV-1a over what the tables look like, not where they are */
+static uint64_t sm_snap_hash(uint64_t h, uint64_t v)
+{
+    unsigned int b;
+
+    for (b = 0; b < 8; b++, v >>= 8) {
+        h ^= v & 0xff;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t sm_snap_layout(struct sm_snap *snap)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned int t;
+    size_t s;
+
+    h = sm_snap_hash(h, snap->ntables);
+    for (t = 0; t < snap->ntables; t++) {
+        state_func *table = snap->tables[t].table;
+        size_t nslots = snap->tables[t].nslots;
+
+        h = sm_snap_hash(h, nslots);
+        for (s = 0; s < nslots; s++) {
+            state_func f = table[s];
+
+            if (!f) {
+                h = sm_snap_hash(h, 0);
+            } else if (f == sm_wait_ticks_state) {
+                h = sm_snap_hash(h, 2);
+            } else if (f == sm_delay_ticks_state && s + 1 < nslots) {
+                h = sm_snap_hash(h, 1);
+                h = sm_snap_hash(h, SM_TABLE_OPERAND(&table[++s]));
+            } else if (f == sm_jump_table_state && s + 1 < nslots) {
+                state_func *target = (state_func *)table[++s];
+                long id = sm_snap_find(snap, target);
+
+                h = sm_snap_hash(h, 3);
+                h = sm_snap_hash(h, id);
+                if (id >= 0)
+                    h = sm_snap_hash(h, target - snap->tables[id].table);
+            } else {
+                h = sm_snap_hash(h, 4); /* a user state */
+            }
+        }
+    }
+    return h;
+}
+
+int sm_snap_open(struct sm_snap *snap, const char *path,
+                 const struct sm_snap_table *tables, unsigned int ntables,
+                 size_t count, size_t ctx_size)
+{
+    struct stat st;
+    uint64_t layout;
+    unsigned int t;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->fd = -1;
+    snap->tables = tables;
+    snap->ntables = ntables;
+    snap->count = count;
+    snap->ctx_size = ctx_size;
+    snap->rec_size = (sizeof(struct sm_snap_rec) + ctx_size + 7) & ~7UL;
+    snap->map_size = sizeof(struct sm_snap_hdr) + count * snap->rec_size;
+    snap->by_addr = malloc((ntables + 1) * sizeof(*snap->by_addr));
+    if (!snap->by_addr)
+        return -1;
+    for (t = 0; t < ntables; t++) {
+        snap->by_addr[t].lo = tables[t].table;
+        snap->by_addr[t].hi = tables[t].table + tables[t].nslots;
+        snap->by_addr[t].id = t;
+    }
+    qsort(snap->by_addr, ntables, sizeof(*snap->by_addr), sm_snap_cmp);
+    layout = sm_snap_layout(snap);
+
+    snap->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (snap->fd < 0 || fstat(snap->fd, &st) < 0)
+        goto err;
+    if ((size_t)st.st_size != snap->map_size &&
+        (ftruncate(snap->fd, 0) < 0 ||
+         ftruncate(snap->fd, snap->map_size) < 0))
+        goto err;
+    snap->map = mmap(NULL, snap->map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, snap->fd, 0);
+    if (snap->map == MAP_FAILED) {
+        snap->map = NULL;
+        goto err;
+    }
+    snap->hdr = (struct sm_snap_hdr *)snap->map;
+    if ((size_t)st.st_size == snap->map_size &&
+        !memcmp(snap->hdr->magic, SM_SNAP_MAGIC, sizeof(snap->hdr->magic)) &&
+        snap->hdr->rec_size == snap->rec_size &&
+        snap->hdr->timer_size == sizeof(SM_TIMER_SIZE) &&
+        snap->hdr->count == count && snap->hdr->ctx_size == ctx_size &&
+        snap->hdr->layout == layout)
+        return 1;
+
+    /* new, or not ours to restore: start over with no records */
+    if ((size_t)st.st_size == snap->map_size) {
+        munmap(snap->map, snap->map_size);
+        snap->map = NULL;
+        if (ftruncate(snap->fd, 0) < 0 ||
+            ftruncate(snap->fd, snap->map_size) < 0)
+            goto err;
+        snap->map = mmap(NULL, snap->map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, snap->fd, 0);
+        if (snap->map == MAP_FAILED) {
+            snap->map = NULL;
+            goto err;
+        }
+        snap->hdr = (struct sm_snap_hdr *)snap->map;
+    }
+    snap->hdr->rec_size = snap->rec_size;
+    snap->hdr->timer_size = sizeof(SM_TIMER_SIZE);
+    snap->hdr->count = count;
+    snap->hdr->ctx_size = ctx_size;
+    snap->hdr->layout = layout;
+    sm_snap_barrier();
+    memcpy(snap->hdr->magic, SM_SNAP_MAGIC, sizeof(snap->hdr->magic));
+    return 0;
+
+err:
+    t = errno;
+    sm_snap_close(snap);
+    errno = t;
+    return -1;
+}
+
+void sm_snap_close(struct sm_snap *snap)
+{
+    if (snap->map)
+        munmap(snap->map, snap->map_size);
+    if (snap->fd >= 0)
+        close(snap->fd);
+    free(snap->by_addr);
+    snap->map = NULL;
+    snap->hdr = NULL;
+    snap->fd = -1;
+    snap->by_addr = NULL;
+}
+
+int sm_snap_sync(struct sm_snap *snap, int wait)
+{
+    return msync(snap->map, snap->map_size, wait ? MS_SYNC : MS_ASYNC);
+}
+
+static int sm_snap_write(struct sm_snap *snap, size_t i, state_func *pc,
+                         SM_TIMER_SIZE start_timer, SM_TIMER_SIZE delay,
+                         const void *ctx, SM_TIMER_SIZE now, uint64_t wall)
+{
+    struct sm_snap_rec *rec = sm_snap_rec(snap, i);
+    SM_TIMER_SIZE elapsed = now - start_timer;
+    uint32_t table = SM_SNAP_STOPPED, offset = 0;
+    uint32_t seq = rec->seq;
+
+    if (pc) {
+        long id = sm_snap_find(snap, pc);
+
+        if (id < 0)
+            return -1;
+        table = id + 1;
+        offset = pc - snap->tables[id].table;
+    }
+    if (elapsed > delay)
+        elapsed = delay;
+    rec->seq = seq | 1;
+    sm_snap_barrier();
+    rec->table = table;
+    rec->offset = offset;
+    rec->delay = delay;
+    rec->elapsed = elapsed;
+    rec->wall_ms = wall;
+    if (ctx)
+        memcpy(rec + 1, ctx, snap->ctx_size);
+    sm_snap_barrier();
+    rec->seq = (seq | 1) + 1;
+    snap->written++;
+    return 0;
+}
+
+int sm_snap_put(struct sm_snap *snap, size_t i, const struct state_machine *sm,
+                const void *ctx)
+{
+#ifdef SM_CALL_DEPTH
+    if (sm->calls && sm->calls->depth)
+        return -1; /* the return stack would be lost */
+#endif
+    SM_TICK_UPDATE();
+    return sm_snap_write(snap, i, sm->stateptrptr, sm->start_timer, sm->delay,
+                         ctx, READ_GLOBAL_TICKS, sm_snap_wall_ms());
+}
+
+/* decode record i, returns 1 with *pc etc set, 0 if not usable */
+static int sm_snap_read(struct sm_snap *snap, size_t i, state_func **pc,
+                        SM_TIMER_SIZE *start_timer, SM_TIMER_SIZE *delay,
+                        SM_TIMER_SIZE now, uint64_t wall, int flags)
+{
+    struct sm_snap_rec *rec = sm_snap_rec(snap, i);
+    uint64_t elapsed;
+
+    if (rec->table == SM_SNAP_NEVER)
+        return 0;
+    if (rec->seq & 1) {
+        snap->torn++;
+        return 0;
+    }
+    if (rec->table == SM_SNAP_STOPPED) {
+        *pc = NULL;
+    } else if (rec->table > snap->ntables ||
+               rec->offset >= snap->tables[rec->table - 1].nslots) {
+        snap->bad++;
+        return 0;
+    } else {
+        *pc = snap->tables[rec->table - 1].table + rec->offset;
+    }
+    elapsed = rec->elapsed;
+    if ((flags & SM_SNAP_DOWNTIME) && wall > rec->wall_ms)
+        elapsed += wall - rec->wall_ms;
+    if (elapsed > rec->delay)
+        elapsed = rec->delay;
+    *delay = rec->delay;
+    *start_timer = now - (SM_TIMER_SIZE)elapsed;
+    return 1;
+}
+
+int sm_snap_get(struct sm_snap *snap, size_t i, struct state_machine *sm,
+                void *ctx, int flags)
+{
+    state_func *pc;
+    SM_TIMER_SIZE start_timer, delay;
+
+    SM_TICK_UPDATE();
+    if (!sm_snap_read(snap, i, &pc, &start_timer, &delay, READ_GLOBAL_TICKS,
+                      sm_snap_wall_ms(), flags))
+        return 0;
+    sm->stateptrptr = pc;
+    sm->start_timer = start_timer;
+    sm->delay = delay;
+    if (ctx)
+        memcpy(ctx, sm_snap_rec(snap, i) + 1, snap->ctx_size);
+    return 1;
+}
+
+size_t sm_snap_save_batch(struct sm_snap *snap, struct sm_batch_pool *pool)
+{
+    size_t w, words = (pool->count + 63) / 64;
+    size_t written = 0;
+    SM_TIMER_SIZE now;
+    uint64_t wall = sm_snap_wall_ms();
+
+    if (!pool->dirty || pool->ctx_size != snap->ctx_size)
+        return 0;
+    SM_TICK_UPDATE();
+    now = READ_GLOBAL_TICKS;
+    for (w = 0; w < words; w++) {
+        uint64_t bits = pool->dirty[w];
+
+        while (bits) {
+            unsigned int b = __builtin_ctzll(bits);
+            size_t i = w * 64 + b;
+
+            bits &= bits - 1;
+            if (i >= pool->count) {
+                pool->dirty[w] &= ~((uint64_t)1 << b); /* no machine */
+                continue;
+            }
+            /* a machine that could not be recorded stays dirty */
+            if (i >= snap->count)
+                continue;
+            if (sm_snap_write(snap, i, pool->pc[i], pool->start_timer[i],
+                              pool->delay[i], sm_batch_ctx(pool, i),
+                              now, wall) == 0) {
+                pool->dirty[w] &= ~((uint64_t)1 << b);
+                written++;
+            }
+        }
+    }
+    return written;
+}
+
+size_t sm_snap_restore_batch(struct sm_snap *snap, struct sm_batch_pool *pool,
+                             int flags)
+{
+    size_t i, n = pool->count < snap->count ? pool->count : snap->count;
+    size_t restored = 0;
+    SM_TIMER_SIZE now;
+    uint64_t wall = sm_snap_wall_ms();
+
+    if (pool->ctx_size != snap->ctx_size)
+        return 0;
+    madvise(snap->map, snap->map_size, MADV_SEQUENTIAL);
+    madvise(snap->map, snap->map_size, MADV_WILLNEED);
+    SM_TICK_UPDATE();
+    now = READ_GLOBAL_TICKS;
+    for (i = 0; i < n; i++) {
+        if (!sm_snap_read(snap, i, &pool->pc[i], &pool->start_timer[i],
+                          &pool->delay[i], now, wall, flags))
+            continue;
+        memcpy(sm_batch_ctx(pool, i), sm_snap_rec(snap, i) + 1,
+               snap->ctx_size);
+        if (pool->dirty)
+            pool->dirty[i / 64] &= ~((uint64_t)1 << (i % 64));
+        restored++;
+    }
+    return restored;
+}
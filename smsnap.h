@@ -0,0 +1,152 @@
+/**********************************************************************
+ *
+ * Filename:    smsnap.h
+ *
+ * Description: snapshot and restore of machine fleets in a mapped file.
+ *
+ * Notes:       Needs Posix mmap.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMSNAP_H__
+#define __SMSNAP_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "states.h"
+#include "smbatch.h"
+
+/*
+ * A struct state_machine cannot just be dumped, stateptrptr points into a
+ * table at an address that moves with every build and every start, and
+ * start_timer counts from whenever READ_GLOBAL_TICKS started. A snapshot
+ * keeps one fixed size record per machine:
+ *
+ *  table id + slot offset      index into the tables given to sm_snap_open
+ *  delay, elapsed              ticks, elapsed is clamped to delay
+ *  wall_ms                     CLOCK_REALTIME when the record was written
+ *  ctx_size bytes              the user context, opaque
+ *
+ * The file is mapped shared, so writing a record is a few stores and the
+ * kernel writes the pages back. A crashed process loses nothing it wrote,
+ * sm_snap_sync(snap, 1) is only needed to survive a crash of the machine.
+ * Each record carries a sequence that is odd while the record is written,
+ * a record torn by a crash is skipped on restore.
+ *
+ * Restoring is one pass over the records: the table id and offset give the
+ * stateptrptr again and the timer is rebased on the new clock, the machine
+ * resumes with as many ticks left as it had when saved. With SM_SNAP_DOWNTIME
+ * the time the process was down counts too, then ticks must be ms.
+ *
+ * SM_CALL return stacks are not kept, a machine inside a call is not saved.
+ *
+ * The file header holds a hash of the shape of the tables (slot kinds and
+ * delay operands), a snapshot from a build with different tables is thrown
+ * away rather than restored into the wrong slots.
+ */
+#define SM_SNAP_MAGIC       "SMSNAP01"
+#define SM_SNAP_NEVER       0           /* record table: never saved */
+#define SM_SNAP_STOPPED     0xffffffffU /* record table: machine exited */
+#define SM_SNAP_DOWNTIME    1           /* restore flag, see above */
+
+struct sm_snap_hdr {
+    char magic[8];
+    uint32_t rec_size;          /* bytes per record */
+    uint32_t timer_size;        /* sizeof(SM_TIMER_SIZE) */
+    uint64_t count;             /* records */
+    uint64_t ctx_size;
+    uint64_t layout;            /* hash of the tables */
+    uint64_t pad[3];            /* header is one cache line */
+};
+
+struct sm_snap_rec {
+    uint32_t seq;               /* odd while being written */
+    uint32_t table;             /* id + 1, SM_SNAP_NEVER or SM_SNAP_STOPPED */
+    uint32_t offset;            /* slot in the table */
+    uint32_t unused;
+    uint64_t delay;
+    uint64_t elapsed;
+    uint64_t wall_ms;
+    /* ctx_size bytes of context follow */
+};
+
+/* one table machines may be in, nslots is elements_of(table) */
+struct sm_snap_table {
+    state_func *table;
+    size_t nslots;
+};
+
+/* address range of a table, for finding the table a pc is in */
+struct sm_snap_range {
+    state_func *lo;
+    state_func *hi;
+    unsigned int id;
+};
+
+struct sm_snap {
+    int fd;
+    char *map;
+    size_t map_size;
+    struct sm_snap_hdr *hdr;
+    const struct sm_snap_table *tables;
+    unsigned int ntables;
+    struct sm_snap_range *by_addr;  /* tables sorted by address */
+    unsigned int last;          /* by_addr index of the last hit */
+    size_t count;
+    size_t ctx_size;
+    size_t rec_size;
+    unsigned long written;      /* records written */
+    unsigned long torn;         /* records skipped on restore */
+    unsigned long bad;          /* restore records out of the tables */
+};
+
+/*
+ * sm_snap_open - map a snapshot file, creating it if needed
+ * tables: every table a machine can be in, the order gives the table ids
+ *         and must not change between builds
+ * count: machines, ctx_size: bytes of user context each, may be 0
+ * returns 1 if the file holds a snapshot of these tables to restore, 0 if
+ * it was created or reset, -1 on error with errno set
+ */
+int sm_snap_open(struct sm_snap *snap, const char *path,
+                 const struct sm_snap_table *tables, unsigned int ntables,
+                 size_t count, size_t ctx_size);
+void sm_snap_close(struct sm_snap *snap);
+/* write mapped pages back, wait for the disk if wait, returns 0 or -1 */
+int sm_snap_sync(struct sm_snap *snap, int wait);
+
+/*
+ * sm_snap_put - record machine i, ctx may be NULL to leave it zero
+ * returns 0, or -1 if the machine is in none of the tables or in a SM_CALL
+ */
+int sm_snap_put(struct sm_snap *snap, size_t i, const struct state_machine *sm,
+                const void *ctx);
+/*
+ * sm_snap_get - load machine i with its timer rebased on now
+ * returns 1 if loaded, 0 if there is no usable record and sm and ctx were
+ * left alone
+ */
+int sm_snap_get(struct sm_snap *snap, size_t i, struct state_machine *sm,
+                void *ctx, int flags);
+
+/*
+ * sm_snap_save_batch - record the pool's dirty machines and clear their bits
+ * The pool must track dirty bits and have ctx_size equal to the snapshot's.
+ * A machine that is not recorded (past the snapshot's count, pc outside
+ * its tables) keeps its bit and is tried again on the next save.
+ * returns records written
+ */
+size_t sm_snap_save_batch(struct sm_snap *snap, struct sm_batch_pool *pool);
+/*
+ * sm_snap_restore_batch - load every recorded machine into the pool
+ * Machines never recorded keep what the pool has, normally the start of
+ * their table. Restored machines are clean.
+ * returns machines restored
+ */
+size_t sm_snap_restore_batch(struct sm_snap *snap, struct sm_batch_pool *pool,
+                             int flags);
+
+#endif //__SMSNAP_H__
@@ -0,0 +1,186 @@
+/**********************************************************************
+ *
+ * Filename:    smtrace.c
+ *
+ * Description: binary state transition trace, per thread overwrite
+ *              oldest rings in memory mapped files.
+ *
+ * Notes:       Linux only, needs GCC atomics and thread local storage.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "smtrace.h"
+
+/*
+ * Reading the tick clock costs more than the rest of a record, it is only
+ * read again once this many tsc units went by, far less than a tick.
+ */
+#define SMTRACE_TICK_REFRESH    65536
+
+struct smtrace_ring {
+    struct smtrace_ring *next;  /* all rings, for table registration */
+    struct smtrace_hdr *hdr;
+    struct smtrace_rec *recs;
+    size_t bytes;
+    uint64_t tick_tsc;          /* when tick was read */
+    uint32_t tick;
+};
+
+static pthread_mutex_t smtrace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct smtrace_ring *smtrace_rings;
+static struct smtrace_table smtrace_tables[SMTRACE_TABLES];
+static unsigned int smtrace_ntables;
+static _Thread_local struct smtrace_ring *smtrace_self;
+static _Thread_local int smtrace_failed;
+
+#define SMTRACE_FPTR(f) ((uint64_t)(uintptr_t)(f))
+
+/* the tsc, or ns where there is none */
+static uint64_t smtrace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * map this thread's ring file, returns it or NULL
+ * Rings are never unmapped, they outlive their thread so registrations
+ * can still be written to them.
+ */
+static struct smtrace_ring *smtrace_open(void)
+{
+    struct smtrace_ring *r;
+    char path[256];
+    struct smtrace_hdr *hdr;
+    Dl_info info;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/smtrace.%d.%d", SMTRACE_DIR,
+             (int)getpid(), (int)gettid());
+    r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        goto err;
+    r->bytes = sizeof(*hdr) + SMTRACE_RECS * sizeof(struct smtrace_rec);
+    if (ftruncate(fd, r->bytes) < 0) {
+        close(fd);
+        goto err;
+    }
+    /* populate now, no page faults while recording */
+    hdr = mmap(NULL, r->bytes, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        goto err;
+    memcpy(hdr->magic, SMTRACE_MAGIC, sizeof(hdr->magic));
+    hdr->rec_size = sizeof(struct smtrace_rec);
+    hdr->nrecs = SMTRACE_RECS;
+    hdr->pid = getpid();
+    hdr->tid = gettid();
+    if (dladdr((void *)(uintptr_t)sm_run_state, &info))
+        hdr->image_base = (uintptr_t)info.dli_fbase;
+    hdr->run_state = SMTRACE_FPTR(sm_run_state);
+    hdr->delay_state = SMTRACE_FPTR(sm_delay_ticks_state);
+    hdr->wait_state = SMTRACE_FPTR(sm_wait_ticks_state);
+    hdr->jump_state = SMTRACE_FPTR(sm_jump_table_state);
+    r->hdr = hdr;
+    r->recs = (struct smtrace_rec *)(hdr + 1);
+
+    pthread_mutex_lock(&smtrace_lock);
+    memcpy(hdr->tables, smtrace_tables, sizeof(smtrace_tables));
+    hdr->ntables = smtrace_ntables;
+    r->next = smtrace_rings;
+    smtrace_rings = r;
+    pthread_mutex_unlock(&smtrace_lock);
+    return r;
+
+err:
+    free(r);
+    return NULL;
+}
+
+void smtrace_record(struct state_machine *sm, state_func *pc,
+                    state_func func, int result)
+{
+    struct smtrace_ring *r = smtrace_self;
+    struct smtrace_rec *rec;
+    uint64_t seq;
+
+    if (!r) {
+        if (smtrace_failed || !(r = smtrace_open())) {
+            smtrace_failed = 1;
+            return;
+        }
+        smtrace_self = r;
+    }
+    seq = ++r->hdr->head;
+    rec = &r->recs[(seq - 1) & (SMTRACE_RECS - 1)];
+    /* invalidate first, so a torn record is never decoded as whole */
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    rec->tsc = smtrace_clock();
+    if (rec->tsc - r->tick_tsc >= SMTRACE_TICK_REFRESH) {
+        r->tick = (uint32_t)READ_GLOBAL_TICKS;
+        r->tick_tsc = rec->tsc;
+    }
+    rec->machine = (uintptr_t)sm;
+    rec->pc = (uintptr_t)pc;
+    rec->func = SMTRACE_FPTR(func);
+    rec->result = result;
+    rec->tick = r->tick;
+    __atomic_store_n(&rec->seq, seq, __ATOMIC_RELEASE);
+}
+
+int smtrace_table(state_func *table, size_t nslots, const char *name)
+{
+    struct smtrace_table *t;
+    struct smtrace_ring *r;
+
+    pthread_mutex_lock(&smtrace_lock);
+    if (smtrace_ntables == SMTRACE_TABLES) {
+        pthread_mutex_unlock(&smtrace_lock);
+        return -1;
+    }
+    t = &smtrace_tables[smtrace_ntables++];
+    t->base = (uintptr_t)table;
+    t->nslots = nslots;
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    for (r = smtrace_rings; r; r = r->next) {
+        r->hdr->tables[smtrace_ntables - 1] = *t;
+        __atomic_store_n(&r->hdr->ntables, smtrace_ntables,
+                         __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&smtrace_lock);
+    return 0;
+}
+
+void smtrace_sync(void)
+{
+    if (smtrace_self)
+        msync(smtrace_self->hdr, smtrace_self->bytes, MS_ASYNC);
+}
@@ -0,0 +1,94 @@
+/**********************************************************************
+ *
+ * Filename:    smtrace.h
+ *
+ * Description: binary state transition trace, per thread overwrite
+ *              oldest rings in memory mapped files.
+ *
+ * Notes:       Linux only, needs GCC atomics and thread local storage.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMTRACE_H__
+#define __SMTRACE_H__
+#include <stdint.h>
+#include "states.h"
+
+/*
+ * Compile states.c with -DSM_TRACE and sm_run_state() appends a record for
+ * every state it runs to the calling thread's ring. The ring is a shared
+ * mapping of a file, SMTRACE_DIR/smtrace.<pid>.<tid>, so whatever was in it
+ * is still on disk after a crash or kill -9. The newest records overwrite
+ * the oldest, a ring only ever has its own thread writing so there are no
+ * locks, a record's seq is stored last and is 0 while it is being written.
+ *
+ * The pc is recorded as an address. Register tables with smtrace_table()
+ * and the decoder prints "table+slot" instead, table registrations are
+ * copied into every ring's header. State functions are printed as offsets
+ * into the executable (or library) that holds sm_run_state(), feed them to
+ * addr2line -f -e, the built in states are named.
+ *
+ * smtrace_dump (smtrace_dump.c) decodes one or more ring files into a
+ * timeline ordered by the TSC.
+ */
+#ifndef SMTRACE_DIR
+#define SMTRACE_DIR     "/tmp"
+#endif
+#ifndef SMTRACE_RECS
+#define SMTRACE_RECS    65536   /* records per thread, power of 2 */
+#endif
+#define SMTRACE_TABLES  64
+#define SMTRACE_MAGIC   "SMTRACE1"
+
+struct smtrace_rec {
+    uint64_t seq;               /* 1 .., 0 while being written */
+    uint64_t tsc;               /* cycle counter, ns where there is none */
+    uint64_t machine;           /* struct state_machine address */
+    uint64_t pc;                /* stateptrptr the state ran from */
+    uint64_t func;              /* state function */
+    int32_t result;             /* what the state returned */
+    uint32_t tick;              /* READ_GLOBAL_TICKS */
+};
+
+struct smtrace_table {
+    uint64_t base;
+    uint32_t nslots;
+    char name[36];
+};
+
+/* head of every ring file, the records follow it */
+struct smtrace_hdr {
+    char magic[8];
+    uint32_t rec_size;
+    uint32_t nrecs;
+    uint64_t head;              /* records ever written */
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t image_base;        /* load address of the code below */
+    uint64_t run_state;         /* sm_run_state */
+    uint64_t delay_state;       /* sm_delay_ticks_state */
+    uint64_t wait_state;        /* sm_wait_ticks_state */
+    uint64_t jump_state;        /* sm_jump_table_state */
+    uint32_t ntables;
+    uint32_t pad;
+    struct smtrace_table tables[SMTRACE_TABLES];
+};
+
+/* sm_run_state() does this under SM_TRACE, pc is before the state ran */
+void smtrace_record(struct state_machine *sm, state_func *pc,
+                    state_func func, int result);
+
+/*
+ * smtrace_table - name a table for the decoder
+ * returns 0, or -1 if SMTRACE_TABLES are already registered
+ */
+int smtrace_table(state_func *table, size_t nslots, const char *name);
+
+/* flush this thread's ring to its file, msync() */
+void smtrace_sync(void);
+
+#endif //__SMTRACE_H__
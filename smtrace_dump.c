@@ -0,0 +1,153 @@
+/**********************************************************************
+ *
+ * Filename:    smtrace_dump.c
+ *
+ * Description: decode smtrace ring files into a timeline.
+ *
+ * Notes:       Reads files written on the same kind of machine.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o smtrace_dump smtrace_dump.c "
+ * run: " ./smtrace_dump [-n last_records] /tmp/smtrace.<pid>.* "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smtrace.h"
+
+struct dump_rec {
+    struct smtrace_rec rec;
+    const struct smtrace_hdr *hdr;
+};
+
+static int dump_cmp(const void *a, const void *b)
+{
+    const struct dump_rec *x = a, *y = b;
+
+    if (x->rec.tsc != y->rec.tsc)
+        return x->rec.tsc < y->rec.tsc ? -1 : 1;
+    return x->rec.seq < y->rec.seq ? -1 : x->rec.seq > y->rec.seq;
+}
+
+/* read a ring file, returns its header, records appended to *recs */
+static struct smtrace_hdr *dump_load(const char *path, struct dump_rec **recs,
+                                     size_t *nrecs)
+{
+    struct smtrace_hdr *hdr = malloc(sizeof(*hdr));
+    struct smtrace_rec rec;
+    FILE *f = fopen(path, "rb");
+    uint32_t i;
+
+    if (!f || !hdr || fread(hdr, sizeof(*hdr), 1, f) != 1 ||
+        memcmp(hdr->magic, SMTRACE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->rec_size != sizeof(rec)) {
+        fprintf(stderr, "%s: not a trace ring\n", path);
+        if (f)
+            fclose(f);
+        free(hdr);
+        return NULL;
+    }
+    for (i = 0; i < hdr->nrecs && fread(&rec, sizeof(rec), 1, f) == 1; i++) {
+        if (!rec.seq)
+            continue; /* never written, or torn by a crash */
+        if (!(*nrecs & (*nrecs + 1)) || !*recs) {
+            /* grow on every power of 2 */
+            *recs = realloc(*recs, (*nrecs + 1) * 2 * sizeof(**recs));
+            if (!*recs) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+        (*recs)[*nrecs].rec = rec;
+        (*recs)[(*nrecs)++].hdr = hdr;
+    }
+    fclose(f);
+    return hdr;
+}
+
+/* "table+slot" if the pc is in a registered table */
+static void dump_pc(const struct smtrace_hdr *hdr, uint64_t pc, char *buf,
+                    size_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < hdr->ntables && i < SMTRACE_TABLES; i++) {
+        const struct smtrace_table *t = &hdr->tables[i];
+
+        if (pc >= t->base && pc < t->base + t->nslots * sizeof(state_func)) {
+            snprintf(buf, len, "%.*s+%llu", (int)sizeof(t->name), t->name,
+                     (unsigned long long)((pc - t->base) /
+                                          sizeof(state_func)));
+            return;
+        }
+    }
+    snprintf(buf, len, "0x%llx", (unsigned long long)pc);
+}
+
+static void dump_func(const struct smtrace_hdr *hdr, uint64_t func, char *buf,
+                      size_t len)
+{
+    if (func == hdr->delay_state)
+        snprintf(buf, len, "sm_delay_ticks_state");
+    else if (func == hdr->wait_state)
+        snprintf(buf, len, "sm_wait_ticks_state");
+    else if (func == hdr->jump_state)
+        snprintf(buf, len, "sm_jump_table_state");
+    else if (hdr->image_base && func >= hdr->image_base)
+        snprintf(buf, len, "image+0x%llx",
+                 (unsigned long long)(func - hdr->image_base));
+    else
+        snprintf(buf, len, "0x%llx", (unsigned long long)func);
+}
+
+int main(int argc, char **argv)
+{
+    struct dump_rec *recs = NULL;
+    size_t nrecs = 0, first = 0, last = 0, i;
+    int a = 1;
+
+    if (a + 1 < argc && !strcmp(argv[a], "-n")) {
+        last = strtoul(argv[a + 1], NULL, 0);
+        a += 2;
+    }
+    if (a >= argc) {
+        fprintf(stderr, "usage: %s [-n last_records] ring_file ...\n",
+                argv[0]);
+        return 2;
+    }
+    for (; a < argc; a++) {
+        struct smtrace_hdr *hdr = dump_load(argv[a], &recs, &nrecs);
+
+        if (hdr)
+            printf("# %s: pid %u tid %u, %llu records written, ring %u\n",
+                   argv[a], hdr->pid, hdr->tid,
+                   (unsigned long long)hdr->head, hdr->nrecs);
+    }
+    if (!nrecs)
+        return 0;
+    qsort(recs, nrecs, sizeof(*recs), dump_cmp);
+    if (last && last < nrecs)
+        first = nrecs - last;
+    printf("# %14s %10s %7s %18s %-24s %-28s %s\n", "+tsc", "tick", "tid",
+           "machine", "pc", "state", "ret");
+    for (i = first; i < nrecs; i++) {
+        const struct smtrace_rec *r = &recs[i].rec;
+        char pc[64], func[64];
+
+        dump_pc(recs[i].hdr, r->pc, pc, sizeof(pc));
+        dump_func(recs[i].hdr, r->func, func, sizeof(func));
+        printf("%16llu %10u %7u %#18llx %-24s %-28s %d\n",
+               (unsigned long long)(r->tsc - recs[first].rec.tsc), r->tick,
+               recs[i].hdr->tid, (unsigned long long)r->machine, pc, func,
+               r->result);
+    }
+    free(recs);
+    return 0;
+}
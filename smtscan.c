@@ -0,0 +1,205 @@
+/**********************************************************************
+ *
+ * Filename:    smtscan.c
+ *
+ * Description: vectorized timer expiry scan over arrays of machine timers.
+ *
+ * Notes:       Uses SSE2/AVX2 when the compiler targets them, plain C
+ *              otherwise.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include "smtscan.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SM_TSCAN_ISA "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SM_TSCAN_ISA "sse2"
+#else
+#define SM_TSCAN_ISA "c"
+#endif
+
+/* scalar test of one word's worth of lanes, lanes <= 64 */
+static uint64_t sm_tscan_word(const SM_TIMER_SIZE *start,
+                              const SM_TIMER_SIZE *delay, unsigned int lanes,
+                              SM_TIMER_SIZE now)
+{
+    uint64_t bits = 0;
+    unsigned int i;
+
+    for (i = 0; i < lanes; i++) {
+        if ((SM_TIMER_SIZE)(now - start[i]) >= delay[i])
+            bits |= (uint64_t)1 << i;
+    }
+    return bits;
+}
+
+size_t sm_timer_scan_scalar(const SM_TIMER_SIZE *start,
+                            const SM_TIMER_SIZE *delay, size_t count,
+                            SM_TIMER_SIZE now, uint64_t *expired)
+{
+    size_t done = 0;
+    size_t i;
+
+    for (i = 0; i < count; i += 64) {
+        unsigned int lanes = count - i < 64 ? count - i : 64;
+
+        expired[i / 64] = sm_tscan_word(start + i, delay + i, lanes, now);
+        done += __builtin_popcountll(expired[i / 64]);
+    }
+    return done;
+}
+
+#if defined(__SSE2__)
+/*
+ * 64 lanes of the timer width into one mask word. There are no unsigned
+ * compares below AVX-512: 8 and 16 bit use a saturating subtract,
+ * delay - elapsed is 0 exactly when elapsed >= delay, 32 and 64 bit flip
+ * the sign bit and use the signed greater than.
+ */
+static uint64_t sm_tscan_vec(const SM_TIMER_SIZE *start,
+                             const SM_TIMER_SIZE *delay, SM_TIMER_SIZE now)
+{
+    uint64_t bits = 0;
+    unsigned int i;
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i *s = (const __m256i *)start;
+    const __m256i *d = (const __m256i *)delay;
+
+    if (sizeof(SM_TIMER_SIZE) == 1) {
+        __m256i vnow = _mm256_set1_epi8((char)now);
+
+        for (i = 0; i < 2; i++) {
+            __m256i el = _mm256_sub_epi8(vnow, _mm256_loadu_si256(s + i));
+            __m256i left = _mm256_subs_epu8(_mm256_loadu_si256(d + i), el);
+
+            bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(left, zero)) << (i * 32);
+        }
+    } else if (sizeof(SM_TIMER_SIZE) == 2) {
+        __m256i vnow = _mm256_set1_epi16((short)now);
+
+        for (i = 0; i < 4; i += 2) {
+            __m256i el0 = _mm256_sub_epi16(vnow, _mm256_loadu_si256(s + i));
+            __m256i el1 = _mm256_sub_epi16(vnow,
+                                           _mm256_loadu_si256(s + i + 1));
+            __m256i d0 = _mm256_subs_epu16(_mm256_loadu_si256(d + i), el0);
+            __m256i d1 = _mm256_subs_epu16(_mm256_loadu_si256(d + i + 1),
+                                           el1);
+            /* packs works per 128 bit half, put the quads back in order */
+            __m256i m = _mm256_packs_epi16(_mm256_cmpeq_epi16(d0, zero),
+                                           _mm256_cmpeq_epi16(d1, zero));
+
+            m = _mm256_permute4x64_epi64(m, 0xd8);
+            bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(m) << (i * 16);
+        }
+    } else if (sizeof(SM_TIMER_SIZE) == 4) {
+        __m256i vnow = _mm256_set1_epi32((int)now);
+        __m256i bias = _mm256_set1_epi32((int)0x80000000);
+
+        for (i = 0; i < 8; i++) {
+            __m256i el = _mm256_sub_epi32(vnow, _mm256_loadu_si256(s + i));
+            __m256i wait = _mm256_cmpgt_epi32(
+                    _mm256_xor_si256(_mm256_loadu_si256(d + i), bias),
+                    _mm256_xor_si256(el, bias));
+
+            bits |= (uint64_t)(~_mm256_movemask_ps(
+                    _mm256_castsi256_ps(wait)) & 0xff) << (i * 8);
+        }
+    } else {
+        __m256i vnow = _mm256_set1_epi64x((long long)now);
+        __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+
+        for (i = 0; i < 16; i++) {
+            __m256i el = _mm256_sub_epi64(vnow, _mm256_loadu_si256(s + i));
+            __m256i wait = _mm256_cmpgt_epi64(
+                    _mm256_xor_si256(_mm256_loadu_si256(d + i), bias),
+                    _mm256_xor_si256(el, bias));
+
+            bits |= (uint64_t)(~_mm256_movemask_pd(
+                    _mm256_castsi256_pd(wait)) & 0xf) << (i * 4);
+        }
+    }
+#else
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i *s = (const __m128i *)start;
+    const __m128i *d = (const __m128i *)delay;
+
+    if (sizeof(SM_TIMER_SIZE) == 1) {
+        __m128i vnow = _mm_set1_epi8((char)now);
+
+        for (i = 0; i < 4; i++) {
+            __m128i el = _mm_sub_epi8(vnow, _mm_loadu_si128(s + i));
+            __m128i left = _mm_subs_epu8(_mm_loadu_si128(d + i), el);
+
+            bits |= (uint64_t)_mm_movemask_epi8(
+                    _mm_cmpeq_epi8(left, zero)) << (i * 16);
+        }
+    } else if (sizeof(SM_TIMER_SIZE) == 2) {
+        __m128i vnow = _mm_set1_epi16((short)now);
+
+        for (i = 0; i < 8; i += 2) {
+            __m128i el0 = _mm_sub_epi16(vnow, _mm_loadu_si128(s + i));
+            __m128i el1 = _mm_sub_epi16(vnow, _mm_loadu_si128(s + i + 1));
+            __m128i d0 = _mm_subs_epu16(_mm_loadu_si128(d + i), el0);
+            __m128i d1 = _mm_subs_epu16(_mm_loadu_si128(d + i + 1), el1);
+            __m128i m = _mm_packs_epi16(_mm_cmpeq_epi16(d0, zero),
+                                        _mm_cmpeq_epi16(d1, zero));
+
+            bits |= (uint64_t)_mm_movemask_epi8(m) << (i * 8);
+        }
+    } else if (sizeof(SM_TIMER_SIZE) == 4) {
+        __m128i vnow = _mm_set1_epi32((int)now);
+        __m128i bias = _mm_set1_epi32((int)0x80000000);
+
+        for (i = 0; i < 16; i++) {
+            __m128i el = _mm_sub_epi32(vnow, _mm_loadu_si128(s + i));
+            __m128i wait = _mm_cmpgt_epi32(
+                    _mm_xor_si128(_mm_loadu_si128(d + i), bias),
+                    _mm_xor_si128(el, bias));
+
+            bits |= (uint64_t)(~_mm_movemask_ps(
+                    _mm_castsi128_ps(wait)) & 0xf) << (i * 4);
+        }
+    } else {
+        /* no 64 bit compare in SSE2 */
+        bits = sm_tscan_word(start, delay, 64, now);
+    }
+#endif
+    (void)zero;
+    return bits;
+}
+#endif
+
+size_t sm_timer_scan(const SM_TIMER_SIZE *start, const SM_TIMER_SIZE *delay,
+                     size_t count, SM_TIMER_SIZE now, uint64_t *expired)
+{
+#if defined(__SSE2__)
+    size_t done = 0;
+    size_t i;
+
+    for (i = 0; i + 64 <= count; i += 64) {
+        expired[i / 64] = sm_tscan_vec(start + i, delay + i, now);
+        done += __builtin_popcountll(expired[i / 64]);
+    }
+    if (i < count) {
+        expired[i / 64] = sm_tscan_word(start + i, delay + i, count - i, now);
+        done += __builtin_popcountll(expired[i / 64]);
+    }
+    return done;
+#else
+    return sm_timer_scan_scalar(start, delay, count, now, expired);
+#endif
+}
+
+const char *sm_timer_scan_isa(void)
+{
+    return SM_TSCAN_ISA;
+}
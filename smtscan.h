@@ -0,0 +1,51 @@
+/**********************************************************************
+ *
+ * Filename:    smtscan.h
+ *
+ * Description: vectorized timer expiry scan over arrays of machine timers.
+ *
+ * Notes:       Uses SSE2/AVX2 when the compiler targets them, plain C
+ *              otherwise.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __SMTSCAN_H__
+#define __SMTSCAN_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "states.h"
+
+/*
+ * When timers live in contiguous start[] and delay[] arrays (the batch pool
+ * does this) the expiry test of SM_IS_TIMER_DONE() can run on many machines
+ * at once:
+ *
+ *      done = (SM_TIMER_SIZE)(now - start[i]) >= delay[i]
+ *
+ * with the same modulo wraparound as the macro, for any SM_TIMER_SIZE of
+ * 8, 16, 32 or 64 bits. A 16 bit timer does 16 lanes per AVX2 compare
+ * (8 with SSE2), 32 bit 8 (4). Build with -mavx2 (or -march=native) to get
+ * the wide version, x86_64 always has SSE2, anything else runs the scalar
+ * loop.
+ *
+ * The result is a bitmask, bit i % 64 of expired[i / 64] is set when
+ * machine i's timer is done, so it needs SM_TSCAN_WORDS(count) words.
+ * Bits past count in the last word are cleared.
+ */
+#define SM_TSCAN_WORDS(count)   (((count) + 63) / 64)
+
+/* returns the number of expired timers */
+size_t sm_timer_scan(const SM_TIMER_SIZE *start, const SM_TIMER_SIZE *delay,
+                     size_t count, SM_TIMER_SIZE now, uint64_t *expired);
+/* one SM_IS_TIMER_DONE() at a time, the reference for sm_timer_scan() */
+size_t sm_timer_scan_scalar(const SM_TIMER_SIZE *start,
+                            const SM_TIMER_SIZE *delay, size_t count,
+                            SM_TIMER_SIZE now, uint64_t *expired);
+/* which vector code sm_timer_scan() was built with, "avx2", "sse2" or "c" */
+const char *sm_timer_scan_isa(void);
+
+#endif //__SMTSCAN_H__
@@ -0,0 +1,168 @@
+/**********************************************************************
+ *
+ * Filename:    snap_bench.c
+ *
+ * Description: time to snapshot a big fleet of machines and to restart it
+ *              from the snapshot.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -Wall -Wextra -o snap_bench snap_bench.c \
+ *            smsnap.c smbatch.c smtscan.c states.c getms.c "
+ * run: " ./snap_bench [machines [file]] "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "smsnap.h"
+#include "bench.h"
+
+/* what each machine remembers, the part a restart used to lose */
+struct counter {
+    uint32_t count;
+    uint32_t id;
+    uint64_t sum;
+};
+
+static int count_state(struct state_machine *sm)
+{
+    struct counter *c = sm_batch_context(sm);
+
+    c->count++;
+    c->sum += c->id;
+    return SM_RETURN_DONE;
+}
+
+state_func fast_table[] = {
+    count_state,
+    SM_DELAY_MS(50),
+    SM_JUMP(fast_table),
+};
+
+state_func slow_table[] = {
+    count_state,
+    SM_DELAY_MS(400),
+    count_state,
+    SM_DELAY_MS(1000),
+    SM_JUMP(slow_table),
+};
+
+state_func once_table[] = {
+    count_state,
+    SM_DELAY_MS(100),
+    count_state,
+    NULL,
+};
+
+static const struct sm_snap_table tables[] = {
+    { fast_table, elements_of(fast_table) },
+    { slow_table, elements_of(slow_table) },
+    { once_table, elements_of(once_table) },
+};
+
+static state_func *start_of(size_t i)
+{
+    return tables[i % elements_of(tables)].table;
+}
+
+static void start_fleet(struct sm_batch_pool *pool)
+{
+    size_t i;
+
+    for (i = 0; i < pool->count; i++) {
+        struct counter *c = sm_batch_ctx(pool, i);
+
+        sm_batch_set_table(pool, i, start_of(i));
+        c->id = i;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t machines = 1000000;
+    const char *path = "/tmp/snap_bench.snap";
+    struct sm_batch_pool pool, back;
+    struct sm_snap snap;
+    size_t i, n, moved = 0, wrong = 0;
+    uint64_t t0, t1, t2;
+    int ret;
+
+    if (argc > 1)
+        machines = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        path = argv[2];
+    unlink(path);
+
+    if (sm_batch_init(&pool, machines, sizeof(struct counter)) < 0 ||
+        sm_batch_init(&back, machines, sizeof(struct counter)) < 0 ||
+        sm_batch_track_dirty(&pool) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    start_fleet(&pool);
+    if (sm_snap_open(&snap, path, tables, elements_of(tables), machines,
+                     pool.ctx_size) < 0) {
+        perror(path);
+        return 1;
+    }
+
+    /* run a while so the machines are spread over their tables */
+    t0 = bench_ns();
+    while (bench_ns() - t0 < 600000000ULL)
+        sm_run_batch(&pool, 0, machines);
+    t0 = bench_ns();
+    n = sm_snap_save_batch(&snap, &pool);
+    t1 = bench_ns();
+    printf("full save   %zu machines: %.1f ms, %zu MB\n", n,
+           (t1 - t0) / 1e6, snap.map_size >> 20);
+
+    /* one more pass, only the machines that moved are written */
+    usleep(60000);
+    sm_run_batch(&pool, 0, machines);
+    t0 = bench_ns();
+    n = sm_snap_save_batch(&snap, &pool);
+    t1 = bench_ns();
+    printf("incremental %zu machines: %.1f ms\n", n, (t1 - t0) / 1e6);
+    t0 = bench_ns();
+    sm_snap_sync(&snap, 1);
+    printf("sync to disk: %.1f ms\n", (bench_ns() - t0) / 1e6);
+    sm_snap_close(&snap);
+
+    /* the restart: fresh pool, every machine at the start of its table */
+    start_fleet(&back);
+    t0 = bench_ns();
+    ret = sm_snap_open(&snap, path, tables, elements_of(tables), machines,
+                       back.ctx_size);
+    t1 = bench_ns();
+    n = ret == 1 ? sm_snap_restore_batch(&snap, &back, 0) : 0;
+    t2 = bench_ns();
+    printf("restart     %zu machines: open %.1f ms restore %.1f ms"
+           " total %.1f ms\n", n, (t1 - t0) / 1e6, (t2 - t1) / 1e6,
+           (t2 - t0) / 1e6);
+
+    for (i = 0; i < machines; i++) {
+        if (back.pc[i] != pool.pc[i] || back.delay[i] != pool.delay[i] ||
+            memcmp(sm_batch_ctx(&back, i), sm_batch_ctx(&pool, i),
+                   pool.ctx_size))
+            wrong++;
+        if (back.pc[i] != start_of(i))
+            moved++;
+    }
+    printf("%zu machines resumed past their start, %zu differ\n", moved,
+           wrong);
+
+    sm_snap_close(&snap);
+    unlink(path);
+    sm_batch_free(&pool);
+    sm_batch_free(&back);
+    return wrong != 0;
+}
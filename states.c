@@ -13,6 +13,12 @@
  * expressed or implied by its publication or distribution.
  **********************************************************************/
 #include "states.h"
+#ifdef SM_PROFILE
+#include "smprof.h"
+#endif
+#ifdef SM_TRACE
+#include "smtrace.h"
+#endif
 /* define commonly required states */
 /*
  * state machine function to initiate a delay using the following
@@ -21,9 +27,9 @@
 int sm_delay_ticks_state(struct state_machine *sm)
 {
     if ( sm->stateptrptr ) {
-        unsigned int delay;
+        SM_TIMER_SIZE delay;
         sm->stateptrptr += 1; /* point to timer value */
-        delay = *(unsigned int *)(sm->stateptrptr);
+        delay = SM_TABLE_OPERAND(sm->stateptrptr);
 
         SM_START_TIMER(sm, delay); /* no callback, just timer */
 
@@ -57,11 +63,69 @@ int sm_jump_table_state(struct state_machine *sm)
     return 0;   /* and start the new table */
 }
 
+#ifdef SM_CALL_DEPTH
+/* SM_CALL: remember the slot after the call and go to the table */
+int sm_call_state(struct state_machine *sm)
+{
+    struct sm_call_stack *calls = sm->calls;
+
+    if (!calls)
+        return SM_RETURN_ERROR; /* machine has no return stack */
+    if (calls->depth == SM_CALL_DEPTH) {
+        calls->overflows++;
+        return SM_RETURN_ERROR;
+    }
+    calls->ret[calls->depth++] = sm->stateptrptr + SM_CALL_SLOTS;
+    sm->stateptrptr = (state_func *)sm->stateptrptr[1];
+    return 0;
+}
+
+/* back to the caller, skip more slots past the call */
+static int sm_ret(struct state_machine *sm, unsigned int skip)
+{
+    struct sm_call_stack *calls = sm->calls;
+
+    if (!calls || !calls->depth)
+        return SM_RETURN_ERROR; /* return without a call */
+    sm->stateptrptr = calls->ret[--calls->depth] + skip;
+    return 0;
+}
+
+/* SM_RET: carry on after the SM_CALL, as if it was SM_RETURN_DONE */
+int sm_ret_state(struct state_machine *sm)
+{
+    return sm_ret(sm, 0);
+}
+
+/* SM_RET_SKIP_JUMP: ... as if it was SM_RETURN_SKIP_JUMP */
+int sm_ret_skip_jump_state(struct state_machine *sm)
+{
+    return sm_ret(sm, SM_RETURN_SKIP_JUMP_SIZE);
+}
+#endif
+
+/*
+ * take the SM_JUMP at stateptrptr and any it lands on, without calling
+ * sm_jump_table_state. A loop of nothing but jumps gives up after
+ * SM_JUMP_HOPS, the next call carries on.
+ */
+static void sm_follow_jumps(struct state_machine *sm)
+{
+    unsigned int hops = SM_JUMP_HOPS;
+
+    do {
+        sm->stateptrptr = (state_func *)sm->stateptrptr[1];
+    } while (sm->stateptrptr && *sm->stateptrptr == sm_jump_table_state &&
+             --hops);
+}
+
 /*
  * main state machine execution monitor
  * call with every statemachine every mainloop
  * Will execute ONE state_func per call
- *  returns 0 if last state will be repeated next time
+ * SM_JUMPs are taken right here, a state moving the machine onto a jump
+ * (or a machine sitting on one) costs no extra call, see smlink.h.
+ *  returns 0 if last state will be repeated next time, or a jump was taken
  *  returns >0 if last state completed
  *  returns <0 if last state reported an error, sm is aborted
  */
@@ -71,19 +135,51 @@ int sm_run_state(struct state_machine *sm) {
 
     if ( sm && sm->stateptrptr && (func_ptr = *(sm->stateptrptr)) )
     {
+        if (func_ptr == sm_jump_table_state) {
+            /* table starting with a jump, nothing to call */
+            sm_follow_jumps(sm);
+            return 0;
+        }
 
+#ifdef SM_TRACE
+        state_func *pc = sm->stateptrptr; /* states may move it */
+#endif
         /* call the state function right here ...*/
+#ifdef SM_PROFILE
+        uint64_t t0 = smprof_clock();
+
         result = (func_ptr)( sm );
+        smprof_record(func_ptr, result, smprof_clock() - t0);
+#else
+        result = (func_ptr)( sm );
+#endif
+#ifdef SM_TRACE
+        smtrace_record(sm, pc, func_ptr, result);
+#endif
         if (result >= 0) {
             /*
              * success update to next state unless returned zero, so then
              * repeat on next call
              */
             sm->stateptrptr += result;
+            /*
+             * done into a jump, the usual way out of a table. Still a
+             * yield like the jump state always was, so looping tables
+             * give the other machines a turn.
+             */
+            if (result && *sm->stateptrptr == sm_jump_table_state) {
+                sm_follow_jumps(sm);
+                result = 0;
+            }
         } else  { /* ERRORS abort state machine, caller needs to fix */
             sm->stateptrptr = NULL;
             SM_STOP_TIMER(sm);
         }
     }
+#ifdef SM_CALL_DEPTH
+    /* the machine ended, any calls it was in are gone with it */
+    if (result < 0 && sm && sm->calls)
+        sm->calls->depth = 0;
+#endif
     return result;
 }
@@ -31,6 +31,9 @@
 #define __STATES_H__
 #include <stddef.h>
 #include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
 /*
  * macros for controlling the statemachine convert to ticks from ms for
  * oneshot. used to build state machine tables.
@@ -41,10 +44,11 @@
 /* allow user to change timer size. this is h/w dependent */
 #ifndef SM_TIMER_SIZE
 /* must be no bigger than free running timer variable, small is less ms
-   resolution, big uses slightly more ram */
+   resolution, big uses slightly more ram. uint16_t wraps after 65 s at
+   1 kHz, use uint32_t or uint64_t for longer delays or faster ticks */
 #define SM_TIMER_SIZE uint16_t
 #endif
-/* defines ticks per second */
+/* defines ticks per second, getms() supports up to 1 GHz, eg 10000L */
 #ifndef SM_TICK_RATE
 #define SM_TICK_RATE 1000L
 #endif
@@ -59,6 +63,36 @@
                                 (state_func)(SM_MS_TO_TICKS(ms))
 
 #define SM_JUMP(dest) (sm_jump_table_state), (state_func)(dest)
+/* most jumps sm_run_state() takes in a row, ends loops of bare jumps */
+#ifndef SM_JUMP_HOPS
+#define SM_JUMP_HOPS 8
+#endif
+#ifdef SM_CALL_DEPTH
+/*
+ * SM_CALL(table) runs table like a subroutine. Its SM_RET comes back to the
+ * slot after the call, SM_RET_SKIP_JUMP past the jump after that, just as
+ * if the call were a state returning SM_RETURN_DONE or SM_RETURN_SKIP_JUMP.
+ * So a shared sequence is kept once and reports back the usual way:
+ *
+ *      SM_CALL(wait_reply_table),
+ *      SM_JUMP(timed_out_table),       <- SM_RET
+ *      handle_reply_state,             <- SM_RET_SKIP_JUMP
+ *
+ * Calls and returns yield like SM_JUMP. Only a machine given a return stack
+ * with SM_SET_CALL_STACK() may call, at most SM_CALL_DEPTH deep. A call with
+ * no stack or a full one, or a return with nothing to return to, aborts the
+ * machine like SM_RETURN_ERROR, overflows are counted in the stack.
+ */
+#define SM_CALL(table) (sm_call_state), (state_func)(table)
+#define SM_CALL_SLOTS 2
+#define SM_RET (sm_ret_state)
+#define SM_RET_SKIP_JUMP (sm_ret_skip_jump_state)
+#endif
+/*
+ * read back a number stored in a table slot by the macros above, as the
+ * whole pointer sized value so it works for any endian and pointer size
+ */
+#define SM_TABLE_OPERAND(slot) ((uintptr_t)*(slot))
 /* if a state wants to skip the next 2 jumps, use this to return */
 #define SM_RETURN_SKIP_TWO_JUMPS 5
 /* if a state wants to skip the next jump, use this to return */
@@ -80,9 +114,37 @@
  * at least 16 bits long which is the number of ms elapsed.
  * The macros assume it is incremented every SM_TICK_RATE times pre second.
  */
-SM_TIMER_SIZE getms(); /* system specific function to read timer */
+SM_TIMER_SIZE getms(void); /* system specific function to read timer */
+#ifdef SM_SIMULATION
+/*
+ * Build everything with SM_SIMULATION and the ticks are a virtual clock that
+ * only moves when the simulator moves it (see smsim.h), getms() reads it
+ * too. A SM_DELAY_MS(3000) then takes no wall time at all.
+ */
+extern uint64_t sm_sim_now;
+#define READ_GLOBAL_TICKS ((SM_TIMER_SIZE)sm_sim_now)
+#endif
+#if defined(SM_CACHED_TICKS) && !defined(READ_GLOBAL_TICKS)
+/*
+ * Build everything with SM_CACHED_TICKS and READ_GLOBAL_TICKS is a load of
+ * this thread's copy of the ticks, read from the clock by SM_TICK_UPDATE().
+ * The schedulers do that once per pass, a hand written mainloop must do it
+ * every time round or the timers never finish.
+ */
+extern __thread SM_TIMER_SIZE sm_tick_now;
+#define READ_GLOBAL_TICKS sm_tick_now
+#endif
+#ifndef READ_GLOBAL_TICKS
 #define READ_GLOBAL_TICKS getms()
 #endif
+#endif
+/* refresh the cached ticks, returns them */
+SM_TIMER_SIZE sm_tick_update(void);
+#ifdef SM_CACHED_TICKS
+#define SM_TICK_UPDATE() ((void)sm_tick_update())
+#else
+#define SM_TICK_UPDATE() ((void)0)
+#endif
 
 #define SM_START_TIMER(sm, delay_) \
     do {    (sm)->start_timer=READ_GLOBAL_TICKS; \
@@ -135,25 +197,52 @@ SM_TIMER_SIZE getms(); /* system specific function to read timer */
 struct state_machine;
 typedef int (*state_func)(struct state_machine *sm);
 
+#ifdef SM_CALL_DEPTH
+struct sm_call_stack {
+    unsigned int depth;             /* calls not returned from yet */
+    unsigned long overflows;        /* calls refused, stack full */
+    state_func *ret[SM_CALL_DEPTH]; /* where each SM_RET goes */
+};
+#endif
+
 struct state_machine {
     state_func  *stateptrptr;   /* ptr to a table of state_func pointers */
     SM_TIMER_SIZE    start_timer;    /* save timer when started */
     SM_TIMER_SIZE    delay;          /* set number of ticks to wait from now */
+#ifdef SM_CALL_DEPTH
+    struct sm_call_stack *calls;     /* return stack, NULL if none */
+#endif
 };
 
+#ifdef SM_CALL_DEPTH
+/* let a machine SM_CALL, with an empty stack */
+#define SM_SET_CALL_STACK(sm, stack) \
+    do {    (stack)->depth = 0; \
+            (sm)->calls = (stack); \
+    } while (0)
+#endif
+
 /*
  * function prototypes (of state_func) for built-in state control
  */
 int sm_wait_ticks_state(struct state_machine *sm);
 int sm_delay_ticks_state(struct state_machine *sm);
 int sm_jump_table_state(struct state_machine *sm);
+#ifdef SM_CALL_DEPTH
+int sm_call_state(struct state_machine *sm);
+int sm_ret_state(struct state_machine *sm);
+int sm_ret_skip_jump_state(struct state_machine *sm);
+#endif
 
 /*  main state machine execution monitor
     call with every statemachine every mainloop
 
   returns the state status of the one state executed.
-  So if returns 0, it means the last state wants to be repeated,
-  if it returned >=1, the last state completed.
+  So if returns 0, it means the last state wants to be repeated, or the
+  machine went through an SM_JUMP: a state done (or skipping) into a jump
+  takes it in the same call and 0 is returned, so does a call that starts
+  on a jump. 0 is not "nothing happened", do not count completions by it.
+  if it returned >=1, the last state completed and the next slot is no jump.
   if it returns <0 but > -256 it is a state reported error condition
   if it returns <0 but < -257 (NULL_STATE_PTR_ERROR)
         ( means run_state does not have ptrs set correctly, yet)
@@ -165,4 +254,7 @@ int sm_jump_table_state(struct state_machine *sm);
 #define NULL_STATE_PTR_ERROR -257
 int sm_run_state(struct state_machine *sm);
 
+#ifdef __cplusplus
+}
+#endif
 #endif
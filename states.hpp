@@ -0,0 +1,431 @@
+/**********************************************************************
+ *
+ * Filename:    states.hpp
+ *
+ * Description: compile time state tables for C++ users, the table
+ *              vocabulary of states.h turned into a dispatcher with direct
+ *              calls and resolved jumps.
+ *
+ * Notes:       Needs C++17.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __STATES_HPP__
+#define __STATES_HPP__
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include "states.h"
+
+/*
+ * A table is a list of op types, one per SM_xxx table macro:
+ *
+ *      struct get_key : sm::program<
+ *          sm::set_timer_ms<3000>,         // SM_SET_TIMER_MS(3000)
+ *          sm::state<input_available>,     // input_available,
+ *          sm::jump<0>,                    // SM_JUMP(get_key), op index
+ *          sm::state<read_key>,
+ *          sm::jump_to<display_key>,       // SM_JUMP(display_key_table)
+ *          sm::delay_ms<10>                // SM_DELAY_MS(10)
+ *      > {};
+ *
+ * get_key::step(sm) does what sm_run_state() does, but the states are
+ * called directly from a switch on the table offset, SM_SET_TIMER_MS is
+ * done inline (no dispatch of its own) and jump targets are constants. As
+ * in sm_run_state(), a state done into a jump takes it in the same step,
+ * which then returns 0, and so does a step that finds a bare jump.
+ * sm_wait_ticks_state and the wait of sm::delay_ms are inlined too.
+ * get_key::run(sm) is the do/while mainloop around it.
+ *
+ * It is the same struct state_machine: get_key::table is laid out exactly
+ * like the C table the macros build, with a NULL end slot after it, and
+ * stateptrptr points into it. A machine done past the last op ends there. So a
+ * machine can be stepped by sm_run_state() or get_key::step() at any time,
+ * the scheduler parks it the same way, and a machine that jumps to a plain
+ * C table just falls back to sm_run_state().
+ */
+namespace sm {
+
+template <state_func F> struct state {};
+template <unsigned long Ms> struct delay_ms {};
+template <unsigned long Ms> struct set_timer_ms {};
+/* jump to op number Label (not table slot) of the same program */
+template <std::size_t Label> struct jump {};
+/* jump to the start of another program */
+template <class Program> struct jump_to {};
+
+namespace detail {
+
+template <class Op> struct op;
+
+template <state_func F> struct op<state<F>> {
+    static constexpr std::size_t slots = 1;
+    template <class Prog> static void fill(state_func *t)
+    {
+        t[0] = F;
+    }
+};
+
+template <unsigned long Ms> struct op<delay_ms<Ms>> {
+    static constexpr std::size_t slots = 3;
+    template <class Prog> static void fill(state_func *t)
+    {
+        t[0] = sm_delay_ticks_state;
+        t[1] = reinterpret_cast<state_func>(
+                static_cast<std::uintptr_t>(SM_MS_TO_TICKS(Ms)));
+        t[2] = sm_wait_ticks_state;
+    }
+};
+
+template <unsigned long Ms> struct op<set_timer_ms<Ms>> {
+    static constexpr std::size_t slots = 2;
+    template <class Prog> static void fill(state_func *t)
+    {
+        t[0] = sm_delay_ticks_state;
+        t[1] = reinterpret_cast<state_func>(
+                static_cast<std::uintptr_t>(SM_MS_TO_TICKS(Ms)));
+    }
+};
+
+template <std::size_t Label> struct op<jump<Label>> {
+    static constexpr std::size_t slots = 2;
+    template <class Prog> static void fill(state_func *t)
+    {
+        t[0] = sm_jump_table_state;
+        t[1] = reinterpret_cast<state_func>(Prog::table.data() +
+                                            Prog::offsets[Label]);
+    }
+};
+
+template <class Program> struct op<jump_to<Program>> {
+    static constexpr std::size_t slots = 2;
+    template <class Prog> static void fill(state_func *t)
+    {
+        t[0] = sm_jump_table_state;
+        t[1] = reinterpret_cast<state_func>(Program::table.data());
+    }
+};
+
+} // namespace detail
+
+template <class... Ops>
+struct program {
+    static_assert(sizeof...(Ops) > 0, "empty state table");
+    using ops = std::tuple<Ops...>;
+    static constexpr std::size_t nops = sizeof...(Ops);
+    static constexpr std::size_t nslots = (detail::op<Ops>::slots + ...);
+
+    /* table slot where each op starts, offsets[nops] is the table size */
+    static constexpr std::array<std::size_t, nops + 1> offsets = [] {
+        std::array<std::size_t, nops + 1> o{};
+        std::size_t slots[] = { detail::op<Ops>::slots... };
+
+        for (std::size_t i = 0; i < nops; i++)
+            o[i + 1] = o[i] + slots[i];
+        return o;
+    }();
+
+private:
+    template <std::size_t... I>
+    static void fill_ops(state_func *t, std::index_sequence<I...>)
+    {
+        (detail::op<Ops>::template fill<program>(t + offsets[I]), ...);
+    }
+
+public:
+    /* the plain table, what the SM_xxx macros would have built, and NULL */
+    static inline std::array<state_func, nslots + 1> table = [] {
+        std::array<state_func, nslots + 1> t{};
+
+        fill_ops(t.data(), std::make_index_sequence<nops>{});
+        return t;
+    }();
+
+    /* true if the machine is somewhere in this program, end slot too */
+    static bool owns(const struct state_machine *sm)
+    {
+        return sm->stateptrptr >= table.data() &&
+               sm->stateptrptr <= table.data() + nslots;
+    }
+
+    /*
+     * step - run ONE state, same contract as sm_run_state()
+     * Timer loads on the way cost no step of their own.
+     */
+    static int step(struct state_machine *sm)
+    {
+        bool jumped = false;
+
+        return step_jump(sm, jumped);
+    }
+
+    /*
+     * run - step until a state repeats, errors, the machine ends or a jump
+     * was taken. That is where the classic do/while mainloop around
+     * sm_run_state() stops too, so other machines still get their turn.
+     */
+    static int run(struct state_machine *sm)
+    {
+        int result;
+        bool jumped;
+
+        do {
+            jumped = false;
+            result = step_jump(sm, jumped);
+        } while (result > 0 && sm->stateptrptr && !jumped);
+        return result;
+    }
+
+    /* step() that tells if a jump was taken */
+    static int step_jump(struct state_machine *sm, bool &jumped)
+    {
+        /* only timer loads go round again, never more than ops in a row */
+        for (std::size_t hops = 0; hops <= nops; hops++) {
+            int result;
+
+            if (!sm->stateptrptr)
+                return -1;
+            if (!owns(sm))
+                return foreign(sm, jumped, std::make_index_sequence<nops>{});
+            if (sm->stateptrptr == table.data() + nslots) {
+                /* ran off the last op into the end slot */
+                sm->stateptrptr = nullptr;
+                return SM_RETURN_ERROR;
+            }
+            if (dispatch(sm, sm->stateptrptr - table.data(), result,
+                         jumped, std::make_index_sequence<nops>{}))
+                return result;
+        }
+        return SM_RETURN_REPEAT;
+    }
+
+private:
+    /* the state call, sm_run_state() does the same */
+    static int call(struct state_machine *sm, state_func f)
+    {
+        int result = f(sm);
+
+        if (result >= 0)
+            sm->stateptrptr += result;
+        else
+            sm->stateptrptr = nullptr;
+        return result;
+    }
+
+    static int wait(struct state_machine *sm)
+    {
+        if (SM_IS_TIMER_DONE(sm)) {
+            sm->stateptrptr += 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    /* the rest of a chain of jumps, as far as sm_run_state() goes */
+    static void follow(struct state_machine *sm, unsigned int hops)
+    {
+        while (hops-- && sm->stateptrptr &&
+               *sm->stateptrptr == sm_jump_table_state)
+            sm->stateptrptr =
+                    reinterpret_cast<state_func *>(sm->stateptrptr[1]);
+    }
+
+    /* op I is a jump somewhere, move the pc there */
+    template <std::size_t I>
+    static void take_jump(struct state_machine *sm)
+    {
+        using Op = std::tuple_element_t<I, ops>;
+
+        if constexpr (is_jump(static_cast<Op *>(nullptr)))
+            sm->stateptrptr = table.data() +
+                              offsets[label(static_cast<Op *>(nullptr))];
+        else
+            sm->stateptrptr = jump_target<Op>::type::table.data();
+        follow(sm, SM_JUMP_HOPS - 1);
+    }
+
+    /*
+     * op I went on by result slots, into a jump it takes it and yields.
+     * A state may have moved the machine itself (SM_SET_TABLE ...), then
+     * the pc is wherever that and the result put it, as in sm_run_state().
+     */
+    template <std::size_t I>
+    static int land(struct state_machine *sm, int result, bool &jumped)
+    {
+        if (result == SM_RETURN_DONE &&
+            sm->stateptrptr == table.data() + offsets[I + 1]) {
+            /* the usual case, known right here */
+            if constexpr (any_jump<I + 1>()) {
+                take_jump<I + 1>(sm);
+                jumped = true;
+                return SM_RETURN_REPEAT;
+            }
+            return result;
+        }
+        if (result > 0 && *sm->stateptrptr == sm_jump_table_state) {
+            follow(sm, SM_JUMP_HOPS);
+            jumped = true;
+            return SM_RETURN_REPEAT;
+        }
+        return result;
+    }
+
+    template <std::size_t I>
+    static constexpr bool any_jump()
+    {
+        if constexpr (I >= nops) {
+            return false;
+        } else {
+            using Op = std::tuple_element_t<I, ops>;
+
+            return is_jump(static_cast<Op *>(nullptr)) ||
+                   is_jump_to(static_cast<Op *>(nullptr));
+        }
+    }
+
+    /* returns true if op I ran a state, false if it only moved the pc */
+    template <std::size_t I>
+    static bool exec(struct state_machine *sm, std::size_t pc, int &result,
+                     bool &jumped)
+    {
+        using Op = std::tuple_element_t<I, ops>;
+        constexpr std::size_t at = offsets[I];
+
+        if constexpr (detail::op<Op>::slots == 1) {
+            constexpr state_func f = table_func(static_cast<Op *>(nullptr));
+
+            if constexpr (f == sm_wait_ticks_state)
+                result = wait(sm);
+            else
+                result = call(sm, f);
+            result = land<I>(sm, result, jumped);
+            return true;
+        } else if constexpr (is_delay(static_cast<Op *>(nullptr))) {
+            if (pc == at) {
+                SM_START_TIMER(sm, (SM_TIMER_SIZE)ticks(
+                                       static_cast<Op *>(nullptr)));
+                sm->stateptrptr = table.data() + at + 2;
+            }
+            result = land<I>(sm, wait(sm), jumped);
+            return true;
+        } else if constexpr (is_set_timer(static_cast<Op *>(nullptr))) {
+            SM_START_TIMER(sm, (SM_TIMER_SIZE)ticks(
+                                   static_cast<Op *>(nullptr)));
+            sm->stateptrptr = table.data() + at + 2;
+            return false;
+        } else {
+            /* sitting on a jump, it started here */
+            take_jump<I>(sm);
+            jumped = true;
+            result = SM_RETURN_REPEAT; /* as sm_run_state() does */
+            return true;
+        }
+    }
+
+    template <std::size_t... I>
+    static bool dispatch(struct state_machine *sm, std::size_t pc,
+                         int &result, bool &jumped,
+                         std::index_sequence<I...>)
+    {
+        bool ran = false;
+        /* a chain of compares against constants, compiled to a switch */
+        bool hit = ((entry<I>(pc) ? (ran = exec<I>(sm, pc, result, jumped),
+                                     true)
+                                  : false) || ...);
+
+        if (!hit) {
+            /* landed on an operand, the table or a return value is wrong */
+            sm->stateptrptr = nullptr;
+            result = SM_RETURN_ERROR;
+            return true;
+        }
+        return ran;
+    }
+
+    /* jumped out of this program, try the programs it jumps to directly */
+    template <std::size_t I>
+    static bool foreign_op(struct state_machine *sm, bool &jumped,
+                           int &result)
+    {
+        using Op = std::tuple_element_t<I, ops>;
+
+        if constexpr (is_jump_to(static_cast<Op *>(nullptr))) {
+            using Target = typename jump_target<Op>::type;
+
+            if (Target::owns(sm)) {
+                result = Target::step_jump(sm, jumped);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <std::size_t... I>
+    static int foreign(struct state_machine *sm, bool &jumped,
+                       std::index_sequence<I...>)
+    {
+        int result;
+
+        if ((foreign_op<I>(sm, jumped, result) || ...))
+            return result;
+        return sm_run_state(sm); /* a plain C table */
+    }
+
+    /* where a machine can be sitting in op I */
+    template <std::size_t I>
+    static constexpr bool entry(std::size_t pc)
+    {
+        using Op = std::tuple_element_t<I, ops>;
+
+        if constexpr (is_delay(static_cast<Op *>(nullptr)))
+            return pc == offsets[I] || pc == offsets[I] + 2;
+        else
+            return pc == offsets[I];
+    }
+
+    /* tag dispatch helpers, pick the op apart at compile time */
+    template <state_func F>
+    static constexpr state_func table_func(state<F> *) { return F; }
+    template <class Op>
+    static constexpr bool is_delay(Op *) { return false; }
+    template <unsigned long Ms>
+    static constexpr bool is_delay(delay_ms<Ms> *) { return true; }
+    template <class Op>
+    static constexpr bool is_set_timer(Op *) { return false; }
+    template <unsigned long Ms>
+    static constexpr bool is_set_timer(set_timer_ms<Ms> *) { return true; }
+    template <class Op>
+    static constexpr bool is_jump(Op *) { return false; }
+    template <std::size_t Label>
+    static constexpr bool is_jump(jump<Label> *) { return true; }
+    template <std::size_t Label>
+    static constexpr std::size_t label(jump<Label> *) { return Label; }
+    template <class Op>
+    static constexpr bool is_jump_to(Op *) { return false; }
+    template <class Target>
+    static constexpr bool is_jump_to(jump_to<Target> *) { return true; }
+    template <unsigned long Ms>
+    static constexpr unsigned long ticks(delay_ms<Ms> *)
+    {
+        return SM_MS_TO_TICKS(Ms);
+    }
+    template <unsigned long Ms>
+    static constexpr unsigned long ticks(set_timer_ms<Ms> *)
+    {
+        return SM_MS_TO_TICKS(Ms);
+    }
+    template <class Op> struct jump_target;
+    template <class Target> struct jump_target<jump_to<Target>> {
+        using type = Target;
+    };
+};
+
+} // namespace sm
+
+#endif //__STATES_HPP__
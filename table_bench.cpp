@@ -0,0 +1,183 @@
+/**********************************************************************
+ *
+ * Filename:    table_bench.cpp
+ *
+ * Description: dispatch cost of sm_run_state() against the compiled
+ *              tables of states.hpp.
+ *
+ * Notes:       Linux only, needs C++17.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -c states.c getms.c && \
+ *            g++ -std=c++17 -I . -O2 -Wall -Wextra -o table_bench \
+ *            table_bench.cpp states.o getms.o "
+ * run: " ./table_bench [machines [rounds]] "
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "states.hpp"
+#include "bench.h"
+
+struct bench_machine {
+    struct state_machine sm;
+    unsigned long work;
+};
+
+/* the useful work, the same states are used by both engines */
+static int count_state(struct state_machine *sm)
+{
+    struct bench_machine *bm = cast_p_to_outer(
+            struct state_machine *, sm, struct bench_machine, sm);
+
+    bm->work++;
+    return SM_RETURN_DONE;
+}
+
+static int skip_state(struct state_machine *sm)
+{
+    struct bench_machine *bm = cast_p_to_outer(
+            struct state_machine *, sm, struct bench_machine, sm);
+
+    bm->work++;
+    return SM_RETURN_SKIP_JUMP;
+}
+
+/* straight line of states, one jump per turn */
+extern state_func straight_table[];
+state_func straight_table[] = {
+    count_state, count_state, count_state, count_state,
+    count_state, count_state, count_state, count_state,
+    SM_JUMP(straight_table),
+};
+struct straight : sm::program<
+    sm::state<count_state>, sm::state<count_state>,
+    sm::state<count_state>, sm::state<count_state>,
+    sm::state<count_state>, sm::state<count_state>,
+    sm::state<count_state>, sm::state<count_state>,
+    sm::jump<0>> {};
+
+/* a jump for every state, skip over jumps like example.c does */
+extern state_func jump_a_table[];
+extern state_func jump_b_table[];
+state_func jump_a_table[] = {
+    skip_state,
+    SM_JUMP(jump_a_table),
+    count_state,
+    SM_JUMP(jump_b_table),
+};
+state_func jump_b_table[] = {
+    count_state,
+    SM_JUMP(jump_a_table),
+};
+struct jump_b;
+struct jump_a : sm::program<
+    sm::state<skip_state>,
+    sm::jump<0>,
+    sm::state<count_state>,
+    sm::jump_to<jump_b>> {};
+struct jump_b : sm::program<
+    sm::state<count_state>,
+    sm::jump_to<jump_a>> {};
+
+/* zero length delays and timer loads between states */
+extern state_func timer_table[];
+state_func timer_table[] = {
+    SM_SET_TIMER_MS(5000),
+    count_state,
+    SM_DELAY_MS(0),
+    count_state,
+    SM_JUMP(timer_table),
+};
+struct timer_prog : sm::program<
+    sm::set_timer_ms<5000>,
+    sm::state<count_state>,
+    sm::delay_ms<0>,
+    sm::state<count_state>,
+    sm::jump<0>> {};
+
+/* the classic mainloop over every machine */
+static void run_classic(std::vector<bench_machine> &fleet)
+{
+    for (auto &m : fleet) {
+        int ret;
+
+        do {
+            ret = sm_run_state(&m.sm);
+        } while (ret > 0 && m.sm.stateptrptr);
+    }
+}
+
+template <class Prog>
+static void run_compiled(std::vector<bench_machine> &fleet)
+{
+    for (auto &m : fleet)
+        Prog::run(&m.sm);
+}
+
+static unsigned long total_work(std::vector<bench_machine> &fleet)
+{
+    unsigned long work = 0;
+
+    for (auto &m : fleet)
+        work += m.work;
+    return work;
+}
+
+/* useful state calls of the last measure(), both engines must agree */
+static unsigned long last_work;
+
+/* ns per useful state call */
+template <class Run>
+static double measure(std::vector<bench_machine> &fleet, state_func *start,
+                      unsigned int rounds, Run run)
+{
+    uint64_t ns;
+
+    for (auto &m : fleet) {
+        m.sm.stateptrptr = start;
+        m.work = 0;
+    }
+    ns = bench_ns();
+    for (unsigned int r = 0; r < rounds; r++)
+        run(fleet);
+    ns = bench_ns() - ns;
+    last_work = total_work(fleet);
+    return (double)ns / last_work;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int machines = argc > 1 ? atoi(argv[1]) : 1000;
+    unsigned int rounds = argc > 2 ? atoi(argv[2]) : 10000;
+    std::vector<bench_machine> fleet(machines);
+    unsigned long work;
+    double c, p;
+
+    printf("table     sm_run_state  compiled  (ns per state)\n");
+    c = measure(fleet, straight_table, rounds, run_classic);
+    work = last_work;
+    p = measure(fleet, straight::table.data(), rounds,
+                run_compiled<straight>);
+    printf("straight  %12.2f %9.2f%s\n", c, p,
+           work == last_work ? "" : "  ran differently!");
+    c = measure(fleet, jump_a_table, rounds, run_classic);
+    work = last_work;
+    p = measure(fleet, jump_a::table.data(), rounds, run_compiled<jump_a>);
+    printf("jumps     %12.2f %9.2f%s\n", c, p,
+           work == last_work ? "" : "  ran differently!");
+    c = measure(fleet, timer_table, rounds, run_classic);
+    work = last_work;
+    p = measure(fleet, timer_prog::table.data(), rounds,
+                run_compiled<timer_prog>);
+    printf("timers    %12.2f %9.2f%s\n", c, p,
+           work == last_work ? "" : "  ran differently!");
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**********************************************************************
+ *
+ * Filename:    tmwheel.c
+ *
+ * Description: hierarchical timing wheel for state machine timers.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#include "tmwheel.h"
+
+#define TMW_LEVEL_SHIFT(level) ((level) * TMW_SLOT_BITS)
+
+/* index of lowest set bit, bits must not be 0 */
+static unsigned int tmw_ffs(uint64_t bits)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(bits);
+#else
+    unsigned int n = 0;
+
+    while (!(bits & 1)) {
+        bits >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/*
+ * distance (1..TMW_SLOTS) from slot cur to the next occupied slot after it,
+ * wrapping around, 0 if the level is empty
+ */
+static unsigned int tmw_next_slot(uint64_t occupied, unsigned int cur)
+{
+    uint64_t rot;
+    unsigned int shift = (cur + 1) & TMW_SLOT_MASK;
+
+    if (!occupied)
+        return 0;
+    rot = shift ? (occupied >> shift) | (occupied << (TMW_SLOTS - shift))
+                : occupied;
+    return tmw_ffs(rot) + 1;
+}
+
+void tmw_init(struct tmwheel *wheel)
+{
+    int level, slot;
+
+    wheel->now = 0;
+    wheel->count = 0;
+    for (level = 0; level < TMW_LEVELS; level++) {
+        wheel->occupied[level] = 0;
+        for (slot = 0; slot < TMW_SLOTS; slot++)
+            cdll_init(&wheel->slots[level][slot]);
+    }
+}
+
+void tmw_timer_init(struct tmw_timer *timer)
+{
+    cdll_init(&timer->node);
+    timer->expires = 0;
+    timer->level = 0;
+    timer->slot = 0;
+    timer->pending = 0;
+}
+
+/* hang timer on the slot matching its expiry, relative to wheel->now */
+static void tmw_place(struct tmwheel *wheel, struct tmw_timer *timer)
+{
+    uint32_t delta = timer->expires - wheel->now;
+    uint32_t when = timer->expires;
+    unsigned int level = 0;
+
+    if (delta > TMW_MAX_TICKS) {
+        /* too far out, park it at the end and place it again later */
+        when = wheel->now + TMW_MAX_TICKS;
+        delta = TMW_MAX_TICKS;
+    }
+    while (delta >> TMW_LEVEL_SHIFT(level + 1))
+        level++;
+    timer->level = level;
+    timer->slot = (when >> TMW_LEVEL_SHIFT(level)) & TMW_SLOT_MASK;
+    cdll_insert_node_tail(&timer->node, &wheel->slots[level][timer->slot]);
+    wheel->occupied[level] |= (uint64_t)1 << timer->slot;
+}
+
+static void tmw_unlink(struct tmwheel *wheel, struct tmw_timer *timer)
+{
+    struct cdll *slot = &wheel->slots[timer->level][timer->slot];
+
+    cdll_delete_node(&timer->node);
+    if (cdll_empty(slot))
+        wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+}
+
+void tmw_add(struct tmwheel *wheel, struct tmw_timer *timer, uint32_t ticks)
+{
+    if (timer->pending)
+        tmw_cancel(wheel, timer);
+    if (!ticks)
+        ticks = 1;
+    timer->expires = wheel->now + ticks;
+    timer->pending = 1;
+    wheel->count++;
+    tmw_place(wheel, timer);
+}
+
+void tmw_cancel(struct tmwheel *wheel, struct tmw_timer *timer)
+{
+    if (!timer->pending)
+        return;
+    tmw_unlink(wheel, timer);
+    timer->pending = 0;
+    wheel->count--;
+}
+
+/* empty one slot, placing each timer again, now on a lower level */
+static void tmw_cascade(struct tmwheel *wheel, unsigned int level,
+                        unsigned int slot)
+{
+    struct cdll list;
+    struct cdll *head = &wheel->slots[level][slot];
+
+    if (cdll_empty(head))
+        return;
+    /* move the whole slot aside first, placing may land in this slot */
+    cdll_init(&list);
+    cdll_insert_node_tail(&list, head);
+    cdll_delete_node(head);
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    while (!cdll_empty(&list)) {
+        struct tmw_timer *timer = cast_cdll_to_tmw_timer(list.next);
+
+        cdll_delete_node(&timer->node);
+        tmw_place(wheel, timer);
+    }
+}
+
+/* advance exactly one tick */
+static void tmw_tick(struct tmwheel *wheel, struct cdll *expired)
+{
+    unsigned int level, slot;
+    struct cdll *head;
+
+    wheel->now++;
+    for (level = 1; level < TMW_LEVELS; level++) {
+        if (wheel->now & ((1UL << TMW_LEVEL_SHIFT(level)) - 1))
+            break; /* lower level has not wrapped */
+        tmw_cascade(wheel, level,
+                    (wheel->now >> TMW_LEVEL_SHIFT(level)) & TMW_SLOT_MASK);
+    }
+    slot = wheel->now & TMW_SLOT_MASK;
+    head = &wheel->slots[0][slot];
+    while (!cdll_empty(head)) {
+        struct tmw_timer *timer = cast_cdll_to_tmw_timer(head->next);
+
+        cdll_delete_node(&timer->node);
+        timer->pending = 0;
+        wheel->count--;
+        cdll_insert_node_tail(&timer->node, expired);
+    }
+    wheel->occupied[0] &= ~((uint64_t)1 << slot);
+}
+
+void tmw_advance(struct tmwheel *wheel, uint32_t ticks, struct cdll *expired)
+{
+    while (ticks) {
+        uint32_t skip = tmw_next(wheel);
+
+        if (skip > ticks) {
+            /* nothing happens in between, just move time */
+            wheel->now += ticks;
+            return;
+        }
+        wheel->now += skip - 1;
+        ticks -= skip;
+        tmw_tick(wheel, expired);
+    }
+}
+
+uint32_t tmw_next(struct tmwheel *wheel)
+{
+    uint32_t best = TMW_NO_TIMER;
+    unsigned int level;
+
+    if (!wheel->count)
+        return TMW_NO_TIMER;
+    for (level = 0; level < TMW_LEVELS; level++) {
+        unsigned int shift = TMW_LEVEL_SHIFT(level);
+        unsigned int cur = (wheel->now >> shift) & TMW_SLOT_MASK;
+        unsigned int dist = tmw_next_slot(wheel->occupied[level], cur);
+        uint32_t when;
+
+        if (!dist)
+            continue;
+        /* level 0 expires at the slot, upper levels cascade at its start */
+        when = (((wheel->now >> shift) + dist) << shift) - wheel->now;
+        if (when < best)
+            best = when;
+    }
+    return best;
+}
@@ -0,0 +1,83 @@
+/**********************************************************************
+ *
+ * Filename:    tmwheel.h
+ *
+ * Description: hierarchical timing wheel for state machine timers.
+ *
+ * Notes:       This software should be portable to Posix compatible systems.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+#ifndef __TMWHEEL_H__
+#define __TMWHEEL_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "cdll.h"
+
+/*
+ * Timers hang off cdll slots of TMW_LEVELS wheels with TMW_SLOTS slots each.
+ * Level 0 has one slot per tick, every level above has one slot per full
+ * turn of the level below. Insert and cancel are a list insert/delete, a
+ * tick only looks at one slot (and once per turn cascades a slot of the
+ * next level down), so a timer costs nothing while it waits.
+ *
+ * Wheel time is a free running 32 bit tick count, the owner decides what a
+ * tick is and calls tmw_advance() with the elapsed ticks.
+ */
+#define TMW_SLOT_BITS   6
+#define TMW_SLOTS       (1 << TMW_SLOT_BITS)
+#define TMW_SLOT_MASK   (TMW_SLOTS - 1)
+#ifndef TMW_LEVELS
+#define TMW_LEVELS      4   /* 24 bits, longer timers get recascaded */
+#endif
+#define TMW_MAX_TICKS   ((1UL << (TMW_SLOT_BITS * TMW_LEVELS)) - 1)
+/* tmw_next() value when no timer is pending */
+#define TMW_NO_TIMER    0xffffffffUL
+
+struct tmw_timer {
+    struct cdll node;           /* links timer into its wheel slot */
+    uint32_t expires;           /* absolute wheel tick */
+    unsigned char level;        /* where it sits, needed for cancel */
+    unsigned char slot;
+    unsigned char pending;      /* non zero while on the wheel */
+};
+
+struct tmwheel {
+    uint32_t now;               /* current wheel tick */
+    unsigned long count;        /* timers on the wheel */
+    uint64_t occupied[TMW_LEVELS]; /* bit per non empty slot */
+    struct cdll slots[TMW_LEVELS][TMW_SLOTS];
+};
+
+#define cast_cdll_to_tmw_timer(pt) (cast_p_to_outer( \
+            struct cdll *, pt, \
+            struct tmw_timer, node))
+
+void tmw_init(struct tmwheel *wheel);
+void tmw_timer_init(struct tmw_timer *timer);
+/*
+ * tmw_add - start a timer
+ * ticks: from now, 0 is treated as 1 (the current tick is already done)
+ */
+void tmw_add(struct tmwheel *wheel, struct tmw_timer *timer, uint32_t ticks);
+/* stop a timer, harmless if it is not pending */
+void tmw_cancel(struct tmwheel *wheel, struct tmw_timer *timer);
+/*
+ * tmw_advance - move wheel time forward
+ * ticks: elapsed since last advance
+ * expired: list head, expired timers are appended (fifo) via their node
+ */
+void tmw_advance(struct tmwheel *wheel, uint32_t ticks, struct cdll *expired);
+/*
+ * tmw_next - ticks until the wheel has work to do
+ * Exact for timers within one level 0 turn, otherwise the time of the next
+ * cascade, which is never later than the earliest timer. So it is always
+ * safe to sleep this long. Returns TMW_NO_TIMER if the wheel is empty.
+ */
+uint32_t tmw_next(struct tmwheel *wheel);
+
+#endif //__TMWHEEL_H__
@@ -0,0 +1,145 @@
+/**********************************************************************
+ *
+ * Filename:    tscan_bench.c
+ *
+ * Description: timer expiry scan, SM_IS_TIMER_DONE() per machine versus
+ *              the vector scan over timer arrays.
+ *
+ * Notes:       Linux only.
+ *
+ *
+ * Copyright (c) 2018 by Steve Calfee.  This software is placed into
+ * the public domain and may be used for any purpose.  However, this
+ * notice must not be changed or removed and no warranty is either
+ * expressed or implied by its publication or distribution.
+ **********************************************************************/
+
+/*
+ * compile: " gcc -I . -O2 -march=native -Wall -Wextra -o tscan_bench \
+ *            tscan_bench.c smtscan.c getms.c "
+ *          add -DSM_TIMER_SIZE=uint32_t to try other timer widths
+ * run: " ./tscan_bench "
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smtscan.h"
+#include "bench.h"
+
+#define REPS_TIMERS 50000000UL  /* timers tested per measurement */
+#define CHECK_TIMERS 1000       /* longest array checked, lengths 0 .. */
+
+/* random over the whole timer range, so the wraparound gets tested too */
+static SM_TIMER_SIZE random_ticks(void)
+{
+    uint64_t v = (uint64_t)rand() << 42 ^ (uint64_t)rand() << 21 ^ rand();
+
+    return (SM_TIMER_SIZE)v;
+}
+
+/* the vector scan must agree with the scalar one, returns 0 if it does */
+static int check_scan(const SM_TIMER_SIZE *start, const SM_TIMER_SIZE *delay,
+                      size_t n, SM_TIMER_SIZE now)
+{
+    uint64_t *want = malloc((SM_TSCAN_WORDS(n) + 1) * sizeof(*want));
+    uint64_t *got = malloc((SM_TSCAN_WORDS(n) + 1) * sizeof(*got));
+    size_t words = SM_TSCAN_WORDS(n) * sizeof(*want);
+    int bad;
+
+    bad = !want || !got ||
+          sm_timer_scan_scalar(start, delay, n, now, want) !=
+          sm_timer_scan(start, delay, n, now, got) ||
+          memcmp(want, got, words);
+    free(want);
+    free(got);
+    return bad;
+}
+
+/* every length up to CHECK_TIMERS, at a few offsets into a vector */
+static int check_lengths(void)
+{
+    SM_TIMER_SIZE start[CHECK_TIMERS + 32], delay[CHECK_TIMERS + 32], now;
+    size_t n, off;
+    int bad = 0;
+
+    srand(2);
+    for (n = 0; n < CHECK_TIMERS + 32; n++) {
+        start[n] = random_ticks();
+        /* short delays too, or nearly every timer is far from done */
+        delay[n] = rand() & 1 ? random_ticks() : (SM_TIMER_SIZE)(rand() % 8);
+    }
+    for (n = 0; n <= CHECK_TIMERS; n++) {
+        for (off = 0; off < 32; off += 7) {
+            now = rand() & 1 ? random_ticks() : start[off] + rand() % 8;
+            bad |= check_scan(start + off, delay + off, n, now);
+        }
+    }
+    return bad;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 10000, 100000, 1000000 };
+    unsigned int z;
+
+    printf("timer %zu bits, vector code %s\n", sizeof(SM_TIMER_SIZE) * 8,
+           sm_timer_scan_isa());
+    if (check_lengths()) {
+        printf("vector scan differs from the scalar scan!\n");
+        return 1;
+    }
+    for (z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+        size_t n = sizes[z];
+        unsigned long reps = REPS_TIMERS / n, r;
+        struct state_machine *sms = malloc(n * sizeof(*sms));
+        SM_TIMER_SIZE *start = malloc(n * sizeof(*start));
+        SM_TIMER_SIZE *delay = malloc(n * sizeof(*delay));
+        uint64_t *mask = malloc(SM_TSCAN_WORDS(n) * sizeof(*mask));
+        SM_TIMER_SIZE now = READ_GLOBAL_TICKS;
+        uint64_t t0, macro_ns, scalar_ns, vec_ns;
+        size_t i, done;
+
+        srand(1);
+        for (i = 0; i < n; i++) {
+            SM_START_TIMER(&sms[i], rand() % 100);
+            sms[i].start_timer -= rand() % 100;
+            start[i] = sms[i].start_timer;
+            delay[i] = sms[i].delay;
+        }
+
+        /* what states do today, one machine and one clock read at a time */
+        done = 0;
+        t0 = bench_ns();
+        for (r = 0; r < reps; r++) {
+            for (i = 0; i < n; i++)
+                done += SM_IS_TIMER_DONE(&sms[i]);
+        }
+        macro_ns = bench_ns() - t0;
+        bench_keep(done);
+
+        t0 = bench_ns();
+        for (r = 0; r < reps; r++)
+            done += sm_timer_scan_scalar(start, delay, n, now, mask);
+        scalar_ns = bench_ns() - t0;
+        bench_keep(done);
+
+        t0 = bench_ns();
+        for (r = 0; r < reps; r++)
+            done += sm_timer_scan(start, delay, n, now, mask);
+        vec_ns = bench_ns() - t0;
+        bench_keep(done);
+
+        if (check_scan(start, delay, n, now))
+            printf("vector scan differs from the scalar scan!\n");
+        printf("%7zu timers: macro %.3f ns/timer, scalar scan %.3f, "
+               "vector scan %.3f (%.1fx scalar, %.1fx macro)\n", n,
+               (double)macro_ns / (reps * n), (double)scalar_ns / (reps * n),
+               (double)vec_ns / (reps * n), (double)scalar_ns / vec_ns,
+               (double)macro_ns / vec_ns);
+        free(sms);
+        free(start);
+        free(delay);
+        free(mask);
+    }
+    return 0;
+}